@@ -40,9 +40,15 @@
 #include "InfoNES_Mapper.h"
 #include "InfoNES_pAPU.h"
 #include "K6502.h"
+#include "InfoNES_Composite.h"
 #include <assert.h>
 #include <pico.h>
+#include <hardware/timer.h>
+#include <array>
+#include <atomic>
 #include <tuple>
+#include <type_traits>
+#include <utility>
 
 #include <util/work_meter.h>
 
@@ -83,6 +89,14 @@ BYTE *ROMBANK[4];
 // BYTE *ROMBANK2;
 // BYTE *ROMBANK3;
 
+/* CPU memory map */
+BYTE *CPU_ReadPage[256];
+BYTE *CPU_WritePage[256];
+
+/* Banks currently developed in CPU memory map */
+static BYTE *CPU_MapROMBANK[4];
+static BYTE *CPU_MapSRAMBANK;
+
 /*-------------------------------------------------------------------*/
 /*  PPU resources                                                    */
 /*-------------------------------------------------------------------*/
@@ -163,7 +177,47 @@ BYTE PPU_UpDown_Clip;
 
 /* Frame IRQ ( 0: Disabled, 1: Enabled )*/
 BYTE FrameIRQ_Enable;
-WORD FrameStep;
+
+#if INFONES_PPU_CATCHUP
+/* The state of the PPU that a scanline is rendered from */
+struct PPU_LineState_tag
+{
+  BYTE *pbyBank[16]; /* PPUBANK[] */
+  WORD wAddr;        /* PPU_Addr */
+  BYTE byR0;         /* PPU_R0 */
+  BYTE byR1;         /* PPU_R1 */
+  BYTE byScrHBit;    /* PPU_Scr_H_Bit */
+  WORD wX;           /* The pixel that the next state starts at ( log entries ) */
+};
+
+/* The states before the writes that changed the scanline being drawn */
+static struct PPU_LineState_tag PPU_Log[INFONES_PPU_LOG_SIZE];
+static int PPU_LogCount;
+
+/* Writes to the PPU and the mapper are logged */
+BYTE PPU_LogEnable;
+
+/* A scanline that the renderer draws later */
+static bool scanlineDrawn(int nLine)
+{
+  return FrameCnt == 0 && PPU_ScanTable[nLine] == SCAN_ON_SCREEN && nLine >= 4 && nLine < 240 - 4;
+}
+#endif
+
+/*-------------------------------------------------------------------*/
+/*  Scheduler resources                                              */
+/*-------------------------------------------------------------------*/
+
+/* Scheduled events */
+struct InfoNES_Event_tag
+{
+  QWORD qwDeadline;   /* Master clock, EVENT_NONE if not scheduled */
+  void (*pHandler)(); /* NULL for EVENT_SCANLINE */
+};
+static struct InfoNES_Event_tag Events[EVENT_COUNT];
+
+/* Deadline of the event being run */
+static QWORD EventClock;
 
 /*-------------------------------------------------------------------*/
 /*  Display and Others resouces                                      */
@@ -173,6 +227,56 @@ WORD FrameStep;
 WORD FrameSkip;
 WORD FrameCnt;
 
+/* Frames emulated since the reset, the skipped ones included */
+DWORD EmulatedFrames;
+
+/* The number of the CPU clocks that idle loops skipped in the last frame */
+DWORD IdleClocksPerFrame;
+
+/* Instruction fetches served by the instruction cache in the last frame, and the others */
+DWORD DecodeHitsPerFrame;
+DWORD DecodeMissesPerFrame;
+
+/* Microseconds that K6502_Step() took in the last frame, and the CPU clocks of it */
+DWORD CpuMicrosPerFrame;
+DWORD CpuClocksPerFrame;
+
+/* Microseconds in K6502_Step() and the CPU clocks at the start of this frame */
+static DWORD CpuMicros;
+static QWORD CpuFrameClocks;
+
+#if INFONES_AUTO_FRAMESKIP
+/* Microseconds of a frame at 60.0988Hz */
+#define FRAME_BUDGET_MICROS 16639
+
+/* Frames in a row that ask for a higher frame skip before it is raised, and for a lower one */
+#define FRAMESKIP_RAISE_FRAMES 8
+#define FRAMESKIP_LOWER_FRAMES 120
+
+/* Microseconds that core0 took for the last frame, the waits for the other core and the pacing excluded */
+DWORD FrameMicros;
+
+/* Drawn frames with the frames skipped after them that took longer than their budget, since the reset */
+DWORD FrameDeadlineMisses;
+
+/* time_us_32() at the start of this frame, and the time of this frame that core0 waited */
+static DWORD FrameStartMicros;
+static DWORD FrameIdleMicros;
+
+/* time_us_32() that this frame ends at in real time */
+static DWORD FrameDeadline;
+
+/* Microseconds of the frames from the last drawn one */
+static DWORD FrameCycleMicros;
+
+/* Averages of the drawn frames and of the skipped ones */
+static DWORD DrawnFrameMicros;
+static DWORD SkippedFrameMicros;
+
+/* Frames in a row that asked for a higher frame skip ( > 0 ) or a lower one ( < 0 ) */
+static int FrameSkipVotes;
+#endif
+
 /* Display Buffer */
 #if 0
 WORD DoubleFrame[ 2 ][ NES_DISP_WIDTH * NES_DISP_HEIGHT ];
@@ -185,6 +289,9 @@ uint8_t *WorkLine8 = nullptr;
 void __not_in_flash_func(InfoNES_SetLineBuffer)(WORD *p, uint8_t *p8, WORD size)
 {
   assert(size >= NES_DISP_WIDTH);
+#if INFONES_DRAW8
+  assert((reinterpret_cast<uintptr_t>(p8) & 3) == 0);
+#endif
   WorkLine = p;
   WorkLine8 = p8;
 }
@@ -196,10 +303,126 @@ BYTE ChrBuf[256 * 2 * 8 * 8];
 /* Update flag for ChrBuf */
 BYTE ChrBufUpdate;
 
+#if INFONES_CHR_CACHE
+/* Pattern banks decoded to 2 bits a pixel ( 8 rows of 64 tiles, the left pixel in the top bits ) */
+static WORD ChrCache[INFONES_CHR_CACHE_SLOTS][64 * 8];
+
+/* Source bank of every slot ( NULL: empty ), and when it was mapped the last time */
+static const BYTE *ChrCacheKey[INFONES_CHR_CACHE_SLOTS];
+static DWORD ChrCacheStamp[INFONES_CHR_CACHE_SLOTS];
+static DWORD ChrCacheClock;
+
+/* PPUBANK[0] - PPUBANK[7] that the slots are mapped for ( NULL: not mapped ) */
+static const BYTE *ChrCacheSrc[8];
+static int ChrCacheSlot[8];
+
+/* A bank switch needs a slot that none of the other 7 banks is on */
+static_assert(INFONES_CHR_CACHE_SLOTS >= 8, "INFONES_CHR_CACHE_SLOTS must be 8 or more");
+
+const DWORD ChrCacheBytes = sizeof ChrCache;
+
+/* Bank switches that found the bank in the cache, and the others */
+DWORD ChrCacheHits;
+DWORD ChrCacheMisses;
+DWORD ChrCacheHitsPerFrame;
+DWORD ChrCacheMissesPerFrame;
+#endif
+
 /* Palette Table */
+#if !INFONES_DRAW8
 WORD PalTable[32];
+#endif
 uint8_t PalTable8[32];
 
+#if INFONES_DRAW8 && INFONES_BG_CACHE
+/* Name tables #0 - #3 of PPURAM pre-rendered, 4 bits a pixel ( palette << 2 | colour, the left pixel in the low bits ) */
+#define BG_CACHE_PITCH (NES_DISP_WIDTH / 2)
+static BYTE BgCache[INFONES_BG_CACHE_PAGES][NES_DISP_HEIGHT * BG_CACHE_PITCH];
+
+/* Tiles to render again ( bit n of a row of tiles: tile n ) */
+static uint32_t BgCacheDirty[INFONES_BG_CACHE_PAGES][30];
+
+/* Update flag for the background cache */
+BYTE BgCacheUpdate;
+
+/* Pattern banks that the tiles are rendered from */
+static BYTE *BgCacheBank[4];
+
+/* 2 pixels of the cache to palette indices, and the palettes of it */
+static WORD BgCachePal[256];
+static BYTE BgCachePalSrc[16];
+
+const DWORD BgCacheBytes = sizeof BgCache + sizeof BgCacheDirty + sizeof BgCachePal;
+
+/* Tiles served and rendered again, and scanlines rendered without the cache */
+DWORD BgCacheHits;
+DWORD BgCacheMisses;
+DWORD BgCacheBypasses;
+DWORD BgCacheHitsPerFrame;
+DWORD BgCacheMissesPerFrame;
+DWORD BgCacheBypassesPerFrame;
+
+/*===================================================================*/
+/*                                                                   */
+/*     InfoNES_BgCacheWrite() : A name table byte was written        */
+/*                                                                   */
+/*===================================================================*/
+void __not_in_flash_func(InfoNES_BgCacheWrite)(const BYTE *pbyAddr)
+{
+  /*
+ *  Mark the tiles of a name table byte to be rendered again
+ *
+ *  Parameters
+ *    const BYTE *pbyAddr            (Read)
+ *      Address of the byte ( in PPUBANK[], only PPURAM name tables are cached )
+ */
+
+  const unsigned nOfs = pbyAddr - &PPURAM[NAME_TABLE0 * 0x400];
+  if (nOfs >= INFONES_BG_CACHE_PAGES * 0x400)
+    return;
+
+  uint32_t *pDirty = BgCacheDirty[nOfs >> 10];
+  const int nByte = nOfs & 0x3ff;
+  if (nByte < 0x3c0)
+  {
+    // Name
+    pDirty[nByte >> 5] |= 1u << (nByte & 31);
+  }
+  else
+  {
+    // Attribute of 4x4 tiles
+    const int nRow = ((nByte - 0x3c0) >> 3) << 2;
+    const uint32_t dwTiles = 0xfu << ((nByte & 7) << 2);
+    for (int nY = nRow; nY < nRow + 4 && nY < 30; ++nY)
+      pDirty[nY] |= dwTiles;
+  }
+}
+#endif
+
+#if INFONES_SPRITE_BINS
+/* Update flag for the sprite bins */
+BYTE SprBinUpdate;
+
+/* Sprites on every scanline, in drawing order ( SprList[SprLineStart[n]] - SprList[SprLineStart[n + 1] - 1] ) */
+static WORD SprLineStart[NES_DISP_HEIGHT + 1];
+static BYTE SprList[64 * 16];
+
+/* Horizontal span of the sprites on every scanline ( X of the leftmost and the rightmost sprite ) */
+static BYTE SprLineMinX[NES_DISP_HEIGHT];
+static BYTE SprLineMaxX[NES_DISP_HEIGHT];
+
+/* Sprite height that the bins are for */
+static WORD SprBinHeight;
+
+/* Decoded rows of the sprites, flipped, 2 bits a pixel from the left ( valid if set in SprRowsValid ) */
+static WORD SprRows[64][16];
+QWORD SprRowsValid;
+
+/* Pattern banks and sprite bits of PPU_R0 that the decoded rows are from */
+static BYTE *SprRowsBank[8];
+static BYTE SprRowsR0;
+#endif
+
 /* Table for Mirroring */
 BYTE PPU_MirrorTable[][4] =
     {
@@ -250,6 +473,8 @@ void (*MapperHSync)();
 void (*MapperPPU)(WORD wAddr); // mapper 96だけ？
 /* Callback at Rendering Screen 1:BG, 0:Sprite */
 void (*MapperRenderScreen)(BYTE byMode);
+/* Callbacks to be called ( MAPPER_CAP_* ), the renderer and the scheduler skip the others */
+BYTE MapperCaps;
 
 /*-------------------------------------------------------------------*/
 /*  ROM information                                                  */
@@ -416,6 +641,25 @@ int InfoNES_Reset()
   // Reset frame skip and frame count
   FrameSkip = 0;
   FrameCnt = 0;
+  EmulatedFrames = 0;
+  IdleClocksPerFrame = 0;
+  DecodeHitsPerFrame = DecodeMissesPerFrame = 0;
+#if INFONES_DRAW8 && INFONES_BG_CACHE
+  BgCacheHitsPerFrame = BgCacheMissesPerFrame = BgCacheBypassesPerFrame = 0;
+#endif
+#if INFONES_CHR_CACHE
+  ChrCacheHitsPerFrame = ChrCacheMissesPerFrame = 0;
+#endif
+  CpuMicrosPerFrame = CpuClocksPerFrame = 0;
+  CpuMicros = 0;
+  CpuFrameClocks = getPassedClocks();
+#if INFONES_AUTO_FRAMESKIP
+  FrameMicros = FrameDeadlineMisses = 0;
+  FrameStartMicros = FrameDeadline = time_us_32();
+  FrameIdleMicros = FrameCycleMicros = 0;
+  DrawnFrameMicros = SkippedFrameMicros = 0;
+  FrameSkipVotes = 0;
+#endif
 
 #if 0
   // Reset work frame
@@ -427,7 +671,9 @@ int InfoNES_Reset()
   ChrBufUpdate = 0xff;
 
   // Reset palette table
+#if !INFONES_DRAW8
   InfoNES_MemorySet(PalTable, 0, sizeof PalTable);
+#endif
   InfoNES_MemorySet(PalTable8, 0, sizeof PalTable8);
 
   // Reset APU register
@@ -443,12 +689,24 @@ int InfoNES_Reset()
 
   InfoNES_SetupPPU();
 
+  /*-------------------------------------------------------------------*/
+  /*  Initialize CPU memory map                                        */
+  /*-------------------------------------------------------------------*/
+
+  InfoNES_SetupCpuMap();
+
   /*-------------------------------------------------------------------*/
   /*  Initialize pAPU                                                  */
   /*-------------------------------------------------------------------*/
 
   InfoNES_pAPUInit();
 
+  /*-------------------------------------------------------------------*/
+  /*  Initialize Scheduler                                             */
+  /*-------------------------------------------------------------------*/
+
+  InfoNES_SetupEvents();
+
   /*-------------------------------------------------------------------*/
   /*  Initialize Mapper                                                */
   /*-------------------------------------------------------------------*/
@@ -470,10 +728,24 @@ int InfoNES_Reset()
   // Set up a mapper initialization function
   MapperTable[nIdx].pMapperInit();
 
+  // Callbacks that do something
+  MapperCaps = (MapperPPU != Map0_PPU ? MAPPER_CAP_PPU : 0) |
+               (MapperRenderScreen != Map0_RenderScreen ? MAPPER_CAP_RENDER_SCREEN : 0) |
+               (MapperHSync != Map0_HSync ? MAPPER_CAP_HSYNC : 0);
+
+  // Develop the initial banks in CPU memory map
+  InfoNES_SyncCpuMap();
+
   /*-------------------------------------------------------------------*/
   /*  Reset CPU                                                        */
   /*-------------------------------------------------------------------*/
 
+  // Interpreter of the mapper
+  K6502_SelectCore();
+
+  // Recompiled code runs if it was generated from this ROM
+  K6502_AotSelect(ROM, NesHeader.byRomSize * 0x4000);
+
   K6502_Reset();
 
   // Successful
@@ -493,6 +765,11 @@ void InfoNES_SetupPPU()
  */
   int nPage;
 
+#if INFONES_DEFERRED_RENDER
+  // Scanlines of the former game
+  InfoNES_DeferredFlush();
+#endif
+
   // Clear PPU and Sprite Memory
   InfoNES_MemorySet(PPURAM, 0, sizeof PPURAM);
   InfoNES_MemorySet(SPRRAM, 0, sizeof SPRRAM);
@@ -503,10 +780,15 @@ void InfoNES_SetupPPU()
   // Reset latch flag
   PPU_Latch_Flag = 0;
 
+#if INFONES_PPU_CATCHUP
+  // Nothing logged until a scanline to be drawn
+  PPU_LogEnable = 0;
+  PPU_LogCount = 0;
+#endif
+
   // Reset up and down clipping flag
   PPU_UpDown_Clip = 0;
 
-  FrameStep = 0;
   FrameIRQ_Enable = 0;
 
   // Reset Scroll values
@@ -531,6 +813,12 @@ void InfoNES_SetupPPU()
   PPU_BG_Base = ChrBuf;
   PPU_SP_Base = ChrBuf + 256 * 64;
   PPU_SP_Height = 8;
+#if INFONES_SPRITE_BINS
+  SprBinUpdate = 1;
+#endif
+#if INFONES_DRAW8 && INFONES_BG_CACHE
+  BgCacheUpdate = 1;
+#endif
 
   // Reset PPU banks
   for (nPage = 0; nPage < 16; ++nPage)
@@ -543,6 +831,301 @@ void InfoNES_SetupPPU()
   byVramWriteEnable = (NesHeader.byVRomSize == 0) ? 1 : 0;
 }
 
+/*===================================================================*/
+/*                                                                   */
+/*           InfoNES_SetupCpuMap() : Initialize CPU memory map       */
+/*                                                                   */
+/*===================================================================*/
+void InfoNES_SetupCpuMap()
+{
+  /*
+ *  Initialize CPU memory map
+ *
+ *  Remarks
+ *    Every 256 bytes page points directly at its memory, or is NULL
+ *    when K6502_Read/Write have to decode the address.
+ *    RAM pages are fixed, ROM and SRAM pages follow ROMBANK and
+ *    SRAMBANK in InfoNES_SyncCpuMap().
+ */
+  int nPage;
+
+  for (nPage = 0; nPage < 256; ++nPage)
+  {
+    if (nPage < 0x20)
+    {
+      // RAM ( 0x800 - 0x1fff is mirror of 0x0 - 0x7ff )
+      CPU_ReadPage[nPage] = CPU_WritePage[nPage] = &RAM[(nPage & 7) << 8];
+    }
+    else
+    {
+      // I/O, SRAM and ROM
+      CPU_ReadPage[nPage] = CPU_WritePage[nPage] = NULL;
+    }
+  }
+
+  // Develop all banks at the next sync
+  CPU_MapROMBANK[0] = CPU_MapROMBANK[1] = CPU_MapROMBANK[2] = CPU_MapROMBANK[3] = NULL;
+  CPU_MapSRAMBANK = NULL;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*    InfoNES_SyncCpuMap() : Follow bank changes in CPU memory map   */
+/*                                                                   */
+/*===================================================================*/
+void __not_in_flash_func(InfoNES_SyncCpuMap)()
+{
+  /*
+ *  Follow ROMBANK and SRAMBANK changes in CPU memory map
+ *
+ *  Remarks
+ *    Mappers switch banks by rewriting ROMBANK[] and SRAMBANK,
+ *    so this is called after every mapper callback that may do it.
+ *    Only banks that have changed are developed again.
+ */
+  int nBank;
+  int nPage;
+
+  for (nBank = 0; nBank < 4; ++nBank)
+  {
+    if (CPU_MapROMBANK[nBank] != ROMBANK[nBank])
+    {
+      CPU_MapROMBANK[nBank] = ROMBANK[nBank];
+      K6502_InvalidateBank(nBank);
+      for (nPage = 0; nPage < 0x20; ++nPage)
+        CPU_ReadPage[0x80 + (nBank << 5) + nPage] = ROMBANK[nBank] + (nPage << 8);
+    }
+  }
+
+  // SRAM is read from SRAMBANK when there is no battery backed SRAM
+  BYTE *pSram = ROM_SRAM ? SRAM : SRAMBANK;
+  if (CPU_MapSRAMBANK != pSram)
+  {
+    CPU_MapSRAMBANK = pSram;
+    for (nPage = 0; nPage < 0x20; ++nPage)
+      CPU_ReadPage[0x60 + nPage] = pSram ? pSram + (nPage << 8) : NULL;
+  }
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*          InfoNES_Sprite0Event() : Sprite #0 hits the scanline     */
+/*                                                                   */
+/*===================================================================*/
+static void __not_in_flash_func(InfoNES_Sprite0Event)()
+{
+  // Set a sprite hit flag
+  if ((PPU_R1 & R1_SHOW_SP) && (PPU_R1 & R1_SHOW_SCR))
+    PPU_R2 |= R2_HIT_SP;
+
+  // NMI is required if there is necessity
+  if ((PPU_R0 & R0_NMI_SP) && (PPU_R1 & R1_SHOW_SP))
+    NMI_REQ;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*           InfoNES_FrameIRQEvent() : pAPU frame IRQ                */
+/*                                                                   */
+/*===================================================================*/
+static void __not_in_flash_func(InfoNES_FrameIRQEvent)()
+{
+  if (FrameIRQ_Enable)
+  {
+    IRQ_REQ;
+    APU_Reg[0x15] |= 0x40;
+
+    // Every frame from the last one, so that it does not drift
+    InfoNES_ScheduleEvent(EVENT_FRAME_IRQ, EventClock + STEP_PER_FRAME * CLOCKS_PER_CPU);
+  }
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*           InfoNES_DmcEvent() : End of a DPCM sample               */
+/*                                                                   */
+/*===================================================================*/
+static void __not_in_flash_func(InfoNES_DmcEvent)()
+{
+  if (APU_Reg[0x10] & 0x40)
+  {
+    // Looping sample starts over
+    InfoNES_ScheduleEvent(EVENT_DMC, EventClock + InfoNES_pAPUDmcClocks() * CLOCKS_PER_CPU);
+  }
+  else
+  {
+    // DMC is no longer active
+    APU_Reg[0x15] &= ~0x10;
+
+    // DMC IRQ
+    if (APU_Reg[0x10] & 0x80)
+    {
+      IRQ_REQ;
+      APU_Reg[0x15] |= 0x80;
+    }
+  }
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*         InfoNES_SetupEvents() : Initialize the event scheduler    */
+/*                                                                   */
+/*===================================================================*/
+void InfoNES_SetupEvents()
+{
+  /*
+ *  Initialize the event scheduler
+ *
+ *  Remarks
+ *    The master clock keeps counting across resets, only the
+ *    deadlines are set up again from it.
+ */
+  int nEvent;
+
+  for (nEvent = 0; nEvent < EVENT_COUNT; ++nEvent)
+  {
+    Events[nEvent].qwDeadline = EVENT_NONE;
+    Events[nEvent].pHandler = NULL;
+  }
+
+  Events[EVENT_SPRITE0].pHandler = InfoNES_Sprite0Event;
+  Events[EVENT_FRAME_IRQ].pHandler = InfoNES_FrameIRQEvent;
+  Events[EVENT_DMC].pHandler = InfoNES_DmcEvent;
+
+  // The first scanline
+  Events[EVENT_SCANLINE].qwDeadline = InfoNES_MasterClock() + CLOCKS_PER_SCANLINE;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*           InfoNES_MasterClock() : Master clock                    */
+/*                                                                   */
+/*===================================================================*/
+QWORD __not_in_flash_func(InfoNES_MasterClock)()
+{
+  /*
+ *  Master clock
+ *
+ *  Return values
+ *    PPU dots since power on, exact to the CPU clock even in the
+ *    middle of K6502_Step()
+ */
+  return getPassedClocks() * CLOCKS_PER_CPU;
+}
+
+#if INFONES_PPU_CATCHUP
+/*===================================================================*/
+/*                                                                   */
+/*      InfoNES_PpuLogBegin() : Before a write to the PPU or mapper  */
+/*                                                                   */
+/*===================================================================*/
+void __not_in_flash_func(InfoNES_PpuLogBegin)()
+{
+  /*
+ *  Before a write to the PPU or the mapper
+ *
+ *  Remarks
+ *    The state is kept in the next entry of the log, that
+ *    InfoNES_PpuLogEnd() takes when the write has changed it.
+ *    With the log full, the writes are applied to the rest of
+ *    the scanline.
+ */
+
+  if (PPU_LogCount == INFONES_PPU_LOG_SIZE)
+    return;
+
+  struct PPU_LineState_tag &state = PPU_Log[PPU_LogCount];
+  InfoNES_MemoryCopy(state.pbyBank, PPUBANK, sizeof state.pbyBank);
+  state.wAddr = PPU_Addr;
+  state.byR0 = PPU_R0;
+  state.byR1 = PPU_R1;
+  state.byScrHBit = PPU_Scr_H_Bit;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*      InfoNES_PpuLogEnd() : After a write to the PPU or mapper     */
+/*                                                                   */
+/*===================================================================*/
+void __not_in_flash_func(InfoNES_PpuLogEnd)()
+{
+  /*
+ *  After a write to the PPU or the mapper
+ *
+ *  Remarks
+ *    The entry is kept with the pixel of the write when the state
+ *    has changed, the state before it ends there.
+ */
+
+  if (PPU_LogCount == INFONES_PPU_LOG_SIZE)
+    return;
+
+  struct PPU_LineState_tag &state = PPU_Log[PPU_LogCount];
+  bool bChanged = state.wAddr != PPU_Addr || state.byR0 != PPU_R0 || state.byR1 != PPU_R1 ||
+                  state.byScrHBit != PPU_Scr_H_Bit;
+  for (int nPage = 0; nPage < 16; ++nPage)
+    bChanged |= state.pbyBank[nPage] != PPUBANK[nPage];
+  if (!bChanged)
+    return;
+
+  // The dot in the scanline, the pixel x is drawn at the dot x + 1
+  const QWORD qwLineStart = Events[EVENT_SCANLINE].qwDeadline - CLOCKS_PER_SCANLINE;
+  const QWORD qwDot = InfoNES_MasterClock() - qwLineStart;
+  state.wX = qwDot < 1 ? 0 : qwDot > NES_DISP_WIDTH ? NES_DISP_WIDTH : (WORD)(qwDot - 1);
+  ++PPU_LogCount;
+}
+#endif
+
+/*===================================================================*/
+/*                                                                   */
+/*      InfoNES_SetEventHandler() : Set the function of an event     */
+/*                                                                   */
+/*===================================================================*/
+void InfoNES_SetEventHandler(int nEvent, void (*pHandler)())
+{
+  /*
+ *  Set the function that runs an event
+ *
+ *  Remarks
+ *    Mappers set EVENT_MAPPER_IRQ in their Init function.
+ */
+  Events[nEvent].pHandler = pHandler;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*        InfoNES_ScheduleEvent() : Schedule an event                */
+/*                                                                   */
+/*===================================================================*/
+void __not_in_flash_func(InfoNES_ScheduleEvent)(int nEvent, QWORD qwDeadline)
+{
+  /*
+ *  Schedule an event at a master clock
+ *
+ *  Parameters
+ *    int nEvent                (Read)
+ *      EVENT_xxx
+ *
+ *    QWORD qwDeadline          (Read)
+ *      Master clock to run the event at
+ *
+ *  Remarks
+ *    An event scheduled by an instruction for a deadline before the
+ *    end of the running CPU slice is run when the slice ends.
+ */
+  Events[nEvent].qwDeadline = qwDeadline;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*           InfoNES_CancelEvent() : Cancel an event                 */
+/*                                                                   */
+/*===================================================================*/
+void __not_in_flash_func(InfoNES_CancelEvent)(int nEvent)
+{
+  Events[nEvent].qwDeadline = EVENT_NONE;
+}
+
 /*===================================================================*/
 /*                                                                   */
 /*       InfoNES_Mirroring() : Set up a Mirroring of Name Table      */
@@ -625,56 +1208,129 @@ void __not_in_flash_func(InfoNES_Cycle)()
   {
     //util::WorkMeterMark(MARKER_START);
 
-    // Set a flag if a scanning line is a hit in the sprite #0
-    if (SpriteJustHit == PPU_Scanline &&
-        PPU_ScanTable[PPU_Scanline] == SCAN_ON_SCREEN)
+    // The nearest event
+    int nEvent = EVENT_SCANLINE;
+    for (int i = EVENT_SCANLINE + 1; i < EVENT_COUNT; ++i)
     {
-      // # of Steps to execute before sprite #0 hit
-      int nStep = SPRRAM[SPR_X] * STEP_PER_SCANLINE / NES_DISP_WIDTH;
-
-      // Execute instructions
-      K6502_Step(nStep);
-
-      // Set a sprite hit flag
-      if ((PPU_R1 & R1_SHOW_SP) && (PPU_R1 & R1_SHOW_SCR))
-        PPU_R2 |= R2_HIT_SP;
-
-      // NMI is required if there is necessity
-      if ((PPU_R0 & R0_NMI_SP) && (PPU_R1 & R1_SHOW_SP))
-        NMI_REQ;
-
-      // Execute instructions
-      K6502_Step(STEP_PER_SCANLINE - nStep);
+      if (Events[i].qwDeadline < Events[nEvent].qwDeadline)
+        nEvent = i;
     }
-    else
+
+    // Execute instructions up to the deadline
+    QWORD qwNow = InfoNES_MasterClock();
+    EventClock = Events[nEvent].qwDeadline;
+    if (EventClock > qwNow)
     {
-      // Execute instructions
-      K6502_Step(STEP_PER_SCANLINE);
+      DWORD dwStart = time_us_32();
+      K6502_Step((int)((EventClock - qwNow + CLOCKS_PER_CPU - 1) / CLOCKS_PER_CPU));
+      CpuMicros += time_us_32() - dwStart;
     }
 
-    // Frame IRQ in H-Sync
-    FrameStep += STEP_PER_SCANLINE;
-    if (FrameStep > STEP_PER_FRAME && FrameIRQ_Enable)
+    if (nEvent != EVENT_SCANLINE)
     {
-      FrameStep %= STEP_PER_FRAME;
-      IRQ_REQ;
-      APU_Reg[0x4015] |= 0x40;
+      Events[nEvent].qwDeadline = EVENT_NONE;
+      Events[nEvent].pHandler();
+      continue;
     }
 
     // util::WorkMeterMark(MARKER_CPU);
 
+    // 341 dots from the last scanline, so 113.67 clocks on average
+    Events[EVENT_SCANLINE].qwDeadline = EventClock + CLOCKS_PER_SCANLINE;
+
     // A mapper function in H-Sync
-    MapperHSync();
+    if (MapperCaps & MAPPER_CAP_HSYNC)
+      MapperHSync();
+    InfoNES_SyncCpuMap();
 
     // A function in H-Sync
     if (InfoNES_HSync() == -1)
       return; // To the menu screen
 
+    // Sprite #0 hit in the next scanning line
+    if (SpriteJustHit == PPU_Scanline &&
+        PPU_ScanTable[PPU_Scanline] == SCAN_ON_SCREEN)
+    {
+      InfoNES_ScheduleEvent(EVENT_SPRITE0, EventClock + 1 + SPRRAM[SPR_X]);
+    }
+
     // HSYNC Wait
     InfoNES_Wait();
   }
 }
 
+#if INFONES_AUTO_FRAMESKIP
+/*===================================================================*/
+/*                                                                   */
+/*     adaptFrameSkip() : Frame skip by the time of the frames       */
+/*                                                                   */
+/*===================================================================*/
+static void __not_in_flash_func(adaptFrameSkip)()
+{
+  /*
+ *  Frame skip by the time of the frames
+ *
+ *  Remarks
+ *    Called at the end of a frame, before FrameCnt moves on. A drawn
+ *    frame and the frames skipped after it have to fit in their budget,
+ *    the level is raised when they have not for FRAMESKIP_RAISE_FRAMES
+ *    frames, and lowered when one frame less would have fit with 1/8 to
+ *    spare for FRAMESKIP_LOWER_FRAMES frames. Only InfoNES_DrawLine()
+ *    is skipped, the CPU and the APU run every frame.
+ */
+
+  const DWORD dwNow = time_us_32();
+  FrameMicros = dwNow - FrameStartMicros - FrameIdleMicros;
+
+  // Averages over about 4 frames
+  DWORD &dwAverage = FrameCnt == 0 ? DrawnFrameMicros : SkippedFrameMicros;
+  dwAverage = dwAverage ? dwAverage - (dwAverage >> 2) + (FrameMicros >> 2) : FrameMicros;
+
+  // The last frame before the next drawn one
+  FrameCycleMicros += FrameMicros;
+  if (FrameCnt >= FrameSkip)
+  {
+    if (FrameCycleMicros > (FrameSkip + 1) * (DWORD)FRAME_BUDGET_MICROS)
+      ++FrameDeadlineMisses;
+    FrameCycleMicros = 0;
+  }
+
+  // A drawn frame and the skipped ones after it, at this level and one lower
+  const DWORD dwCycle = DrawnFrameMicros + FrameSkip * SkippedFrameMicros;
+  if (FrameSkip < INFONES_FRAMESKIP_MAX && dwCycle > (FrameSkip + 1) * (DWORD)FRAME_BUDGET_MICROS)
+    FrameSkipVotes = FrameSkipVotes > 0 ? FrameSkipVotes + 1 : 1;
+  else if (FrameSkip > 0 && (dwCycle - SkippedFrameMicros) * 8 < FrameSkip * (DWORD)FRAME_BUDGET_MICROS * 7)
+    FrameSkipVotes = FrameSkipVotes < 0 ? FrameSkipVotes - 1 : -1;
+  else
+    FrameSkipVotes = 0;
+
+  if (FrameSkipVotes >= FRAMESKIP_RAISE_FRAMES)
+  {
+    ++FrameSkip;
+    FrameSkipVotes = 0;
+  }
+  else if (FrameSkipVotes <= -FRAMESKIP_LOWER_FRAMES)
+  {
+    --FrameSkip;
+    FrameSkipVotes = 0;
+  }
+
+  // Skipped frames wait for real time, InfoNES_LoadFrame() paces the drawn ones
+  FrameDeadline += FRAME_BUDGET_MICROS;
+  if (FrameCnt != 0)
+  {
+    while ((int32_t)(time_us_32() - FrameDeadline) < 0)
+      ;
+  }
+
+  // More than a frame behind, not caught up later
+  FrameStartMicros = time_us_32();
+  if ((int32_t)(FrameStartMicros - FrameDeadline) > FRAME_BUDGET_MICROS)
+    FrameDeadline = FrameStartMicros;
+  FrameIdleMicros = 0;
+}
+#endif
+
 /*===================================================================*/
 /*                                                                   */
 /*              InfoNES_HSync() : A function in H-Sync               */
@@ -762,6 +1418,12 @@ int __not_in_flash_func(InfoNES_HSync)()
   /*-------------------------------------------------------------------*/
   PPU_Scanline = (PPU_Scanline == SCAN_VBLANK_END) ? 0 : PPU_Scanline + 1;
 
+#if INFONES_PPU_CATCHUP
+  // Log the writes of the next scanline when it is drawn
+  PPU_LogCount = 0;
+  PPU_LogEnable = scanlineDrawn(PPU_Scanline);
+#endif
+
   /*-------------------------------------------------------------------*/
   /*  Operation in the specific scanning line                          */
   /*-------------------------------------------------------------------*/
@@ -780,10 +1442,21 @@ int __not_in_flash_func(InfoNES_HSync)()
     break;
 
   case SCAN_UNKNOWN_START:
+#if INFONES_DEFERRED_RENDER
+    // The frame is out before it is shown, and before the renderer's counters are latched
+    InfoNES_DeferredFlush();
+#endif
     if (FrameCnt == 0)
     {
+#if INFONES_AUTO_FRAMESKIP
+      // The wait for the other core is not the time of the frame
+      const DWORD dwLoadStart = time_us_32();
+#endif
       // Transfer the contents of work frame on the screen
       InfoNES_LoadFrame();
+#if INFONES_AUTO_FRAMESKIP
+      FrameIdleMicros += time_us_32() - dwLoadStart;
+#endif
 
 #if 0
         // Switching of the double buffer
@@ -794,11 +1467,47 @@ int __not_in_flash_func(InfoNES_HSync)()
     break;
 
   case SCAN_VBLANK_START:
+#if INFONES_AUTO_FRAMESKIP
+    // The level of the frames from here
+    adaptFrameSkip();
+#endif
+
     // FrameCnt + 1
     FrameCnt = (FrameCnt >= FrameSkip) ? 0 : FrameCnt + 1;
+    ++EmulatedFrames;
 
     // Set a V-Blank flag
     PPU_R2 |= R2_IN_VBLANK;
+
+    // Latch the clocks that idle loops skipped in this frame
+    IdleClocksPerFrame = g_dwIdleClocks;
+    g_dwIdleClocks = 0;
+
+    // Latch the hit rate of the instruction cache in this frame
+    DecodeHitsPerFrame = g_dwDecodeHits;
+    DecodeMissesPerFrame = g_dwDecodeMisses;
+    g_dwDecodeHits = g_dwDecodeMisses = 0;
+
+#if INFONES_CHR_CACHE
+    // Latch the hit rate of the pattern cache in this frame
+    ChrCacheHitsPerFrame = ChrCacheHits;
+    ChrCacheMissesPerFrame = ChrCacheMisses;
+    ChrCacheHits = ChrCacheMisses = 0;
+#endif
+
+#if INFONES_DRAW8 && INFONES_BG_CACHE
+    // Latch the hit rate of the background cache in this frame
+    BgCacheHitsPerFrame = BgCacheHits;
+    BgCacheMissesPerFrame = BgCacheMisses;
+    BgCacheBypassesPerFrame = BgCacheBypasses;
+    BgCacheHits = BgCacheMisses = BgCacheBypasses = 0;
+#endif
+
+    // Latch the time that the CPU took in this frame
+    CpuMicrosPerFrame = CpuMicros;
+    CpuClocksPerFrame = (DWORD)(getPassedClocks() - CpuFrameClocks);
+    CpuMicros = 0;
+    CpuFrameClocks = getPassedClocks();
     // printf("vb : pc %04x, r2 %02x\n", PC, PPU_R2);
 
     // Reset latch flag
@@ -810,6 +1519,7 @@ int __not_in_flash_func(InfoNES_HSync)()
 
     // A mapper function in V-Sync
     MapperVSync();
+    InfoNES_SyncCpuMap();
 
     // Get the condition of the joypad
     InfoNES_PadState(&PAD1_Latch, &PAD2_Latch, &PAD_System);
@@ -834,15 +1544,135 @@ int __not_in_flash_func(InfoNES_HSync)()
 
 //#pragma GCC optimize("O2")
 
+/*-------------------------------------------------------------------*/
+/*  Input of the renderer                                            */
+/*-------------------------------------------------------------------*/
+
+/* The PPU state that a scanline is rendered from */
+struct InfoNES_DrawState_tag
+{
+  BYTE *const *ppbyBank; /* PPUBANK */
+  WORD *pLine;           /* WorkLine */
+  BYTE *pbyLine8;        /* WorkLine8 */
+  WORD wScanline;        /* PPU_Scanline */
+  WORD wAddr;            /* PPU_Addr */
+  BYTE byR0;             /* PPU_R0 */
+  BYTE byR1;             /* PPU_R1 */
+  BYTE byScrHByte;       /* PPU_Scr_H_Byte */
+  BYTE byScrHBit;        /* PPU_Scr_H_Bit */
+  BYTE byNameTableBank;  /* PPU_NameTableBank */
+  BYTE byUpDownClip;     /* PPU_UpDown_Clip */
+  BYTE bySprOverflow;    /* R2_MAX_SP of the scanline ( set by the renderer ) */
+};
+
+/* The scanline being rendered, only the renderer reads the PPU state from here on */
+static struct InfoNES_DrawState_tag DrawState;
+
 namespace
 {
+  // 8 pixels of a pattern row, 2 bits a pixel from the left
+  inline WORD decodeChrRow(int pl0, int pl1)
+  {
+    auto spread = [](int v) __attribute__((always_inline))
+    {
+      v = (v | (v << 4)) & 0x0f0f;
+      v = (v | (v << 2)) & 0x3333;
+      return (v | (v << 1)) & 0x5555;
+    };
+    return spread(pl0) | (spread(pl1) << 1);
+  }
+
+#if INFONES_CHR_CACHE
+  // Decode a pattern bank to a slot of the cache
+  void __not_in_flash_func(chrCacheMap)(int nBank)
+  {
+    const BYTE *pbySrc = DrawState.ppbyBank[nBank];
+    ChrCacheSrc[nBank] = NULL;
+    ++ChrCacheClock;
+
+    int nSlot = 0;
+    while (nSlot < INFONES_CHR_CACHE_SLOTS && ChrCacheKey[nSlot] != pbySrc)
+      ++nSlot;
+
+    if (nSlot < INFONES_CHR_CACHE_SLOTS)
+    {
+      ++ChrCacheHits;
+    }
+    else
+    {
+      ++ChrCacheMisses;
+
+      // The least recently mapped slot that no bank is on ( an empty slot is the oldest ),
+      // or slot 0 if the stamps do not tell
+      nSlot = 0;
+      DWORD dwOldest = ~0u;
+      for (int i = 0; i < INFONES_CHR_CACHE_SLOTS; ++i)
+      {
+        bool bMapped = false;
+        for (int b = 0; b < 8; ++b)
+          bMapped |= ChrCacheSrc[b] && ChrCacheSlot[b] == i;
+        if (!bMapped && ChrCacheStamp[i] < dwOldest)
+        {
+          dwOldest = ChrCacheStamp[i];
+          nSlot = i;
+        }
+      }
+
+      // Banks still on the slot decode their patterns again
+      for (int b = 0; b < 8; ++b)
+        if (ChrCacheSlot[b] == nSlot)
+          ChrCacheSrc[b] = NULL;
+
+      WORD *pRows = ChrCache[nSlot];
+      for (int nTile = 0; nTile < 64; ++nTile, pbySrc += 16)
+        for (int y = 0; y < 8; ++y)
+          *pRows++ = decodeChrRow(pbySrc[y], pbySrc[y + 8]);
+      ChrCacheKey[nSlot] = DrawState.ppbyBank[nBank];
+    }
+
+    ChrCacheStamp[nSlot] = ChrCacheClock;
+    ChrCacheSlot[nBank] = nSlot;
+    ChrCacheSrc[nBank] = DrawState.ppbyBank[nBank];
+  }
+
+  // Decoded rows of a pattern bank ( tile << 3 | row )
+  inline const WORD *chrCacheRows(int nBank)
+  {
+    if (ChrCacheSrc[nBank] != DrawState.ppbyBank[nBank])
+      chrCacheMap(nBank);
+    return ChrCache[ChrCacheSlot[nBank]];
+  }
+#endif
+
+#if INFONES_DRAW8
+  // A sprite pixel is drawn in front, or behind the transparent background ( 4 pixels a word )
+  void __not_in_flash_func(compositeSprite)(const uint8_t *spr,
+                                            uint8_t *buf8,
+                                            int width)
+  {
+    auto spr4 = reinterpret_cast<const uint32_t *>(spr);
+    auto buf4 = reinterpret_cast<uint32_t *>(buf8);
+    for (int i = 0; i < width >> 2; ++i)
+    {
+      if (const uint32_t v = spr4[i])
+      {
+#if defined(__ARM_FEATURE_SIMD32)
+        buf4[i] = InfoNES_Composite::compositeSprite8x4Dsp(v, buf4[i]);
+#else
+        buf4[i] = InfoNES_Composite::compositeSprite8x4(v, buf4[i]);
+#endif
+      }
+    }
+  }
+#else
   void __not_in_flash_func(compositeSprite)(const uint16_t *pal,
                                             const uint8_t *pal8,
                                             const uint8_t *spr,
                                             uint16_t *buf,
-                                            uint8_t *buf8)
+                                            uint8_t *buf8,
+                                            int width)
   {
-    auto sprEnd = spr + NES_DISP_WIDTH;
+    auto sprEnd = spr + width;
     do
     {
       auto proc = [=](int i) __attribute__((always_inline))
@@ -871,27 +1701,326 @@ namespace
 #endif
     } while (spr < sprEnd);
   }
+#endif
+
+#if INFONES_DRAW8 && INFONES_BG_SWAR
+  // Byte masks of the set bits of a pattern plane, 4 pixels a word from the left ( in RAM )
+  struct BgPlaneMaskTable
+  {
+    uint32_t mask[256][2];
+
+    constexpr BgPlaneMaskTable() : mask{}
+    {
+      for (int v = 0; v < 256; ++v)
+        for (int i = 0; i < 8; ++i)
+          if ((v << i) & 0x80)
+            mask[v][i >> 2] |= 0xffu << ((i & 3) << 3);
+    }
+
+    const uint32_t *operator[](int v) const { return mask[v]; }
+  };
+  BgPlaneMaskTable BgPlaneMask;
+#endif
+
+#if INFONES_DRAW8 && INFONES_BG_SWAR && INFONES_CHR_CACHE
+  // Byte masks of the bit 0 and the bit 1 of 4 pixels of a decoded row ( in RAM )
+  struct BgChunkyMaskTable
+  {
+    uint32_t mask[256][2];
+
+    constexpr BgChunkyMaskTable() : mask{}
+    {
+      for (int v = 0; v < 256; ++v)
+        for (int i = 0; i < 4; ++i)
+          for (int bit = 0; bit < 2; ++bit)
+            if ((v >> (6 - i * 2 + bit)) & 1)
+              mask[v][bit] |= 0xffu << (i << 3);
+    }
+
+    const uint32_t *operator[](int v) const { return mask[v]; }
+  };
+  BgChunkyMaskTable BgChunkyMask;
+#endif
+
+#if INFONES_DRAW8 && INFONES_BG_CACHE
+  // Render tiles of a row of a name table to the background cache
+  void __not_in_flash_func(renderBgCacheTiles)(int nPage, const BYTE *pbyNameTable, int nRow,
+                                               uint32_t dwTiles, int nBankOfs)
+  {
+    const BYTE *pbyAttr = pbyNameTable + 0x3c0 + (nRow >> 2) * 8;
+    const int nAttrShift = (nRow & 2) << 1;
+    BYTE *pRow = BgCache[nPage] + nRow * 8 * BG_CACHE_PITCH;
+
+    for (int nX = 0; dwTiles; ++nX, dwTiles >>= 1)
+    {
+      if (!(dwTiles & 1))
+        continue;
+
+      const int ch = pbyNameTable[nRow * 32 + nX];
+      const int pal = ((pbyAttr[nX >> 2] >> ((nX & 2) + nAttrShift)) & 3) * 0x44;
+      const BYTE *data = DrawState.ppbyBank[(ch >> 6) + nBankOfs] + ((ch & 63) << 4);
+      BYTE *dst = pRow + nX * 4;
+      for (int y = 0; y < 8; ++y, dst += BG_CACHE_PITCH)
+      {
+        const int pl0 = data[y];
+        const int pl1 = data[y + 8];
+        auto pixel = [=](int bit) __attribute__((always_inline))
+        {
+          return ((pl0 >> bit) & 1) | (((pl1 >> bit) & 1) << 1);
+        };
+        dst[0] = pal | pixel(7) | (pixel(6) << 4);
+        dst[1] = pal | pixel(5) | (pixel(4) << 4);
+        dst[2] = pal | pixel(3) | (pixel(2) << 4);
+        dst[3] = pal | pixel(1) | (pixel(0) << 4);
+      }
+    }
+  }
+
+  // Pixels of a row of the background cache to palette indices
+  void __not_in_flash_func(copyBgCacheSpan)(BYTE *dst, const BYTE *pRow, int nX, int nCount)
+  {
+    const BYTE *src = pRow + (nX >> 1);
+    if (nCount && (nX & 1))
+    {
+      *dst++ = BgCachePal[*src++] >> 8;
+      --nCount;
+    }
+    for (; nCount >= 2; nCount -= 2, dst += 2)
+    {
+      const WORD wPixels = BgCachePal[*src++];
+      dst[0] = wPixels;
+      dst[1] = wPixels >> 8;
+    }
+    if (nCount)
+      *dst = BgCachePal[*src] & 0xff;
+  }
+
+  // Background of the scanline from the cache, false when the cache cannot serve it
+  bool __not_in_flash_func(drawBgCache)(int nNameTable, int nY, int nYOfs, int nBankOfs)
+  {
+    const BYTE *pbyNameL = DrawState.ppbyBank[nNameTable];
+    const BYTE *pbyNameR = DrawState.ppbyBank[nNameTable ^ NAME_TABLE_H_MASK];
+    const unsigned nOfsL = pbyNameL - &PPURAM[NAME_TABLE0 * 0x400];
+    const unsigned nOfsR = pbyNameR - &PPURAM[NAME_TABLE0 * 0x400];
+
+    // Pattern fetches hooked by the mapper, a name table out of PPURAM, or the attributes as tiles
+    if ((MapperCaps & MAPPER_CAP_PPU) || nY >= 30 ||
+        nOfsL >= INFONES_BG_CACHE_PAGES * 0x400 || nOfsR >= INFONES_BG_CACHE_PAGES * 0x400)
+    {
+      ++BgCacheBypasses;
+      return false;
+    }
+
+    // Every tile is rendered again after a bank switch or a write to CHR-RAM
+    bool bBankSwitched = BgCacheUpdate;
+    for (int i = 0; i < 4; ++i)
+      bBankSwitched |= BgCacheBank[i] != DrawState.ppbyBank[nBankOfs + i];
+    if (bBankSwitched)
+    {
+      for (int i = 0; i < 4; ++i)
+        BgCacheBank[i] = DrawState.ppbyBank[nBankOfs + i];
+      InfoNES_MemorySet(BgCacheDirty, 0xff, sizeof BgCacheDirty);
+      BgCacheUpdate = 0;
+    }
+
+    // Palettes
+    bool bPalChanged = false;
+    for (int i = 0; i < 16; ++i)
+      bPalChanged |= BgCachePalSrc[i] != PalTable8[i];
+    if (bPalChanged)
+    {
+      InfoNES_MemoryCopy(BgCachePalSrc, PalTable8, sizeof BgCachePalSrc);
+      for (int i = 0; i < 256; ++i)
+        BgCachePal[i] = PalTable8[i & 15] | (PalTable8[i >> 4] << 8);
+    }
+
+    // Render the changed tiles of the rows that the scanline is copied from
+    const int nPageL = nOfsL >> 10;
+    const int nPageR = nOfsR >> 10;
+    auto renderRow = [&](int nPage, const BYTE *pbyName) __attribute__((always_inline))
+    {
+      const uint32_t dwTiles = BgCacheDirty[nPage][nY];
+      const int nMisses = __builtin_popcount(dwTiles);
+      BgCacheMisses += nMisses;
+      BgCacheHits += 32 - nMisses;
+      if (dwTiles)
+      {
+        renderBgCacheTiles(nPage, pbyName, nY, dwTiles, nBankOfs);
+        BgCacheDirty[nPage][nY] = 0;
+      }
+    };
+    renderRow(nPageL, pbyNameL);
+    if (nPageR != nPageL)
+      renderRow(nPageR, pbyNameR);
+
+    // The window of the scroll position over the two name tables
+    const int nX = (DrawState.byScrHByte << 3) + DrawState.byScrHBit;
+    const int nLine = ((nY << 3) + nYOfs) * BG_CACHE_PITCH;
+    copyBgCacheSpan(DrawState.pbyLine8, BgCache[nPageL] + nLine, nX, NES_DISP_WIDTH - nX);
+    copyBgCacheSpan(DrawState.pbyLine8 + NES_DISP_WIDTH - nX, BgCache[nPageR] + nLine, 0, nX);
+    return true;
+  }
+#endif
+
+#if INFONES_SPRITE_BINS
+  // Bin the sprites by the scanlines that they are on
+  void __not_in_flash_func(binSprites)()
+  {
+    const int height = (DrawState.byR0 & R0_SP_SIZE) ? 16 : 8;
+
+    // Count the sprites on every scanline, and their span
+    InfoNES_MemorySet(SprLineStart, 0, sizeof SprLineStart);
+    InfoNES_MemorySet(SprLineMinX, 0xff, sizeof SprLineMinX);
+    InfoNES_MemorySet(SprLineMaxX, 0, sizeof SprLineMaxX);
+    for (const BYTE *spr = SPRRAM; spr < SPRRAM + SPRRAM_SIZE; spr += 4)
+    {
+      const int y = spr[SPR_Y] + 1;
+      const int yEnd = y + height < NES_DISP_HEIGHT ? y + height : NES_DISP_HEIGHT;
+      const int x = spr[SPR_X];
+      for (int line = y; line < yEnd; ++line)
+      {
+        ++SprLineStart[line];
+        if (x < SprLineMinX[line])
+          SprLineMinX[line] = x;
+        if (x > SprLineMaxX[line])
+          SprLineMaxX[line] = x;
+      }
+    }
+
+    // The end of the list of every scanline
+    int total = 0;
+    for (int line = 0; line < NES_DISP_HEIGHT; ++line)
+    {
+      total += SprLineStart[line];
+      SprLineStart[line] = total;
+    }
+    SprLineStart[NES_DISP_HEIGHT] = total;
+
+    // Fill the lists from the end, sprite #63 comes first
+    for (int n = 0; n < 64; ++n)
+    {
+      const int y = SPRRAM[(n << 2) + SPR_Y] + 1;
+      const int yEnd = y + height < NES_DISP_HEIGHT ? y + height : NES_DISP_HEIGHT;
+      for (int line = y; line < yEnd; ++line)
+        SprList[--SprLineStart[line]] = n;
+    }
+
+    SprBinHeight = height;
+    SprBinUpdate = 0;
+    SprRowsValid = 0;
+  }
+
+  inline int reverseBits(int v)
+  {
+    v = ((v & 0xf0) >> 4) | ((v & 0x0f) << 4);
+    v = ((v & 0xcc) >> 2) | ((v & 0x33) << 2);
+    return ((v & 0xaa) >> 1) | ((v & 0x55) << 1);
+  }
+
+  // Decode the rows of a sprite from the current pattern banks
+  void __not_in_flash_func(decodeSprite)(int n)
+  {
+    const BYTE *spr = SPRRAM + (n << 2);
+    const int attr = spr[SPR_ATTR];
+    int ch = spr[SPR_CHR];
+
+    int bankOfs;
+    if (DrawState.byR0 & R0_SP_SIZE)
+    {
+      // 8x16
+      bankOfs = (ch & 1) << 2;
+      ch &= 0xfe;
+    }
+    else
+    {
+      // 8x8
+      bankOfs = DrawState.byR0 & R0_SP_ADDR ? 4 : 0;
+    }
+
+    const int height = (DrawState.byR0 & R0_SP_SIZE) ? 16 : 8;
+    WORD *rows = SprRows[n];
+#if INFONES_CHR_CACHE
+    const WORD *data = chrCacheRows((ch >> 6) + bankOfs) + ((ch & 63) << 3);
+    for (int y = 0; y < height; ++y)
+    {
+      int row = data[(attr & SPR_ATTR_V_FLIP) ? height - y - 1 : y];
+      if (attr & SPR_ATTR_H_FLIP)
+      {
+        // Reverse the order of the pixels
+        row = ((row & 0xff00) >> 8) | ((row & 0x00ff) << 8);
+        row = ((row & 0xf0f0) >> 4) | ((row & 0x0f0f) << 4);
+        row = ((row & 0xcccc) >> 2) | ((row & 0x3333) << 2);
+      }
+      rows[y] = row;
+    }
+#else
+    const BYTE *data = DrawState.ppbyBank[(ch >> 6) + bankOfs] + ((ch & 63) << 4);
+    for (int y = 0; y < height; ++y)
+    {
+      const int yOfs = (attr & SPR_ATTR_V_FLIP) ? height - y - 1 : y;
+      const BYTE *row = data + ((yOfs & 8) << 1) + (yOfs & 7);
+      if (attr & SPR_ATTR_H_FLIP)
+        rows[y] = decodeChrRow(reverseBits(row[0]), reverseBits(row[8]));
+      else
+        rows[y] = decodeChrRow(row[0], row[8]);
+    }
+#endif
+
+    SprRowsValid |= 1ull << n;
+  }
+#endif
+}
+
+/*-------------------------------------------------------------------*/
+/*  Modes of InfoNES_DrawLine                                        */
+/*-------------------------------------------------------------------*/
+
+/* The register bits of DrawState that the renderer tests ( these R1 and R0 bits don't overlap ) */
+#define DRAW_LINE_MODE() \
+  ((DrawState.byR1 & (R1_SHOW_SP | R1_SHOW_SCR | R1_CLIP_SP | R1_CLIP_BG)) | (DrawState.byR0 & R0_SP_SIZE))
+
+/* drawLine() that reads the mode from the registers */
+#define DRAW_LINE_ANY_MODE -1
+
+/* The mode with the bits that don't matter cleared */
+static constexpr int drawLineVariantMode(int nMode)
+{
+  if (!(nMode & R1_SHOW_SCR))
+    nMode &= ~R1_CLIP_BG;
+  if (!(nMode & R1_SHOW_SP))
+    nMode &= ~(R1_CLIP_SP | R0_SP_SIZE);
+  return nMode;
 }
 
 /*===================================================================*/
 /*                                                                   */
-/*              InfoNES_DrawLine() : Render a scanline               */
+/*                  drawLine() : Render a scanline                   */
 /*                                                                   */
 /*===================================================================*/
-void __not_in_flash_func(InfoNES_DrawLine)()
+template <int Mode>
+static void __not_in_flash_func(drawLine)()
 {
   /*
  *  Render a scanline
  *
+ *  Remarks
+ *    Mode is DRAW_LINE_MODE() of a variant ( INFONES_DRAWLINE_VARIANTS ),
+ *    where the tests of the mode bits are constants and fold away,
+ *    or DRAW_LINE_ANY_MODE.
  */
 
+  const int nMode = Mode == DRAW_LINE_ANY_MODE ? DRAW_LINE_MODE() : Mode;
+  const int nSpHeight = (nMode & R0_SP_SIZE) ? 16 : 8;
+  BYTE *const pbyBgBase = (DrawState.byR0 & R0_BG_ADDR) ? ChrBuf + 256 * 64 : ChrBuf;
+
   int nX;
   int nY;
   int nY4;
   int nYBit;
-  WORD *pPalTbl;
   BYTE *pAttrBase;
+#if !INFONES_DRAW8
   WORD *pPoint;
+#endif
   uint8_t *pPoint8;
   int nNameTable;
   BYTE *pbyNameTable;
@@ -899,37 +2028,45 @@ void __not_in_flash_func(InfoNES_DrawLine)()
   BYTE *pSPRRAM;
   int nAttr;
   int nSprCnt;
-  int nIdx;
-  int nSprData;
-  BYTE bySprCol;
-  BYTE pSprBuf[NES_DISP_WIDTH + 7];
+  alignas(4) BYTE pSprBuf[NES_DISP_WIDTH + 7];
 
   /*-------------------------------------------------------------------*/
   /*  Render Background                                                */
   /*-------------------------------------------------------------------*/
 
   /* MMC5 VROM switch */
-  MapperRenderScreen(1);
+  if (MapperCaps & MAPPER_CAP_RENDER_SCREEN)
+    MapperRenderScreen(1);
+
+#if INFONES_CHR_CACHE
+  // Decoded patterns of CHR-RAM are decoded again
+  if (ChrBufUpdate)
+    InfoNES_SetupChr();
+#endif
 
   // Pointer to the render position
-  //  pPoint = &WorkFrame[PPU_Scanline * NES_DISP_WIDTH];
-  assert(WorkLine);
-  pPoint = WorkLine;
-  pPoint8 = WorkLine8;
+  //  pPoint = &WorkFrame[DrawState.wScanline * NES_DISP_WIDTH];
+  assert(DrawState.pbyLine8);
+#if !INFONES_DRAW8
+  pPoint = DrawState.pLine;
+#endif
+  pPoint8 = DrawState.pbyLine8;
 
   // Clear a scanline if screen is off
-  if (!(PPU_R1 & R1_SHOW_SCR))
+  if (!(nMode & R1_SHOW_SCR))
   {
+#if !INFONES_DRAW8
     InfoNES_MemorySet(pPoint, 0, NES_DISP_WIDTH << 1);
+#endif
     InfoNES_MemorySet(pPoint8, 0, NES_DISP_WIDTH);
   }
   else
   {
-    nNameTable = PPU_NameTableBank;
+    nNameTable = DrawState.byNameTableBank;
 
 #if 0
-    nY = PPU_Scr_V_Byte + (PPU_Scanline >> 3);
-    nYBit = PPU_Scr_V_Bit + (PPU_Scanline & 7);
+    nY = PPU_Scr_V_Byte + (DrawState.wScanline >> 3);
+    nYBit = PPU_Scr_V_Bit + (DrawState.wScanline & 7);
 
     if (nYBit > 7)
     {
@@ -946,289 +2083,423 @@ void __not_in_flash_func(InfoNES_DrawLine)()
       nY -= 30;
     }
 #else
-    nY = (PPU_Addr >> 5) & 31;
-    const int yOfsModBG = PPU_Addr >> 12;
+    nY = (DrawState.wAddr >> 5) & 31;
+    const int yOfsModBG = DrawState.wAddr >> 12;
     nYBit = yOfsModBG << 3;
 #endif
 
-    nX = PPU_Scr_H_Byte;
+    nX = DrawState.byScrHByte;
 
     nY4 = ((nY & 2) << 1);
 
+    // Most mappers have no callback at PPU read/write
+    const bool bMapperPPU = MapperCaps & MAPPER_CAP_PPU;
+
     //
-    const int patternTableIdBG = PPU_R0 & R0_BG_ADDR ? 1 : 0;
+    const int patternTableIdBG = DrawState.byR0 & R0_BG_ADDR ? 1 : 0;
     const int bankOfsBG = patternTableIdBG << 2;
 
+#if INFONES_DRAW8 && INFONES_BG_CACHE
+    if (drawBgCache(nNameTable, nY, yOfsModBG, bankOfsBG))
+    {
+      // Copied from the pre-rendered name tables
+    }
+    else
+#endif
+#if INFONES_DRAW8 && INFONES_BG_SWAR
     /*-------------------------------------------------------------------*/
-    /*  Rendering of the block of the left end                           */
+    /*  Rendering of the 33 blocks, 4 pixels a store                     */
     /*-------------------------------------------------------------------*/
 
-    pbyNameTable = PPUBANK[nNameTable] + nY * 32 + nX;
-    pbyChrData = PPU_BG_Base + (*pbyNameTable << 6) + nYBit;
-    pAttrBase = PPUBANK[nNameTable] + 0x3c0 + (nY / 4) * 8;
-#if 0
-    pPalTbl = &PalTable[(((pAttrBase[nX >> 2] >> ((nX & 2) + nY4)) & 3) << 2)];
-
-    for (nIdx = PPU_Scr_H_Bit; nIdx < 8; ++nIdx)
-    {
-      *(pPoint++) = pPalTbl[pbyChrData[nIdx]];
-    }
-#else
     {
-      pPoint += 8 - PPU_Scr_H_Bit;
-      pPoint8 += 8 - PPU_Scr_H_Bit;
-      const auto pal = &PalTable[(((pAttrBase[nX >> 2] >> ((nX & 2) + nY4)) & 3) << 2)];
-      const auto pal8 = &PalTable8[(((pAttrBase[nX >> 2] >> ((nX & 2) + nY4)) & 3) << 2)];
-      const int ch = *pbyNameTable;
-      const int bank = (ch >> 6) + bankOfsBG;
-      const int addrOfs = ((ch & 63) << 4) + yOfsModBG;
-      const auto data = PPUBANK[bank] + addrOfs;
-      const auto pl0 = data[0];
-      const auto pl1 = data[8];
-      const auto pat0 = (pl0 & 0x55) | ((pl1 << 1) & 0xaa);
-      const auto pat1 = ((pl0 >> 1) & 0x55) | (pl1 & 0xaa);
-      switch (PPU_Scr_H_Bit)
+      // Colours of the 4 palettes, as 4 pixels for the byte selects
+      uint32_t palSel[4][4];
+      for (int nIdx = 0; nIdx < 4; ++nIdx)
       {
-      case 0:
-        pPoint[-8] = pal[(pat1 >> 6) & 3];
-        pPoint8[-8] = pal8[(pat1 >> 6) & 3];
-      case 1:
-        pPoint[-7] = pal[(pat0 >> 6) & 3];
-        pPoint8[-7] = pal8[(pat0 >> 6) & 3];
-      case 2:
-        pPoint[-6] = pal[(pat1 >> 4) & 3];
-        pPoint8[-6] = pal8[(pat1 >> 4) & 3];
-      case 3:
-        pPoint[-5] = pal[(pat0 >> 4) & 3];
-        pPoint8[-5] = pal8[(pat0 >> 4) & 3];
-      case 4:
-        pPoint[-4] = pal[(pat1 >> 2) & 3];
-        pPoint8[-4] = pal8[(pat1 >> 2) & 3];
-      case 5:
-        pPoint[-3] = pal[(pat0 >> 2) & 3];
-        pPoint8[-3] = pal8[(pat0 >> 2) & 3];
-      case 6:
-        pPoint[-2] = pal[(pat1 >> 0) & 3];
-        pPoint8[-2] = pal8[(pat1 >> 0) & 3];
-      case 7:
-        pPoint[-1] = pal[(pat0 >> 0) & 3];
-        pPoint8[-1] = pal8[(pat0 >> 0) & 3];
-      default:
-        break;
+        const uint32_t c0 = PalTable8[(nIdx << 2) + 0] * 0x01010101u;
+        const uint32_t c1 = PalTable8[(nIdx << 2) + 1] * 0x01010101u;
+        const uint32_t c2 = PalTable8[(nIdx << 2) + 2] * 0x01010101u;
+        const uint32_t c3 = PalTable8[(nIdx << 2) + 3] * 0x01010101u;
+        palSel[nIdx][0] = c0;
+        palSel[nIdx][1] = c0 ^ c1;
+        palSel[nIdx][2] = c2;
+        palSel[nIdx][3] = c2 ^ c3;
       }
-    }
-#endif
 
-    // Callback at PPU read/write
-    MapperPPU(PATTBL(pbyChrData));
+      // With the fine scroll, the blocks go to a buffer to be shifted into the line
+      uint32_t bgBuf[33 * 2];
+      const int nBlocks = DrawState.byScrHBit ? 33 : 32;
+      auto *dst = DrawState.byScrHBit ? bgBuf : reinterpret_cast<uint32_t *>(pPoint8);
 
-    ++nX;
-    ++pbyNameTable;
+      pbyNameTable = DrawState.ppbyBank[nNameTable] + nY * 32 + nX;
+      pbyChrData = pbyBgBase + (*pbyNameTable << 6) + nYBit;
+      pAttrBase = DrawState.ppbyBank[nNameTable] + 0x3c0 + (nY / 4) * 8;
 
-    /*-------------------------------------------------------------------*/
-    /*  Rendering of the left table                                      */
-    /*-------------------------------------------------------------------*/
+      // One loop with the callback a tile, one without
+      auto drawTiles = [&](auto bHook) __attribute__((always_inline))
+      {
+        for (int nIdx = 0; nIdx < 33; ++nIdx, ++nX, ++pbyNameTable)
+        {
+          if (nX == 32)
+          {
+            // Holizontal Mirror
+            nNameTable ^= NAME_TABLE_H_MASK;
+            nX = 0;
+            pbyNameTable = DrawState.ppbyBank[nNameTable] + nY * 32;
+            pAttrBase = DrawState.ppbyBank[nNameTable] + 0x3c0 + (nY / 4) * 8;
+          }
 
-    auto putBG = [&](int nX) __attribute__((always_inline))
-    {
-      const auto pal = &PalTable[(((pAttrBase[nX >> 2] >> ((nX & 2) + nY4)) & 3) << 2)];
-      const auto pal8 = &PalTable8[(((pAttrBase[nX >> 2] >> ((nX & 2) + nY4)) & 3) << 2)];
-      const auto palAddr = reinterpret_cast<uintptr_t>(pal);
-      const auto palAddr8 = reinterpret_cast<uintptr_t>(pal8);
-      const int ch = *pbyNameTable;
-      const int bank = (ch >> 6) + bankOfsBG;
-      const int addrOfs = ((ch & 63) << 4) + yOfsModBG;
-      const auto data = PPUBANK[bank] + addrOfs;
-      const auto pl0 = data[0];
-      const auto pl1 = data[8];
-      // const auto pat0 = (pl0 & 0x55) | ((pl1 << 1) & 0xaa);
-      // const auto pat1 = ((pl0 >> 1) & 0x55) | (pl1 & 0xaa);
-      const auto pat0 = ((pl0 & 0x55) << 1) | ((pl1 & 0x55) << 2);
-      const auto pat1 = ((pl0 & 0xaa) << 0) | ((pl1 & 0xaa) << 1);
-
-      auto readPal = [&](int ofs) {
-        return *reinterpret_cast<const WORD *>(palAddr + ofs);
-      };
-       auto readPal8 = [&](int ofs) {
-        return *reinterpret_cast<const BYTE *>(palAddr8 + (ofs >>1));
-      };
-      pPoint[0] = readPal((pat1 >> 6) & 6);
-      pPoint8[0] = readPal8((pat1 >> 6) & 6);
+          if (nIdx < nBlocks)
+          {
+            const auto sel = palSel[(pAttrBase[nX >> 2] >> ((nX & 2) + nY4)) & 3];
+            const int ch = *pbyNameTable;
+            const int bank = (ch >> 6) + bankOfsBG;
+
+            // Colour 0/1 or 2/3 by the plane 0, then one of the pairs by the plane 1
+            auto expand = [&](uint32_t mask0, uint32_t mask1) __attribute__((always_inline))
+            {
+              const uint32_t c01 = sel[0] ^ (sel[1] & mask0);
+              const uint32_t c23 = sel[2] ^ (sel[3] & mask0);
+              return c01 ^ ((c01 ^ c23) & mask1);
+            };
+#if INFONES_CHR_CACHE
+            const int row = chrCacheRows(bank)[((ch & 63) << 3) + yOfsModBG];
+            const auto maskL = BgChunkyMask[row >> 8];
+            const auto maskR = BgChunkyMask[row & 0xff];
+            dst[0] = expand(maskL[0], maskL[1]);
+            dst[1] = expand(maskR[0], maskR[1]);
+#else
+            const int addrOfs = ((ch & 63) << 4) + yOfsModBG;
+            const auto data = DrawState.ppbyBank[bank] + addrOfs;
+            const auto mask0 = BgPlaneMask[data[0]];
+            const auto mask1 = BgPlaneMask[data[8]];
+            dst[0] = expand(mask0[0], mask1[0]);
+            dst[1] = expand(mask0[1], mask1[1]);
+#endif
+            dst += 2;
+          }
 
-      pPoint[1] = readPal((pat0 >> 6) & 6);
-      pPoint8[1] = readPal8((pat0 >> 6) & 6);
+          // Callback at PPU read/write
+          if (bHook)
+            MapperPPU(PATTBL(pbyChrData));
+        }
+      };
+      if (bMapperPPU)
+        drawTiles(std::true_type());
+      else
+        drawTiles(std::false_type());
 
-      pPoint[2] = readPal((pat1 >> 4) & 6);
-      pPoint8[2] = readPal8((pat1 >> 4) & 6);
+      if (DrawState.byScrHBit)
+      {
+        auto *src = bgBuf + (DrawState.byScrHBit >> 2);
+        auto *line = reinterpret_cast<uint32_t *>(pPoint8);
+        const int shift = (DrawState.byScrHBit & 3) << 3;
+        if (shift)
+        {
+          for (int nIdx = 0; nIdx < NES_DISP_WIDTH / 4; ++nIdx)
+            line[nIdx] = (src[nIdx] >> shift) | (src[nIdx + 1] << (32 - shift));
+        }
+        else
+        {
+          for (int nIdx = 0; nIdx < NES_DISP_WIDTH / 4; ++nIdx)
+            line[nIdx] = src[nIdx];
+        }
+      }
+    }
+#else
+    {
+      /*-------------------------------------------------------------------*/
+      /*  Rendering of the block of the left end                           */
+      /*-------------------------------------------------------------------*/
 
-      pPoint[3] = readPal((pat0 >> 4) & 6);
-      pPoint8[3] = readPal8((pat0 >> 4) & 6);
+      pbyNameTable = DrawState.ppbyBank[nNameTable] + nY * 32 + nX;
+      pbyChrData = pbyBgBase + (*pbyNameTable << 6) + nYBit;
+      pAttrBase = DrawState.ppbyBank[nNameTable] + 0x3c0 + (nY / 4) * 8;
+#if 0
+      pPalTbl = &PalTable[(((pAttrBase[nX >> 2] >> ((nX & 2) + nY4)) & 3) << 2)];
 
-      pPoint[4] = readPal((pat1 >> 2) & 6);
-      pPoint8[4] = readPal8((pat1 >> 2) & 6);
+      for (nIdx = DrawState.byScrHBit; nIdx < 8; ++nIdx)
+      {
+        *(pPoint++) = pPalTbl[pbyChrData[nIdx]];
+      }
+#else
+      {
+#if !INFONES_DRAW8
+        pPoint += 8 - DrawState.byScrHBit;
+        const auto pal = &PalTable[(((pAttrBase[nX >> 2] >> ((nX & 2) + nY4)) & 3) << 2)];
+#endif
+        pPoint8 += 8 - DrawState.byScrHBit;
+        const auto pal8 = &PalTable8[(((pAttrBase[nX >> 2] >> ((nX & 2) + nY4)) & 3) << 2)];
+        const int ch = *pbyNameTable;
+        const int bank = (ch >> 6) + bankOfsBG;
+        const int addrOfs = ((ch & 63) << 4) + yOfsModBG;
+        const auto data = DrawState.ppbyBank[bank] + addrOfs;
+        const auto pl0 = data[0];
+        const auto pl1 = data[8];
+        const auto pat0 = (pl0 & 0x55) | ((pl1 << 1) & 0xaa);
+        const auto pat1 = ((pl0 >> 1) & 0x55) | (pl1 & 0xaa);
+        auto put = [&](int i, int v) __attribute__((always_inline))
+        {
+#if !INFONES_DRAW8
+          pPoint[i] = pal[v];
+#endif
+          pPoint8[i] = pal8[v];
+        };
+        switch (DrawState.byScrHBit)
+        {
+        case 0:
+          put(-8, (pat1 >> 6) & 3);
+          [[fallthrough]];
+        case 1:
+          put(-7, (pat0 >> 6) & 3);
+          [[fallthrough]];
+        case 2:
+          put(-6, (pat1 >> 4) & 3);
+          [[fallthrough]];
+        case 3:
+          put(-5, (pat0 >> 4) & 3);
+          [[fallthrough]];
+        case 4:
+          put(-4, (pat1 >> 2) & 3);
+          [[fallthrough]];
+        case 5:
+          put(-3, (pat0 >> 2) & 3);
+          [[fallthrough]];
+        case 6:
+          put(-2, (pat1 >> 0) & 3);
+          [[fallthrough]];
+        case 7:
+          put(-1, (pat0 >> 0) & 3);
+        default:
+          break;
+        }
+      }
+#endif
 
-      pPoint[5] = readPal((pat0 >> 2) & 6);
-      pPoint8[5] = readPal8((pat0 >> 2) & 6);
+      // Callback at PPU read/write
+      if (bMapperPPU)
+        MapperPPU(PATTBL(pbyChrData));
 
-      pPoint[6] = readPal((pat1 >> 0) & 6);
-      pPoint8[6] = readPal8((pat1 >> 0) & 6);
+      ++nX;
+      ++pbyNameTable;
 
-      pPoint[7] = readPal((pat0 >> 0) & 6);
-      pPoint8[7] = readPal8((pat0 >> 0) & 6);
+      /*-------------------------------------------------------------------*/
+      /*  Rendering of the left table                                      */
+      /*-------------------------------------------------------------------*/
 
-      pPoint += 8;
-      pPoint8 += 8;
-    };
+      auto putBG = [&](int nX) __attribute__((always_inline))
+      {
+#if !INFONES_DRAW8
+        const auto pal = &PalTable[(((pAttrBase[nX >> 2] >> ((nX & 2) + nY4)) & 3) << 2)];
+        const auto palAddr = reinterpret_cast<uintptr_t>(pal);
+#endif
+        const auto pal8 = &PalTable8[(((pAttrBase[nX >> 2] >> ((nX & 2) + nY4)) & 3) << 2)];
+        const auto palAddr8 = reinterpret_cast<uintptr_t>(pal8);
+        const int ch = *pbyNameTable;
+        const int bank = (ch >> 6) + bankOfsBG;
+        const int addrOfs = ((ch & 63) << 4) + yOfsModBG;
+        const auto data = DrawState.ppbyBank[bank] + addrOfs;
+        const auto pl0 = data[0];
+        const auto pl1 = data[8];
+        // const auto pat0 = (pl0 & 0x55) | ((pl1 << 1) & 0xaa);
+        // const auto pat1 = ((pl0 >> 1) & 0x55) | (pl1 & 0xaa);
+        const auto pat0 = ((pl0 & 0x55) << 1) | ((pl1 & 0x55) << 2);
+        const auto pat1 = ((pl0 & 0xaa) << 0) | ((pl1 & 0xaa) << 1);
+
+#if !INFONES_DRAW8
+        auto readPal = [&](int ofs) {
+          return *reinterpret_cast<const WORD *>(palAddr + ofs);
+        };
+#endif
+         auto readPal8 = [&](int ofs) {
+          return *reinterpret_cast<const BYTE *>(palAddr8 + (ofs >>1));
+        };
+        auto put = [&](int i, int ofs) __attribute__((always_inline))
+        {
+#if !INFONES_DRAW8
+          pPoint[i] = readPal(ofs);
+#endif
+          pPoint8[i] = readPal8(ofs);
+        };
+        put(0, (pat1 >> 6) & 6);
+        put(1, (pat0 >> 6) & 6);
+        put(2, (pat1 >> 4) & 6);
+        put(3, (pat0 >> 4) & 6);
+        put(4, (pat1 >> 2) & 6);
+        put(5, (pat0 >> 2) & 6);
+        put(6, (pat1 >> 0) & 6);
+        put(7, (pat0 >> 0) & 6);
+
+#if !INFONES_DRAW8
+        pPoint += 8;
+#endif
+        pPoint8 += 8;
+      };
 
-    for (; nX < 32; ++nX)
-    {
+      for (; nX < 32; ++nX)
+      {
 #if 0
-      pbyChrData = PPU_BG_Base + (*pbyNameTable << 6) + nYBit;
-      pPalTbl = &PalTable[(((pAttrBase[nX >> 2] >> ((nX & 2) + nY4)) & 3) << 2)];
-
-      pPoint[0] = pPalTbl[pbyChrData[0]];
-      pPoint[1] = pPalTbl[pbyChrData[1]];
-      pPoint[2] = pPalTbl[pbyChrData[2]];
-      pPoint[3] = pPalTbl[pbyChrData[3]];
-      pPoint[4] = pPalTbl[pbyChrData[4]];
-      pPoint[5] = pPalTbl[pbyChrData[5]];
-      pPoint[6] = pPalTbl[pbyChrData[6]];
-      pPoint[7] = pPalTbl[pbyChrData[7]];
-      pPoint += 8;
+        pbyChrData = pbyBgBase + (*pbyNameTable << 6) + nYBit;
+        pPalTbl = &PalTable[(((pAttrBase[nX >> 2] >> ((nX & 2) + nY4)) & 3) << 2)];
+
+        pPoint[0] = pPalTbl[pbyChrData[0]];
+        pPoint[1] = pPalTbl[pbyChrData[1]];
+        pPoint[2] = pPalTbl[pbyChrData[2]];
+        pPoint[3] = pPalTbl[pbyChrData[3]];
+        pPoint[4] = pPalTbl[pbyChrData[4]];
+        pPoint[5] = pPalTbl[pbyChrData[5]];
+        pPoint[6] = pPalTbl[pbyChrData[6]];
+        pPoint[7] = pPalTbl[pbyChrData[7]];
+        pPoint += 8;
 #else
-      putBG(nX);
+        putBG(nX);
 #endif
 
-      // Callback at PPU read/write
-      MapperPPU(PATTBL(pbyChrData));
+        // Callback at PPU read/write
+        if (bMapperPPU)
+          MapperPPU(PATTBL(pbyChrData));
 
-      ++pbyNameTable;
-    }
+        ++pbyNameTable;
+      }
 
-    // Holizontal Mirror
-    nNameTable ^= NAME_TABLE_H_MASK;
+      // Holizontal Mirror
+      nNameTable ^= NAME_TABLE_H_MASK;
 
-    pbyNameTable = PPUBANK[nNameTable] + nY * 32;
-    pAttrBase = PPUBANK[nNameTable] + 0x3c0 + (nY / 4) * 8;
+      pbyNameTable = DrawState.ppbyBank[nNameTable] + nY * 32;
+      pAttrBase = DrawState.ppbyBank[nNameTable] + 0x3c0 + (nY / 4) * 8;
 
-    /*-------------------------------------------------------------------*/
-    /*  Rendering of the right table                                     */
-    /*-------------------------------------------------------------------*/
+      /*-------------------------------------------------------------------*/
+      /*  Rendering of the right table                                     */
+      /*-------------------------------------------------------------------*/
 
-    for (nX = 0; nX < PPU_Scr_H_Byte; ++nX)
-    {
+      for (nX = 0; nX < DrawState.byScrHByte; ++nX)
+      {
 #if 0
-      pbyChrData = PPU_BG_Base + (*pbyNameTable << 6) + nYBit;
-      pPalTbl = &PalTable[(((pAttrBase[nX >> 2] >> ((nX & 2) + nY4)) & 3) << 2)];
-
-      pPoint[0] = pPalTbl[pbyChrData[0]];
-      pPoint[1] = pPalTbl[pbyChrData[1]];
-      pPoint[2] = pPalTbl[pbyChrData[2]];
-      pPoint[3] = pPalTbl[pbyChrData[3]];
-      pPoint[4] = pPalTbl[pbyChrData[4]];
-      pPoint[5] = pPalTbl[pbyChrData[5]];
-      pPoint[6] = pPalTbl[pbyChrData[6]];
-      pPoint[7] = pPalTbl[pbyChrData[7]];
-      pPoint += 8;
+        pbyChrData = pbyBgBase + (*pbyNameTable << 6) + nYBit;
+        pPalTbl = &PalTable[(((pAttrBase[nX >> 2] >> ((nX & 2) + nY4)) & 3) << 2)];
+
+        pPoint[0] = pPalTbl[pbyChrData[0]];
+        pPoint[1] = pPalTbl[pbyChrData[1]];
+        pPoint[2] = pPalTbl[pbyChrData[2]];
+        pPoint[3] = pPalTbl[pbyChrData[3]];
+        pPoint[4] = pPalTbl[pbyChrData[4]];
+        pPoint[5] = pPalTbl[pbyChrData[5]];
+        pPoint[6] = pPalTbl[pbyChrData[6]];
+        pPoint[7] = pPalTbl[pbyChrData[7]];
+        pPoint += 8;
 #else
-      putBG(nX);
+        putBG(nX);
 #endif
 
-      // Callback at PPU read/write
-      MapperPPU(PATTBL(pbyChrData));
+        // Callback at PPU read/write
+        if (bMapperPPU)
+          MapperPPU(PATTBL(pbyChrData));
 
-      ++pbyNameTable;
-    }
+        ++pbyNameTable;
+      }
 
-    /*-------------------------------------------------------------------*/
-    /*  Rendering of the block of the right end                          */
-    /*-------------------------------------------------------------------*/
+      /*-------------------------------------------------------------------*/
+      /*  Rendering of the block of the right end                          */
+      /*-------------------------------------------------------------------*/
 
 #if 0
-    pbyChrData = PPU_BG_Base + (*pbyNameTable << 6) + nYBit;
-    pPalTbl = &PalTable[(((pAttrBase[nX >> 2] >> ((nX & 2) + nY4)) & 3) << 2)];
-    for (nIdx = 0; nIdx < PPU_Scr_H_Bit; ++nIdx)
-    {
-      pPoint[nIdx] = pPalTbl[pbyChrData[nIdx]];
-    }
+      pbyChrData = pbyBgBase + (*pbyNameTable << 6) + nYBit;
+      pPalTbl = &PalTable[(((pAttrBase[nX >> 2] >> ((nX & 2) + nY4)) & 3) << 2)];
+      for (nIdx = 0; nIdx < DrawState.byScrHBit; ++nIdx)
+      {
+        pPoint[nIdx] = pPalTbl[pbyChrData[nIdx]];
+      }
 #else
-    {
-      const auto pal = &PalTable[(((pAttrBase[nX >> 2] >> ((nX & 2) + nY4)) & 3) << 2)];
-      const auto pal8 = &PalTable8[(((pAttrBase[nX >> 2] >> ((nX & 2) + nY4)) & 3) << 2)];
-
-      const int ch = *pbyNameTable;
-      const int bank = (ch >> 6) + bankOfsBG;
-      const int addrOfs = ((ch & 63) << 4) + yOfsModBG;
-      const auto data = PPUBANK[bank] + addrOfs;
-      const auto pl0 = data[0];
-      const auto pl1 = data[8];
-      const auto pat0 = (pl0 & 0x55) | ((pl1 << 1) & 0xaa);
-      const auto pat1 = ((pl0 >> 1) & 0x55) | (pl1 & 0xaa);
-      //      const auto [pat0, pat1] = getPatBG(ch);
-      switch (PPU_Scr_H_Bit)
       {
-      case 8:
-        pPoint[7] = pal[(pat0 >> 0) & 3];
-        pPoint8[7] = pal8[(pat0 >> 0) & 3];
-      case 7:
-        pPoint[6] = pal[(pat1 >> 0) & 3];
-        pPoint8[6] = pal8[(pat1 >> 0) & 3];
-      case 6:
-        pPoint[5] = pal[(pat0 >> 2) & 3];
-        pPoint8[5] = pal8[(pat0 >> 2) & 3];
-      case 5:
-        pPoint[4] = pal[(pat1 >> 2) & 3];
-        pPoint8[4] = pal8[(pat1 >> 2) & 3];
-      case 4:
-        pPoint[3] = pal[(pat0 >> 4) & 3];
-        pPoint8[3] = pal8[(pat0 >> 4) & 3];
-      case 3:
-        pPoint[2] = pal[(pat1 >> 4) & 3];
-        pPoint8[2] = pal8[(pat1 >> 4) & 3];
-      case 2:
-        pPoint[1] = pal[(pat0 >> 6) & 3];
-        pPoint8[1] = pal8[(pat0 >> 6) & 3];
-      case 1:
-        pPoint[0] = pal[(pat1 >> 6) & 3];
-        pPoint8[0] = pal8[(pat1 >> 6) & 3];
-      default:
-        break;
+#if !INFONES_DRAW8
+        const auto pal = &PalTable[(((pAttrBase[nX >> 2] >> ((nX & 2) + nY4)) & 3) << 2)];
+#endif
+        const auto pal8 = &PalTable8[(((pAttrBase[nX >> 2] >> ((nX & 2) + nY4)) & 3) << 2)];
+
+        const int ch = *pbyNameTable;
+        const int bank = (ch >> 6) + bankOfsBG;
+        const int addrOfs = ((ch & 63) << 4) + yOfsModBG;
+        const auto data = DrawState.ppbyBank[bank] + addrOfs;
+        const auto pl0 = data[0];
+        const auto pl1 = data[8];
+        const auto pat0 = (pl0 & 0x55) | ((pl1 << 1) & 0xaa);
+        const auto pat1 = ((pl0 >> 1) & 0x55) | (pl1 & 0xaa);
+        //      const auto [pat0, pat1] = getPatBG(ch);
+        auto put = [&](int i, int v) __attribute__((always_inline))
+        {
+#if !INFONES_DRAW8
+          pPoint[i] = pal[v];
+#endif
+          pPoint8[i] = pal8[v];
+        };
+        switch (DrawState.byScrHBit)
+        {
+        case 8:
+          put(7, (pat0 >> 0) & 3);
+          [[fallthrough]];
+        case 7:
+          put(6, (pat1 >> 0) & 3);
+          [[fallthrough]];
+        case 6:
+          put(5, (pat0 >> 2) & 3);
+          [[fallthrough]];
+        case 5:
+          put(4, (pat1 >> 2) & 3);
+          [[fallthrough]];
+        case 4:
+          put(3, (pat0 >> 4) & 3);
+          [[fallthrough]];
+        case 3:
+          put(2, (pat1 >> 4) & 3);
+          [[fallthrough]];
+        case 2:
+          put(1, (pat0 >> 6) & 3);
+          [[fallthrough]];
+        case 1:
+          put(0, (pat1 >> 6) & 3);
+        default:
+          break;
+        }
+
+        //      pPoint += DrawState.byScrHBit;
       }
+#endif
 
-      //      pPoint += PPU_Scr_H_Bit;
+      // Callback at PPU read/write
+      if (bMapperPPU)
+        MapperPPU(PATTBL(pbyChrData));
     }
 #endif
 
-    // Callback at PPU read/write
-    MapperPPU(PATTBL(pbyChrData));
-
     /*-------------------------------------------------------------------*/
     /*  Backgroud Clipping                                               */
     /*-------------------------------------------------------------------*/
-    if (!(PPU_R1 & R1_CLIP_BG))
+    if (!(nMode & R1_CLIP_BG))
     {
-      WORD *pPointTop;
       BYTE *pPointTop8;
 
-      // pPointTop = &WorkFrame[PPU_Scanline * NES_DISP_WIDTH];
-      pPointTop = WorkLine;
-      pPointTop8 = WorkLine8;
+      // pPointTop = &WorkFrame[DrawState.wScanline * NES_DISP_WIDTH];
+      pPointTop8 = DrawState.pbyLine8;
+#if !INFONES_DRAW8
+      WORD *pPointTop = DrawState.pLine;
       InfoNES_MemorySet(pPointTop, 0, 8 << 1);
+#endif
       InfoNES_MemorySet(pPointTop8, 0, 8);
     }
 
     /*-------------------------------------------------------------------*/
     /*  Clear a scanline if up and down clipping flag is set             */
     /*-------------------------------------------------------------------*/
-    if (PPU_UpDown_Clip &&
-        (SCAN_ON_SCREEN_START > PPU_Scanline || PPU_Scanline > SCAN_BOTTOM_OFF_SCREEN_START))
+    if (DrawState.byUpDownClip &&
+        (SCAN_ON_SCREEN_START > DrawState.wScanline || DrawState.wScanline > SCAN_BOTTOM_OFF_SCREEN_START))
     {
-      WORD *pPointTop;
       BYTE *pPointTop8;
-      // pPointTop = &WorkFrame[PPU_Scanline * NES_DISP_WIDTH];
-      pPointTop = WorkLine;
-      pPointTop8 = WorkLine8;
+      // pPointTop = &WorkFrame[DrawState.wScanline * NES_DISP_WIDTH];
+      pPointTop8 = DrawState.pbyLine8;
+#if !INFONES_DRAW8
+      WORD *pPointTop = DrawState.pLine;
       InfoNES_MemorySet(pPointTop, 0, NES_DISP_WIDTH << 1);
+#endif
       InfoNES_MemorySet(pPointTop8, 0, NES_DISP_WIDTH);
     }
   }
@@ -1240,17 +2511,97 @@ void __not_in_flash_func(InfoNES_DrawLine)()
   /*-------------------------------------------------------------------*/
 
   /* MMC5 VROM switch */
-  MapperRenderScreen(0);
+  if (MapperCaps & MAPPER_CAP_RENDER_SCREEN)
+    MapperRenderScreen(0);
 
-  if (PPU_R1 & R1_SHOW_SP)
+  if (nMode & R1_SHOW_SP)
   {
     // Reset Scanline Sprite Count
-    PPU_R2 &= ~R2_MAX_SP;
+    DrawState.bySprOverflow = 0;
+
+#if INFONES_SPRITE_BINS
+    if (SprBinUpdate || SprBinHeight != nSpHeight)
+      binSprites();
+
+    // Decoded rows are from other patterns after a bank switch
+    const BYTE spR0 = DrawState.byR0 & (R0_SP_SIZE | R0_SP_ADDR);
+    bool bankSwitched = spR0 != SprRowsR0;
+    for (int nIdx = 0; nIdx < 8; ++nIdx)
+      bankSwitched |= SprRowsBank[nIdx] != DrawState.ppbyBank[nIdx];
+    if (bankSwitched)
+    {
+      InfoNES_MemoryCopy(SprRowsBank, DrawState.ppbyBank, sizeof SprRowsBank);
+      SprRowsR0 = spR0;
+      SprRowsValid = 0;
+    }
+
+    const BYTE *pList = SprList + SprLineStart[DrawState.wScanline];
+    const BYTE *pListEnd = SprList + SprLineStart[DrawState.wScanline + 1];
+    nSprCnt = pListEnd - pList;
+    if (nSprCnt)
+    {
+      // Span of the sprites on the scanline, in 4 pixel units
+      const int spanX = SprLineMinX[DrawState.wScanline] & ~3;
+      const int spanEnd = SprLineMaxX[DrawState.wScanline] + 8 + 3 < NES_DISP_WIDTH ? (SprLineMaxX[DrawState.wScanline] + 8 + 3) & ~3 : NES_DISP_WIDTH;
+
+      // Reset sprite buffer
+      InfoNES_MemorySet(pSprBuf + spanX, 0, spanEnd - spanX);
+
+      // Render the sprites to the sprite buffer
+      for (; pList < pListEnd; ++pList)
+      {
+        const int n = *pList;
+        if (!((SprRowsValid >> n) & 1))
+          decodeSprite(n);
+
+        pSPRRAM = SPRRAM + (n << 2);
+        const int row = SprRows[n][DrawState.wScanline - pSPRRAM[SPR_Y] - 1];
+        if (!row)
+          continue;
+
+        nAttr = pSPRRAM[SPR_ATTR] ^ SPR_ATTR_PRI;
+
+#if INFONES_DRAW8
+        // Colour and bits of a sprite pixel of InfoNES_Composite.h
+        const auto sprPal8 = PalTable8 + 0x10 + ((nAttr & SPR_ATTR_COLOR) << 2);
+        const BYTE sprBits = SPR8_OPAQUE | ((nAttr & SPR_ATTR_PRI) << 2);
+        auto sprPixel = [=](int v) __attribute__((always_inline)) { return sprPal8[v] | sprBits; };
+#else
+        const BYTE bySprCol = (nAttr & (SPR_ATTR_COLOR | SPR_ATTR_PRI)) << 2;
+        auto sprPixel = [=](int v) __attribute__((always_inline)) { return bySprCol | v; };
+#endif
+        const auto dst = pSprBuf + pSPRRAM[SPR_X];
+
+        auto proc = [=](int i) __attribute__((always_inline))
+        {
+          if (int v = (row >> (14 - i * 2)) & 3)
+          {
+            dst[i] = sprPixel(v);
+          }
+        };
 
+        proc(0);
+        proc(1);
+        proc(2);
+        proc(3);
+        proc(4);
+        proc(5);
+        proc(6);
+        proc(7);
+      }
+
+      // Rendering sprite
+#if INFONES_DRAW8
+      compositeSprite(pSprBuf + spanX, DrawState.pbyLine8 + spanX, spanEnd - spanX);
+#else
+      compositeSprite(PalTable + 0x10, PalTable8 + 0x10, pSprBuf + spanX, DrawState.pLine + spanX, DrawState.pbyLine8 + spanX, spanEnd - spanX);
+#endif
+    }
+#else
     // Reset sprite buffer
     InfoNES_MemorySet(pSprBuf, 0, sizeof pSprBuf);
 
-    const int patternTableIdSP88 = PPU_R0 & R0_SP_ADDR ? 1 : 0;
+    const int patternTableIdSP88 = DrawState.byR0 & R0_SP_ADDR ? 1 : 0;
     const int bankOfsSP88 = patternTableIdSP88 << 2;
 
     // Render a sprite to the sprite buffer
@@ -1258,7 +2609,7 @@ void __not_in_flash_func(InfoNES_DrawLine)()
     for (pSPRRAM = SPRRAM + (63 << 2); pSPRRAM >= SPRRAM; pSPRRAM -= 4)
     {
       nY = pSPRRAM[SPR_Y] + 1;
-      if (nY > PPU_Scanline || nY + PPU_SP_Height <= PPU_Scanline)
+      if (nY > DrawState.wScanline || nY + nSpHeight <= DrawState.wScanline)
         continue; // Next sprite
 
       /*-------------------------------------------------------------------*/
@@ -1269,13 +2620,13 @@ void __not_in_flash_func(InfoNES_DrawLine)()
       ++nSprCnt;
 
       nAttr = pSPRRAM[SPR_ATTR];
-      nYBit = PPU_Scanline - nY;
-      nYBit = (nAttr & SPR_ATTR_V_FLIP) ? (PPU_SP_Height - nYBit - 1) : nYBit;
+      nYBit = DrawState.wScanline - nY;
+      nYBit = (nAttr & SPR_ATTR_V_FLIP) ? (nSpHeight - nYBit - 1) : nYBit;
       const int yOfsModSP = nYBit;
       nYBit <<= 3;
 
 #if 0
-      if (PPU_R0 & R0_SP_SIZE)
+      if (nMode & R0_SP_SIZE)
       {
         // Sprite size 8x16
         if (pSPRRAM[SPR_CHR] & 1)
@@ -1290,7 +2641,7 @@ void __not_in_flash_func(InfoNES_DrawLine)()
       else
       {
         // Sprite size 8x8
-        pbyChrData = PPU_SP_Base + (pSPRRAM[SPR_CHR] << 6) + nYBit;
+        pbyChrData = ((DrawState.byR0 & R0_SP_ADDR) ? ChrBuf + 256 * 64 : ChrBuf) + (pSPRRAM[SPR_CHR] << 6) + nYBit;
       }
 
       nAttr ^= SPR_ATTR_PRI;
@@ -1341,7 +2692,7 @@ void __not_in_flash_func(InfoNES_DrawLine)()
       int ch = pSPRRAM[SPR_CHR];
 
       int bankOfs;
-      if (PPU_R0 & R0_SP_SIZE)
+      if (nMode & R0_SP_SIZE)
       {
         // 8x16
         bankOfs = (ch & 1) << 2;
@@ -1355,14 +2706,22 @@ void __not_in_flash_func(InfoNES_DrawLine)()
 
       const int bank = (ch >> 6) + bankOfs;
       const int addrOfs = ((ch & 63) << 4) + ((yOfsModSP & 8) << 1) + (yOfsModSP & 7);
-      const auto data = PPUBANK[bank] + addrOfs;
+      const auto data = DrawState.ppbyBank[bank] + addrOfs;
       const uint32_t pl0 = data[0];
       const uint32_t pl1 = data[8];
       const auto pat0 = ((pl0 & 0x55) << 24) | ((pl1 & 0x55) << 25);
       const auto pat1 = ((pl0 & 0xaa) << 23) | ((pl1 & 0xaa) << 24);
 
       nAttr ^= SPR_ATTR_PRI;
-      bySprCol = (nAttr & (SPR_ATTR_COLOR | SPR_ATTR_PRI)) << 2;
+#if INFONES_DRAW8
+      // Colour and bits of a sprite pixel of InfoNES_Composite.h
+      const auto sprPal8 = PalTable8 + 0x10 + ((nAttr & SPR_ATTR_COLOR) << 2);
+      const BYTE sprBits = SPR8_OPAQUE | ((nAttr & SPR_ATTR_PRI) << 2);
+      auto sprPixel = [=](int v) __attribute__((always_inline)) { return sprPal8[v] | sprBits; };
+#else
+      const BYTE bySprCol = (nAttr & (SPR_ATTR_COLOR | SPR_ATTR_PRI)) << 2;
+      auto sprPixel = [=](int v) __attribute__((always_inline)) { return bySprCol | v; };
+#endif
       nX = pSPRRAM[SPR_X];
       const auto dst = pSprBuf + nX;
 
@@ -1371,35 +2730,35 @@ void __not_in_flash_func(InfoNES_DrawLine)()
         // h flip
         if (int v = (pat1 << 0) >> 30)
         {
-          dst[7] = bySprCol | v;
+          dst[7] = sprPixel(v);
         }
         if (int v = (pat0 << 0) >> 30)
         {
-          dst[6] = bySprCol | v;
+          dst[6] = sprPixel(v);
         }
         if (int v = (pat1 << 2) >> 30)
         {
-          dst[5] = bySprCol | v;
+          dst[5] = sprPixel(v);
         }
         if (int v = (pat0 << 2) >> 30)
         {
-          dst[4] = bySprCol | v;
+          dst[4] = sprPixel(v);
         }
         if (int v = (pat1 << 4) >> 30)
         {
-          dst[3] = bySprCol | v;
+          dst[3] = sprPixel(v);
         }
         if (int v = (pat0 << 4) >> 30)
         {
-          dst[2] = bySprCol | v;
+          dst[2] = sprPixel(v);
         }
         if (int v = (pat1 << 6) >> 30)
         {
-          dst[1] = bySprCol | v;
+          dst[1] = sprPixel(v);
         }
         if (int v = (pat0 << 6) >> 30)
         {
-          dst[0] = bySprCol | v;
+          dst[0] = sprPixel(v);
         }
       }
       else
@@ -1407,47 +2766,51 @@ void __not_in_flash_func(InfoNES_DrawLine)()
         // non flip
         if (int v = (pat1 << 0) >> 30)
         {
-          dst[0] = bySprCol | v;
+          dst[0] = sprPixel(v);
         }
         if (int v = (pat0 << 0) >> 30)
         {
-          dst[1] = bySprCol | v;
+          dst[1] = sprPixel(v);
         }
         if (int v = (pat1 << 2) >> 30)
         {
-          dst[2] = bySprCol | v;
+          dst[2] = sprPixel(v);
         }
         if (int v = (pat0 << 2) >> 30)
         {
-          dst[3] = bySprCol | v;
+          dst[3] = sprPixel(v);
         }
         if (int v = (pat1 << 4) >> 30)
         {
-          dst[4] = bySprCol | v;
+          dst[4] = sprPixel(v);
         }
         if (int v = (pat0 << 4) >> 30)
         {
-          dst[5] = bySprCol | v;
+          dst[5] = sprPixel(v);
         }
         if (int v = (pat1 << 6) >> 30)
         {
-          dst[6] = bySprCol | v;
+          dst[6] = sprPixel(v);
         }
         if (int v = (pat0 << 6) >> 30)
         {
-          dst[7] = bySprCol | v;
+          dst[7] = sprPixel(v);
         }
       }
 #endif
     }
 
     // Rendering sprite
-    pPoint = WorkLine;
-    pPoint8 = WorkLine8;
-    //   pPoint -= (NES_DISP_WIDTH - PPU_Scr_H_Bit);
+#if !INFONES_DRAW8
+    pPoint = DrawState.pLine;
+#endif
+    pPoint8 = DrawState.pbyLine8;
+    //   pPoint -= (NES_DISP_WIDTH - DrawState.byScrHBit);
 
-#if 1
-    compositeSprite(PalTable + 0x10, PalTable8 + 0x10, pSprBuf, pPoint, pPoint8);
+#if INFONES_DRAW8
+    compositeSprite(pSprBuf, pPoint8, NES_DISP_WIDTH);
+#elif 1
+    compositeSprite(PalTable + 0x10, PalTable8 + 0x10, pSprBuf, pPoint, pPoint8, NES_DISP_WIDTH);
 #else
     {
       const auto *pal = &PalTable[0x10];
@@ -1480,30 +2843,305 @@ void __not_in_flash_func(InfoNES_DrawLine)()
 #endif
       }
     }
+#endif
+
 #endif
 
     /*-------------------------------------------------------------------*/
     /*  Sprite Clipping                                                  */
     /*-------------------------------------------------------------------*/
-    if (!(PPU_R1 & R1_CLIP_SP))
+    if (!(nMode & R1_CLIP_SP))
     {
-      WORD *pPointTop;
       BYTE *pPointTop8;
 
-      // pPointTop = &WorkFrame[PPU_Scanline * NES_DISP_WIDTH];
-      pPointTop = WorkLine;
-      pPointTop8 = WorkLine8;
+      // pPointTop = &WorkFrame[DrawState.wScanline * NES_DISP_WIDTH];
+      pPointTop8 = DrawState.pbyLine8;
+#if !INFONES_DRAW8
+      WORD *pPointTop = DrawState.pLine;
       InfoNES_MemorySet(pPointTop, 0, 8 << 1);
+#endif
       InfoNES_MemorySet(pPointTop8, 0, 8);
     }
 
     if (nSprCnt >= 8)
-      PPU_R2 |= R2_MAX_SP; // Set a flag of maximum sprites on scanline
+      DrawState.bySprOverflow = R2_MAX_SP; // Set a flag of maximum sprites on scanline
 
     // util::WorkMeterMark(MARKER_SPRITE);
   }
 }
 
+#if INFONES_DRAWLINE_VARIANTS
+/* A variant for every mode, the modes that render the same share one */
+template <int... N>
+static constexpr std::array<void (*)(), sizeof...(N)> makeDrawLineVariants(std::integer_sequence<int, N...>)
+{
+  return {{drawLine<drawLineVariantMode(N << 1)>...}};
+}
+
+/* Indexed by DRAW_LINE_MODE() >> 1 ( in RAM ) */
+static std::array<void (*)(), 32> DrawLineVariants = makeDrawLineVariants(std::make_integer_sequence<int, 32>());
+#endif
+
+/* drawLine() of the mode of DrawState */
+static inline void drawLineOfMode()
+{
+#if INFONES_DRAWLINE_VARIANTS
+  DrawLineVariants[DRAW_LINE_MODE() >> 1]();
+#else
+  drawLine<DRAW_LINE_ANY_MODE>();
+#endif
+}
+
+/* Take the state that the scanline is rendered from, other than the banks */
+static inline void captureDrawState(struct InfoNES_DrawState_tag &state)
+{
+  state.pLine = WorkLine;
+  state.pbyLine8 = WorkLine8;
+  state.wScanline = PPU_Scanline;
+  state.wAddr = PPU_Addr;
+  state.byR0 = PPU_R0;
+  state.byR1 = PPU_R1;
+  state.byScrHByte = PPU_Scr_H_Byte;
+  state.byScrHBit = PPU_Scr_H_Bit;
+  state.byNameTableBank = PPU_NameTableBank;
+  state.byUpDownClip = PPU_UpDown_Clip;
+}
+
+/* Render the scanline of the current state */
+static void __not_in_flash_func(drawCurrentLine)()
+{
+  // The banks as they are, the mapper callbacks switch them while the scanline is rendered
+  captureDrawState(DrawState);
+  DrawState.ppbyBank = PPUBANK;
+  drawLineOfMode();
+
+  if (DrawState.byR1 & R1_SHOW_SP)
+    PPU_R2 = (PPU_R2 & ~R2_MAX_SP) | DrawState.bySprOverflow;
+}
+
+#if INFONES_DEFERRED_RENDER
+static_assert(!(INFONES_DEFERRED_QUEUE_SIZE & (INFONES_DEFERRED_QUEUE_SIZE - 1)),
+              "INFONES_DEFERRED_QUEUE_SIZE is a power of 2");
+
+/* A scanline queued for the deferred renderer */
+struct InfoNES_DeferredLine_tag
+{
+  struct InfoNES_DrawState_tag state;
+  BYTE *pbyBank[16]; /* PPUBANK */
+};
+
+/* Scanlines from InfoNES_HSync() to InfoNES_DeferredRender(), one producer and one consumer */
+static struct InfoNES_DeferredLine_tag DeferredQueue[INFONES_DEFERRED_QUEUE_SIZE];
+static std::atomic<unsigned> DeferredHead; /* Written by InfoNES_DrawLine() */
+static std::atomic<unsigned> DeferredTail; /* Written by InfoNES_DeferredRender() once a scanline is out */
+
+/* R2_MAX_SP of the last rendered scanline with sprites, DEFERRED_NO_SPRITES if none since the flush */
+#define DEFERRED_NO_SPRITES 0xff
+static BYTE DeferredSprOverflow = DEFERRED_NO_SPRITES;
+
+/* Scanlines are queued */
+volatile BYTE DeferredRenderEnable;
+
+/* Queue the scanline of the current state */
+static void __not_in_flash_func(deferLine)()
+{
+  const unsigned nHead = DeferredHead.load(std::memory_order_relaxed);
+  while (nHead - DeferredTail.load(std::memory_order_acquire) == INFONES_DEFERRED_QUEUE_SIZE)
+    ; // The queue is full
+
+  struct InfoNES_DeferredLine_tag &line = DeferredQueue[nHead % INFONES_DEFERRED_QUEUE_SIZE];
+  captureDrawState(line.state);
+  InfoNES_MemoryCopy(line.pbyBank, PPUBANK, sizeof line.pbyBank);
+  DeferredHead.store(nHead + 1, std::memory_order_release);
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*      InfoNES_DeferredRender() : Render the queued scanlines       */
+/*                                                                   */
+/*===================================================================*/
+int __not_in_flash_func(InfoNES_DeferredRender)()
+{
+  /*
+ *  Render the queued scanlines
+ *
+ *  Return values
+ *    The number of scanlines rendered
+ *
+ *  Remarks
+ *    Called by the core or the thread that is not emulating. OAM, palettes,
+ *    CHR-RAM and name tables are read as they are, InfoNES_DeferredFlush()
+ *    keeps them until the scanlines before a write to them are out.
+ */
+
+  const unsigned nHead = DeferredHead.load(std::memory_order_acquire);
+  const unsigned nTail = DeferredTail.load(std::memory_order_relaxed);
+  for (unsigned nIdx = nTail; nIdx != nHead; ++nIdx)
+  {
+    struct InfoNES_DeferredLine_tag &line = DeferredQueue[nIdx % INFONES_DEFERRED_QUEUE_SIZE];
+    DrawState = line.state;
+    DrawState.ppbyBank = line.pbyBank;
+    drawLineOfMode();
+
+    if (DrawState.byR1 & R1_SHOW_SP)
+      DeferredSprOverflow = DrawState.bySprOverflow;
+    DeferredTail.store(nIdx + 1, std::memory_order_release);
+  }
+  return nHead - nTail;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*    InfoNES_DeferredFlush() : Wait for the queued scanlines        */
+/*                                                                   */
+/*===================================================================*/
+void __not_in_flash_func(InfoNES_DeferredFlush)()
+{
+  /*
+ *  Wait until the queued scanlines are rendered
+ *
+ *  Remarks
+ *    The renderer is idle after it, and R2_MAX_SP is the one of the
+ *    last scanline with sprites.
+ */
+
+  const unsigned nHead = DeferredHead.load(std::memory_order_relaxed);
+  while (DeferredTail.load(std::memory_order_acquire) != nHead)
+    ; // The renderer is behind
+
+  if (DeferredSprOverflow != DEFERRED_NO_SPRITES)
+  {
+    PPU_R2 = (PPU_R2 & ~R2_MAX_SP) | DeferredSprOverflow;
+    DeferredSprOverflow = DEFERRED_NO_SPRITES;
+  }
+}
+#endif
+
+#if INFONES_PPU_CATCHUP
+/* A scanline of a state, spans of it are copied to the scanline */
+alignas(4) static BYTE PPU_SpanLine8[NES_DISP_WIDTH];
+#if !INFONES_DRAW8
+static WORD PPU_SpanLine[NES_DISP_WIDTH];
+#endif
+
+/* Take the state to render from */
+static void __not_in_flash_func(setLineState)(const struct PPU_LineState_tag &state, int nX)
+{
+  InfoNES_MemoryCopy(PPUBANK, state.pbyBank, sizeof state.pbyBank);
+  PPU_Addr = state.wAddr;
+  PPU_R0 = state.byR0;
+  PPU_R1 = state.byR1;
+  PPU_Scr_H_Bit = state.byScrHBit;
+  PPU_BG_Base = (PPU_R0 & R0_BG_ADDR) ? ChrBuf + 256 * 64 : ChrBuf;
+  PPU_SP_Base = (PPU_R0 & R0_SP_ADDR) ? ChrBuf + 256 * 64 : ChrBuf;
+  PPU_SP_Height = (PPU_R0 & R0_SP_SIZE) ? 16 : 8;
+
+  // The horizontal scroll as InfoNES_HSync() sets it
+  int nScrollX = ((PPU_Addr & 0x400) >> 2) | ((PPU_Addr & 31) << 3);
+
+  // The coarse scroll that a write to $2006 changed in the middle of the scanline, the
+  // tile fetched next is at the write ( the first entry is the start of the scanline )
+  if (nX && ((PPU_Addr ^ PPU_Log[0].wAddr) & 0x41f))
+    nScrollX = (nScrollX - (((nX + 7) >> 3) << 3)) & 511;
+
+  PPU_Scr_H_Byte = (nScrollX >> 3) & 31;
+  PPU_NameTableBank = NAME_TABLE0 + ((PPU_Addr >> 10) & 2) + (nScrollX >> 8);
+}
+
+/* Render a scanline with writes in the log, in spans between them */
+static void __not_in_flash_func(drawLineSpans)()
+{
+  // The state at the end of the scanline
+  struct PPU_LineState_tag current;
+  InfoNES_MemoryCopy(current.pbyBank, PPUBANK, sizeof current.pbyBank);
+  current.wAddr = PPU_Addr;
+  current.byR0 = PPU_R0;
+  current.byR1 = PPU_R1;
+  current.byScrHBit = PPU_Scr_H_Bit;
+  const BYTE byScrHByte = PPU_Scr_H_Byte;
+  const BYTE byNameTableBank = PPU_NameTableBank;
+
+  WORD *pLine = WorkLine;
+  BYTE *pLine8 = WorkLine8;
+
+  // The first span renders the whole scanline, the others are copied over it
+  int nX0 = 0;
+  bool bFirst = true;
+  for (int nIdx = 0; nIdx <= PPU_LogCount; ++nIdx)
+  {
+    const struct PPU_LineState_tag &state = nIdx < PPU_LogCount ? PPU_Log[nIdx] : current;
+    const int nX1 = nIdx < PPU_LogCount ? PPU_Log[nIdx].wX : NES_DISP_WIDTH;
+    if (nX1 <= nX0)
+      continue;
+
+    setLineState(state, nX0);
+    if (bFirst)
+    {
+      drawCurrentLine();
+      bFirst = false;
+    }
+    else
+    {
+      WorkLine8 = PPU_SpanLine8;
+#if !INFONES_DRAW8
+      WorkLine = PPU_SpanLine;
+#endif
+      drawCurrentLine();
+      InfoNES_MemoryCopy(pLine8 + nX0, PPU_SpanLine8 + nX0, nX1 - nX0);
+#if !INFONES_DRAW8
+      InfoNES_MemoryCopy(pLine + nX0, PPU_SpanLine + nX0, (nX1 - nX0) << 1);
+#endif
+    }
+    nX0 = nX1;
+  }
+
+  setLineState(current, 0);
+  PPU_Scr_H_Byte = byScrHByte;
+  PPU_NameTableBank = byNameTableBank;
+  WorkLine = pLine;
+  WorkLine8 = pLine8;
+  PPU_LogCount = 0;
+}
+#endif
+
+/*===================================================================*/
+/*                                                                   */
+/*              InfoNES_DrawLine() : Render a scanline               */
+/*                                                                   */
+/*===================================================================*/
+void __not_in_flash_func(InfoNES_DrawLine)()
+{
+  /*
+ *  Render a scanline
+ *
+ */
+
+#if INFONES_PPU_CATCHUP
+  // Writes in the middle of the scanline ( mappers with callbacks in the renderer switch
+  // the banks as it draws, so they draw the scanline once with the state at its end )
+  if (PPU_LogCount && !(MapperCaps & (MAPPER_CAP_PPU | MAPPER_CAP_RENDER_SCREEN)))
+  {
+#if INFONES_DEFERRED_RENDER
+    InfoNES_DeferredFlush();
+#endif
+    drawLineSpans();
+    return;
+  }
+#endif
+
+#if INFONES_DEFERRED_RENDER
+  // Mappers with callbacks in the renderer keep it here, with the state they switch
+  if (DeferredRenderEnable && !(MapperCaps & (MAPPER_CAP_PPU | MAPPER_CAP_RENDER_SCREEN)))
+  {
+    deferLine();
+    return;
+  }
+  InfoNES_DeferredFlush();
+#endif
+
+  drawCurrentLine();
+}
+
 /*===================================================================*/
 /*                                                                   */
 /* InfoNES_GetSprHitY() : Get a position of scanline hits sprite #0  */
@@ -1691,6 +3329,26 @@ void __not_in_flash_func(InfoNES_SetupChr)()
     pbyPrevBank[nBank] = PPUBANK[nBank];
   }
 
+  // Reset update flag
+  ChrBufUpdate = 0;
+#elif INFONES_CHR_CACHE
+  if (!ChrBufUpdate)
+    return;
+
+  // Banks out of VROM are CHR-RAM, that the game has written to
+  const BYTE *pbyVRomEnd = VROM + NesHeader.byVRomSize * 0x2000;
+  for (int nSlot = 0; nSlot < INFONES_CHR_CACHE_SLOTS; ++nSlot)
+  {
+    const BYTE *pbyKey = ChrCacheKey[nSlot];
+    if (pbyKey && !(VROM && pbyKey >= VROM && pbyKey < pbyVRomEnd))
+    {
+      ChrCacheKey[nSlot] = NULL;
+      ChrCacheStamp[nSlot] = 0;
+    }
+  }
+  for (int nBank = 0; nBank < 8; ++nBank)
+    ChrCacheSrc[nBank] = NULL;
+
   // Reset update flag
   ChrBufUpdate = 0;
 #endif
@@ -48,6 +48,10 @@ extern BYTE *ROMBANK[4];
 #define ROMBANK2 (ROMBANK[2])
 #define ROMBANK3 (ROMBANK[3])
 
+/* CPU memory map ( 256 bytes * 256 pages, NULL : handled by K6502_Read/Write ) */
+extern BYTE *CPU_ReadPage[256];
+extern BYTE *CPU_WritePage[256];
+
 /*-------------------------------------------------------------------*/
 /*  PPU resources                                                    */
 /*-------------------------------------------------------------------*/
@@ -150,6 +154,21 @@ extern BYTE PPU_UpDown_Clip;
 #define STEP_PER_SCANLINE 114 // 113.66
 #define STEP_PER_FRAME 29780 // 29780.5
 
+/* Master clock ( PPU dots, 3 per CPU clock ) */
+#define CLOCKS_PER_CPU 3
+#define CLOCKS_PER_SCANLINE 341
+
+/* Scheduled events ( a lower number goes first at the same deadline ) */
+#define EVENT_SCANLINE 0   /* End of a scanline */
+#define EVENT_SPRITE0 1    /* Sprite #0 hit */
+#define EVENT_FRAME_IRQ 2  /* pAPU frame IRQ */
+#define EVENT_MAPPER_IRQ 3 /* Mapper IRQ counted in CPU clocks */
+#define EVENT_DMC 4        /* End of a DPCM sample */
+#define EVENT_COUNT 5
+
+/* Deadline of an event that is not scheduled */
+#define EVENT_NONE (~(QWORD)0)
+
 /* Develop Scroll Registers */
 #if 0
 #define InfoNES_SetupScr()                             \
@@ -190,12 +209,89 @@ extern WORD PPU_SP_Height;
 #define NES_DISP_WIDTH 256
 #define NES_DISP_HEIGHT 240
 
+/* Scanline output ( 0: 16-bit colours and 8-bit palette indices, 1: 8-bit palette indices only, 4 byte aligned ) */
+#ifndef INFONES_DRAW8
+#define INFONES_DRAW8 0
+#endif
+
+/* A palette index of the backdrop colour ( transparent background ) has this bit in INFONES_DRAW8 */
+#define PAL8_BG_CLEAR 0x80
+
+/* Background of INFONES_DRAW8 ( 0: a pixel a store, 1: 4 pixels a 32-bit store ) */
+#ifndef INFONES_BG_SWAR
+#define INFONES_BG_SWAR 0
+#endif
+
+/* Background of INFONES_DRAW8 ( 0: rendered from the tiles every scanline, 1: copied from name tables
+   pre-rendered in RAM, that the tiles are rendered to again when they change ) */
+#ifndef INFONES_BG_CACHE
+#define INFONES_BG_CACHE 0
+#endif
+
+/* Name tables in the background cache ( 2: horizontal / vertical mirroring, 4: four screen ) */
+#ifndef INFONES_BG_CACHE_PAGES
+#define INFONES_BG_CACHE_PAGES 2
+#endif
+
+/* Patterns ( 0: decoded from PPUBANK[] every row, 1: decoded once a bank to a cache of INFONES_CHR_CACHE_SLOTS 1KB
+   banks, read by the background of INFONES_BG_SWAR and the sprites of INFONES_SPRITE_BINS ) */
+#ifndef INFONES_CHR_CACHE
+#define INFONES_CHR_CACHE 0
+#endif
+
+#ifndef INFONES_CHR_CACHE_SLOTS
+#define INFONES_CHR_CACHE_SLOTS 16
+#endif
+
+/* Sprites ( 0: all 64 scanned every scanline, 1: binned per scanline when OAM is written ) */
+#ifndef INFONES_SPRITE_BINS
+#define INFONES_SPRITE_BINS 0
+#endif
+
+/* Scanline renderer ( 0: one that tests the R0/R1 mode bits every scanline, 1: a variant for every
+   mode, picked from a table every scanline, 15 times the code in RAM ) */
+#ifndef INFONES_DRAWLINE_VARIANTS
+#define INFONES_DRAWLINE_VARIANTS 0
+#endif
+
+/* PPU writes while a scanline is drawn ( 0: applied to the whole scanline, 1: logged with the dot
+   they are at, and the scanline is rendered in spans between them ) */
+#ifndef INFONES_PPU_CATCHUP
+#define INFONES_PPU_CATCHUP 0
+#endif
+
+/* Writes logged a scanline, the writes after them are applied to the rest of the scanline */
+#ifndef INFONES_PPU_LOG_SIZE
+#define INFONES_PPU_LOG_SIZE 8
+#endif
+
+/* Frame skip ( 0: FrameSkip as it is set, 1: raised and lowered by the time core0 takes for the
+   frames against the 60Hz budget ) */
+#ifndef INFONES_AUTO_FRAMESKIP
+#define INFONES_AUTO_FRAMESKIP 0
+#endif
+
+/* The highest frame skip of INFONES_AUTO_FRAMESKIP */
+#ifndef INFONES_FRAMESKIP_MAX
+#define INFONES_FRAMESKIP_MAX 3
+#endif
+
+/* Scanlines ( 0: rendered in InfoNES_HSync(), 1: their PPU state queued for InfoNES_DeferredRender()
+   on another core while DeferredRenderEnable is set ) */
+#ifndef INFONES_DEFERRED_RENDER
+#define INFONES_DEFERRED_RENDER 0
+#endif
+
+/* Scanlines queued for the deferred renderer */
+#ifndef INFONES_DEFERRED_QUEUE_SIZE
+#define INFONES_DEFERRED_QUEUE_SIZE 16
+#endif
+
 /* VRAM Write Enable ( 0: Disable, 1: Enable ) */
 extern BYTE byVramWriteEnable;
 
 /* Frame IRQ ( 0: Disabled, 1: Enabled )*/
 extern BYTE FrameIRQ_Enable;
-extern WORD FrameStep;
 
 /*-------------------------------------------------------------------*/
 /*  Display and Others resouces                                      */
@@ -206,6 +302,28 @@ extern WORD FrameSkip;
 extern WORD FrameCnt;
 extern WORD FrameWait;
 
+/* Frames emulated since the reset, the skipped ones included */
+extern DWORD EmulatedFrames;
+
+/* The number of the CPU clocks that idle loops skipped in the last frame */
+extern DWORD IdleClocksPerFrame;
+
+/* Instruction fetches served by the instruction cache in the last frame, and the others */
+extern DWORD DecodeHitsPerFrame;
+extern DWORD DecodeMissesPerFrame;
+
+/* Microseconds that K6502_Step() took in the last frame, and the CPU clocks of it */
+extern DWORD CpuMicrosPerFrame;
+extern DWORD CpuClocksPerFrame;
+
+#if INFONES_AUTO_FRAMESKIP
+/* Microseconds that core0 took for the last frame, without the waits */
+extern DWORD FrameMicros;
+
+/* Drawn frames with the skipped ones after them that were over their budget, since the reset */
+extern DWORD FrameDeadlineMisses;
+#endif
+
 #if 0
 extern WORD DoubleFrame[ 2 ][ NES_DISP_WIDTH * NES_DISP_HEIGHT ];
 extern WORD *WorkFrame;
@@ -218,7 +336,70 @@ extern BYTE ChrBuf[];
 
 extern BYTE ChrBufUpdate;
 
+#if INFONES_CHR_CACHE
+/* Bytes of RAM that the pattern cache takes */
+extern const DWORD ChrCacheBytes;
+
+/* Bank switches that found the bank in the pattern cache, and the ones that decoded it,
+   in this frame and the last frame */
+extern DWORD ChrCacheHits;
+extern DWORD ChrCacheMisses;
+extern DWORD ChrCacheHitsPerFrame;
+extern DWORD ChrCacheMissesPerFrame;
+#endif
+
+#if INFONES_DRAW8 && INFONES_BG_CACHE
+/* Update flag for the background cache ( set by writes to CHR-RAM, every tile is rendered again ) */
+extern BYTE BgCacheUpdate;
+
+/* Bytes of RAM that the background cache takes */
+extern const DWORD BgCacheBytes;
+
+/* Tiles of the rows of the background cache that scanlines were copied from, tiles rendered
+   again, and scanlines rendered without it ( a mapper hooks the pattern fetches, the name table
+   is not in PPURAM ), in this frame and the last frame */
+extern DWORD BgCacheHits;
+extern DWORD BgCacheMisses;
+extern DWORD BgCacheBypasses;
+extern DWORD BgCacheHitsPerFrame;
+extern DWORD BgCacheMissesPerFrame;
+extern DWORD BgCacheBypassesPerFrame;
+
+/* A name table byte was written */
+void InfoNES_BgCacheWrite(const BYTE *pbyAddr);
+#endif
+
+#if INFONES_SPRITE_BINS
+/* Update flag for the sprite bins ( set by writes to SPRRAM ) */
+extern BYTE SprBinUpdate;
+
+/* Sprites whose decoded rows are valid ( bit n: sprite n, cleared by writes to CHR-RAM ) */
+extern QWORD SprRowsValid;
+#endif
+
+#if INFONES_PPU_CATCHUP
+/* Writes to the PPU and the mapper are logged ( set while a scanline to be drawn runs ) */
+extern BYTE PPU_LogEnable;
+
+/* Around a write that may change the scanline being drawn, an entry is kept when it does */
+void InfoNES_PpuLogBegin();
+void InfoNES_PpuLogEnd();
+#endif
+
+#if INFONES_DEFERRED_RENDER
+/* Scanlines are queued ( set by the frontend once another core calls InfoNES_DeferredRender() ) */
+extern volatile BYTE DeferredRenderEnable;
+
+/* Render the queued scanlines ( the other core ), returns the number rendered */
+int InfoNES_DeferredRender();
+
+/* Wait until the queued scanlines are rendered ( before writes to the data they are rendered from ) */
+void InfoNES_DeferredFlush();
+#endif
+
+#if !INFONES_DRAW8
 extern WORD PalTable[];
+#endif
 extern BYTE PalTable8[];
 
 /*-------------------------------------------------------------------*/
@@ -267,6 +448,12 @@ extern void (*MapperPPU)(WORD wAddr);
 /* Callback at Rendering Screen 1:BG, 0:Sprite */
 extern void (*MapperRenderScreen)(BYTE byMode);
 
+/* Callbacks that the mapper has, other than the no-ops of mapper 0 */
+#define MAPPER_CAP_PPU 0x01           /* MapperPPU() */
+#define MAPPER_CAP_RENDER_SCREEN 0x02 /* MapperRenderScreen() */
+#define MAPPER_CAP_HSYNC 0x04         /* MapperHSync() */
+extern BYTE MapperCaps;
+
 /*-------------------------------------------------------------------*/
 /*  ROM information                                                  */
 /*-------------------------------------------------------------------*/
@@ -313,6 +500,27 @@ int InfoNES_Reset();
 /* Initialize PPU */
 void InfoNES_SetupPPU();
 
+/* Initialize CPU memory map */
+void InfoNES_SetupCpuMap();
+
+/* Follow ROMBANK and SRAMBANK changes in CPU memory map */
+void InfoNES_SyncCpuMap();
+
+/* Initialize the event scheduler */
+void InfoNES_SetupEvents();
+
+/* Master clock ( PPU dots since power on ) */
+QWORD InfoNES_MasterClock();
+
+/* Set the function that runs an event */
+void InfoNES_SetEventHandler(int nEvent, void (*pHandler)());
+
+/* Schedule an event at a master clock */
+void InfoNES_ScheduleEvent(int nEvent, QWORD qwDeadline);
+
+/* Cancel an event */
+void InfoNES_CancelEvent(int nEvent);
+
 /* Set up a Mirroring of Name Table */
 void InfoNES_Mirroring(int nType);
 
@@ -334,6 +542,7 @@ void InfoNES_GetSprHitY();
 /* Develop character data */
 void InfoNES_SetupChr();
 
+/* Set the line to render to ( p is not used in INFONES_DRAW8 ) */
 void InfoNES_SetLineBuffer(WORD *p, BYTE *p8, WORD size);
 
 #endif /* !InfoNES_H_INCLUDED */
@@ -0,0 +1,101 @@
+/*===================================================================*/
+/*                                                                   */
+/*  InfoNES_Composite.h : Sprite over background compositing of      */
+/*                        INFONES_DRAW8, 4 pixels a word             */
+/*                                                                   */
+/*===================================================================*/
+
+#ifndef INFONES_COMPOSITE_H_INCLUDED
+#define INFONES_COMPOSITE_H_INCLUDED
+
+#include <stdint.h>
+
+/*-------------------------------------------------------------------*/
+/*  Pixels                                                           */
+/*-------------------------------------------------------------------*/
+
+/*
+ *  A background pixel is a palette index, with PAL8_BG_CLEAR of
+ *  InfoNES.h ( 0x80 ) when it is the backdrop colour.
+ *
+ *  A sprite pixel is 0 where no sprite is drawn, else the palette
+ *  index of the sprite colour with these bits.
+ */
+#define SPR8_OPAQUE 0x40 /* a sprite is drawn */
+#define SPR8_FRONT 0x80  /* in front of the background */
+
+/*
+ *  Kernels ( a pixel is drawn when it is opaque, and in front or over the backdrop )
+ *
+ *  compositeSprite8()    : a pixel, the reference
+ *  compositeSprite8x4()  : 4 pixels of a little endian word, portable
+ *  compositeSprite8x4Dsp : 4 pixels by the byte select of the DSP extension of
+ *                          Armv7E-M / Armv8-M ( USUB8 and SEL ), on DspModel of
+ *                          the instructions where there is no DSP extension
+ */
+
+namespace InfoNES_Composite
+{
+  inline uint8_t compositeSprite8(uint8_t spr, uint8_t bg)
+  {
+    if ((spr & SPR8_OPAQUE) && ((spr & SPR8_FRONT) || (bg & 0x80)))
+      return spr & 0x3f;
+    return bg;
+  }
+
+  // Bit 7 of every byte that the sprite is drawn to
+  inline uint32_t drawMask(uint32_t spr, uint32_t bg)
+  {
+    return (spr | bg) & (spr << 1) & 0x80808080u;
+  }
+
+  inline uint32_t compositeSprite8x4(uint32_t spr, uint32_t bg)
+  {
+    const uint32_t m = drawMask(spr, bg);
+    const uint32_t mask = (m - (m >> 7)) | m;
+    return bg ^ ((bg ^ (spr & 0x3f3f3f3fu)) & mask);
+  }
+
+  // USUB8 a, b sets the GE flag of the bytes where a_i >= b_i, then SEL x, y
+  // takes those bytes from x and the others from y
+  struct DspModel
+  {
+    static inline uint32_t selectGE(uint32_t a, uint32_t b, uint32_t x, uint32_t y)
+    {
+      uint32_t r = 0;
+      for (int i = 0; i < 32; i += 8)
+      {
+        const uint32_t byte = 0xffu << i;
+        r |= ((a & byte) >= (b & byte) ? x : y) & byte;
+      }
+      return r;
+    }
+  };
+
+#if defined(__ARM_FEATURE_SIMD32)
+  struct Dsp
+  {
+    static inline uint32_t selectGE(uint32_t a, uint32_t b, uint32_t x, uint32_t y)
+    {
+      uint32_t r;
+      __asm__("usub8 %0, %1, %2\n\t"
+              "sel %0, %3, %4"
+              : "=&r"(r)
+              : "r"(a), "r"(b), "r"(x), "r"(y)
+              : "cc");
+      return r;
+    }
+  };
+#else
+  using Dsp = DspModel;
+#endif
+
+  template <class Ops = Dsp>
+  inline uint32_t compositeSprite8x4Dsp(uint32_t spr, uint32_t bg)
+  {
+    // GE is set in the bytes whose mask is 0x80
+    return Ops::selectGE(drawMask(spr, bg), 0x80808080u, spr & 0x3f3f3f3fu, bg);
+  }
+}
+
+#endif /* !INFONES_COMPOSITE_H_INCLUDED */
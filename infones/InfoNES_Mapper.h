@@ -290,7 +290,8 @@ void Map72_Write(WORD wAddr, BYTE byData);
 
 void Map73_Init();
 void Map73_Write(WORD wAddr, BYTE byData);
-void Map73_HSync();
+void Map73_IrqEvent();
+void Map73_ScheduleIrq();
 
 void Map74_Init();
 void Map74_Write(WORD wAddr, BYTE byData);
@@ -12,6 +12,10 @@
 /*-------------------------------------------------------------------*/
 /*  Type definition                                                  */
 /*-------------------------------------------------------------------*/
+#ifndef QWORD
+typedef unsigned long long QWORD;
+#endif /* !QWORD */
+
 #ifndef DWORD
 typedef unsigned long  DWORD;
 #endif /* !DWORD */
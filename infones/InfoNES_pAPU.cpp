@@ -22,7 +22,7 @@
 
 struct ApuEvent_t ApuEventQueue[APU_EVENT_MAX];
 int cur_event;
-WORD entertime;
+QWORD entertime;
 
 /*-------------------------------------------------------------------*/
 /*   APU Register Write Functions                                    */
@@ -1006,6 +1006,16 @@ void __not_in_flash_func(ApuRenderingWave5)(int n)
   }
 }
 
+/*-------------------------------------------------------------------*/
+/* Length of a DPCM sample in CPU clocks ( from APU registers )      */
+/*-------------------------------------------------------------------*/
+
+DWORD __not_in_flash_func(InfoNES_pAPUDmcClocks)(void)
+{
+  DWORD bytes = ((DWORD)APU_Reg[0x13] << 4) + 1;
+  return bytes * 8 * ApuDpcmCycles[APU_Reg[0x10] & 0x0F];
+}
+
 /*===================================================================*/
 /*                                                                   */
 /*     InfoNES_pApuVsync() : Callback Function per Vsync             */
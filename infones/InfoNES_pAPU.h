@@ -105,7 +105,7 @@
 
 struct ApuEvent_t
 {
-  short time;
+  int time; /* clocks since the last H-Sync */
   BYTE type;
   BYTE data;
 };
@@ -155,6 +155,7 @@ void InfoNES_pAPUInit(void);
 void InfoNES_pAPUDone(void);
 void InfoNES_pAPUVsync(void);
 void InfoNES_pAPUHsync(bool enabled);
+DWORD InfoNES_pAPUDmcClocks(void);
 
 /*-------------------------------------------------------------------*/
 /*  pAPU Quality resources                                           */
@@ -14,31 +14,169 @@
 #include "InfoNES_System.h"
 
 #include <stdio.h>
+#include <string.h>
 #include <pico.h>
 
+/*-------------------------------------------------------------------*/
+/*  Build options                                                    */
+/*-------------------------------------------------------------------*/
+
+// Opcode dispatch ( 0: switch, 1: threaded dispatch via a label table )
+#ifndef K6502_THREADED_DISPATCH
+#define K6502_THREADED_DISPATCH 0
+#endif
+
+// Called with the opcode after every instruction fetch
+#ifndef K6502_INSTRUCTION_HOOK
+#define K6502_INSTRUCTION_HOOK(byCode)
+#endif
+
+// N and Z flags ( 0: kept in F, 1: evaluated lazily from the last result )
+#ifndef K6502_LAZY_FLAGS
+#define K6502_LAZY_FLAGS 0
+#endif
+
+// Idle loop skip ( 0: off, 1: fast-forward side-effect free spin loops )
+#ifndef K6502_IDLE_SKIP
+#define K6502_IDLE_SKIP 1
+#endif
+
+// Longest loop body ( in bytes ) that is checked for an idle loop
+#define IDLE_LOOP_MAX_BYTES 16
+
+// Basic block cache for ROM ( 0: off, 1: run translated blocks of micro-ops )
+#ifndef K6502_BLOCK_CACHE
+#define K6502_BLOCK_CACHE 0
+#endif
+
+// Sets of the block cache ( 4 blocks each, about 90 bytes a block )
+#ifndef K6502_BLOCK_CACHE_BITS
+#define K6502_BLOCK_CACHE_BITS 5
+#endif
+
+// Pre-decoded instruction cache for ROM ( 0: off, 1: on )
+#ifndef K6502_DECODE_CACHE
+#define K6502_DECODE_CACHE 0
+#endif
+
+// Entries of the instruction cache ( direct mapped by PC, 6 bytes each )
+#ifndef K6502_DECODE_CACHE_BITS
+#define K6502_DECODE_CACHE_BITS 10
+#endif
+
+// Superinstructions ( 0: off, 1: hot instruction pairs skip the second dispatch )
+#ifndef K6502_FUSION
+#define K6502_FUSION 1
+#endif
+
+// Interpreters specialised for the hooks of mappers 0/1/2/3/4/7 ( 0: off, 1: on )
+#ifndef K6502_MAPPER_CORES
+#define K6502_MAPPER_CORES 0
+#endif
+
+// Execution profile ( 0: off, 1: every instruction, N: every Nth instruction )
+#ifndef K6502_PROFILE
+#define K6502_PROFILE 0
+#endif
+
+// Entries of the ( bank, PC ) hit table of the profile ( 8 bytes each )
+#ifndef K6502_PROFILE_PC_BITS
+#define K6502_PROFILE_PC_BITS 11
+#endif
+
+// Trace of the last executed instructions ( 0: off, 1: on )
+#ifndef K6502_TRACE
+#define K6502_TRACE 0
+#endif
+
+// Instructions in the trace ( 16 bytes each )
+#ifndef K6502_TRACE_BITS
+#define K6502_TRACE_BITS 9
+#endif
+
+// Recompiled ROM code ( -DK6502_AOT_FILE="file" written by k6502_aot_gen.py )
+#ifdef K6502_AOT_FILE
+#define K6502_AOT 1
+#else
+#define K6502_AOT 0
+#endif
+
+/*-------------------------------------------------------------------*/
+/*  Functions of K6502_rw.h ( included at the end )                  */
+/*-------------------------------------------------------------------*/
+
+// Whether reading an address again has no side effect ( idle loop skip )
+static inline bool K6502_IsIdleRead(WORD wAddr);
+
+// The 8KB PRG-ROM bank in a window of 0x8000 - 0xffff, or -1 ( recompiled code )
+static inline int K6502_PrgBank(int nWindow);
+
 /*-------------------------------------------------------------------*/
 /*  Operation Macros                                                 */
 /*-------------------------------------------------------------------*/
 
+// Mapper hooks of the reading/writing below. run() is instantiated per mapper,
+// its template parameter of the same name hides this one inside it.
+typedef K6502_MapperAny CoreMapper;
+
+// Context Op.
+// Copy the context into locals named after the registers ( and back ),
+// so the operation macros work on values kept in CPU registers
+#define LOAD_CONTEXT()        \
+  WORD PC = g_Context.PC;     \
+  BYTE SP = g_Context.SP;     \
+  BYTE F = g_Context.F;       \
+  BYTE A = g_Context.A;       \
+  BYTE X = g_Context.X;       \
+  BYTE Y = g_Context.Y;       \
+  WORD NZ = g_Context.NZ;     \
+  int wPassedClocks = g_Context.wPassedClocks
+#define SAVE_CONTEXT()        \
+  g_Context.PC = PC;          \
+  g_Context.SP = SP;          \
+  g_Context.F = F;            \
+  g_Context.A = A;            \
+  g_Context.X = X;            \
+  g_Context.Y = Y;            \
+  g_Context.NZ = NZ;          \
+  g_Context.wPassedClocks = wPassedClocks
+// A write may reach the APU or a mapper, which read getPassedClocks()
+#define WRITE_CLOCKS wPassedClocks
+#define WRITE(a, d) (g_Context.wPassedClocks = WRITE_CLOCKS, K6502_Write<CoreMapper>((a), (d)))
+
 // Clock Op.
-#define CLK(a) g_wPassedClocks += (a);
+#define CLK(a) wPassedClocks += (a);
+
+// Operand Op.
+#if K6502_DECODE_CACHE
+// The operand was read with the opcode ( see decode() )
+#define OPERAND_PEEK ((BYTE)wOperand)
+#define OPERAND_B (++PC, (BYTE)wOperand)
+#define OPERAND_W (PC += 2, wOperand)
+#define OPERAND_W2 (++PC, wOperand)
+#else
+#define OPERAND_PEEK K6502_Read<CoreMapper>(PC)
+#define OPERAND_B K6502_Read<CoreMapper>(PC++)
+#define OPERAND_W (PC += 2, K6502_ReadW<CoreMapper>(PC - 2))
+#define OPERAND_W2 (++PC, K6502_ReadW<CoreMapper>(PC - 1))
+#endif
 
 // Addressing Op.
 // Address
 // (Indirect,X)
-#define AA_IX K6502_ReadZpW(K6502_Read(PC++) + X)
+#define AA_IX K6502_ReadZpW(OPERAND_B + X)
 // (Indirect),Y
-#define AA_IY K6502_ReadZpW(K6502_Read(PC++)) + Y
+#define AA_IY K6502_ReadZpW(OPERAND_B) + Y
 // Zero Page
-#define AA_ZP K6502_Read(PC++)
+#define AA_ZP OPERAND_B
 // Zero Page,X
-#define AA_ZPX (BYTE)(K6502_Read(PC++) + X)
+#define AA_ZPX (BYTE)(OPERAND_B + X)
 // Zero Page,Y
-#define AA_ZPY (BYTE)(K6502_Read(PC++) + Y)
+#define AA_ZPY (BYTE)(OPERAND_B + Y)
 // Absolute
-#define AA_ABS (K6502_Read(PC++) | (WORD)K6502_Read(PC++) << 8)
+#define AA_ABS OPERAND_W
 // Absolute2 ( PC-- )
-#define AA_ABS2 (K6502_Read(PC++) | (WORD)K6502_Read(PC) << 8)
+#define AA_ABS2 OPERAND_W2
 // Absolute,X
 #define AA_ABSX AA_ABS + X
 // Absolute,Y
@@ -46,9 +184,15 @@
 
 // Data
 // (Indirect,X)
-#define A_IX K6502_Read(AA_IX)
-// (Indirect),Y
-#define A_IY K6502_ReadIY()
+#define A_IX K6502_Read<CoreMapper>(AA_IX)
+// (Indirect),Y ( and Absolute,X / Absolute,Y ) take a clock more across a page
+#define A_IY                               \
+  ({                                       \
+    WORD wB0 = K6502_ReadZpW(OPERAND_B);   \
+    WORD wB1 = wB0 + Y;                    \
+    CLK((wB0 & 0x0100) != (wB1 & 0x0100)); \
+    K6502_Read<CoreMapper>(wB1);           \
+  })
 // Zero Page
 #define A_ZP K6502_ReadZp(AA_ZP)
 // Zero Page,X
@@ -56,25 +200,50 @@
 // Zero Page,Y
 #define A_ZPY K6502_ReadZp(AA_ZPY)
 // Absolute
-#define A_ABS K6502_Read(AA_ABS)
+#define A_ABS K6502_Read<CoreMapper>(AA_ABS)
 // Absolute,X
-#define A_ABSX K6502_ReadAbsX()
+#define A_ABSX                             \
+  ({                                       \
+    WORD wB0 = AA_ABS;                     \
+    WORD wB1 = wB0 + X;                    \
+    CLK((wB0 & 0x0100) != (wB1 & 0x0100)); \
+    K6502_Read<CoreMapper>(wB1);           \
+  })
 // Absolute,Y
-#define A_ABSY K6502_ReadAbsY()
+#define A_ABSY                             \
+  ({                                       \
+    WORD wB0 = AA_ABS;                     \
+    WORD wB1 = wB0 + Y;                    \
+    CLK((wB0 & 0x0100) != (wB1 & 0x0100)); \
+    K6502_Read<CoreMapper>(wB1);           \
+  })
 // Immediate
-#define A_IMM K6502_Read(PC++)
+#define A_IMM OPERAND_B
 
 // Flag Op.
 #define SETF(a) F |= (a)
 #define RSTF(a) F &= ~(a)
+#if K6502_LAZY_FLAGS
+// N is bit 7 or bit 8 of NZ, Z is set when the low byte of NZ is 0
+#define TEST(a) NZ = (a)
+#define IS_N (NZ & 0x180)
+#define IS_Z (!(NZ & 0xff))
+#define GETF() ((BYTE)((F & ~(FLAG_N | FLAG_Z)) | (IS_N ? FLAG_N : 0) | (IS_Z ? FLAG_Z : 0)))
+#define LOADNZ() NZ = ((F & FLAG_N) << 1) | ((F & FLAG_Z) ^ FLAG_Z)
+#else
 #define TEST(a)          \
   RSTF(FLAG_N | FLAG_Z); \
   SETF(g_byTestTable[a])
+#define IS_N (F & FLAG_N)
+#define IS_Z (F & FLAG_Z)
+#define GETF() F
+#define LOADNZ()
+#endif
 
 // Load & Store Op.
-#define STA(a) K6502_Write((a), A);
-#define STX(a) K6502_Write((a), X);
-#define STY(a) K6502_Write((a), Y);
+#define STA(a) WRITE((a), A);
+#define STX(a) WRITE((a), X);
+#define STY(a) WRITE((a), Y);
 #define LDA(a) \
   A = (a);     \
   TEST(A);
@@ -86,14 +255,14 @@
   TEST(Y);
 
 // Stack Op.
-#define PUSH(a) K6502_Write(BASE_STACK + SP--, (a))
+#define PUSH(a) K6502_Write<CoreMapper>(BASE_STACK + SP--, (a))
 #define PUSHW(a)  \
   PUSH((a) >> 8); \
   PUSH((a)&0xff)
-#define POP(a) a = K6502_Read(BASE_STACK + ++SP)
+#define POP(a) a = K6502_Read<CoreMapper>(BASE_STACK + ++SP)
 #define POPW(a) \
   POP(a);       \
-  a |= (K6502_Read(BASE_STACK + ++SP) << 8)
+  a |= (K6502_Read<CoreMapper>(BASE_STACK + ++SP) << 8)
 
 // Logical Op.
 #define ORA(a) \
@@ -105,6 +274,28 @@
 #define EOR(a) \
   A ^= (a);    \
   TEST(A)
+#if K6502_LAZY_FLAGS
+#define BIT(a)            \
+  byD0 = (a);             \
+  RSTF(FLAG_V);           \
+  SETF(byD0 & FLAG_V);    \
+  NZ = ((byD0 & FLAG_N) << 1) | (byD0 & A);
+#define CMP(a)            \
+  wD0 = (WORD)A - (a);    \
+  NZ = (BYTE)wD0;         \
+  RSTF(FLAG_C);           \
+  SETF(wD0 < 0x100 ? FLAG_C : 0);
+#define CPX(a)            \
+  wD0 = (WORD)X - (a);    \
+  NZ = (BYTE)wD0;         \
+  RSTF(FLAG_C);           \
+  SETF(wD0 < 0x100 ? FLAG_C : 0);
+#define CPY(a)            \
+  wD0 = (WORD)Y - (a);    \
+  NZ = (BYTE)wD0;         \
+  RSTF(FLAG_C);           \
+  SETF(wD0 < 0x100 ? FLAG_C : 0);
+#else
 #define BIT(a)                    \
   byD0 = (a);                     \
   RSTF(FLAG_N | FLAG_V | FLAG_Z); \
@@ -121,8 +312,28 @@
   wD0 = (WORD)Y - (a);            \
   RSTF(FLAG_N | FLAG_Z | FLAG_C); \
   SETF(g_byTestTable[wD0 & 0xff] | (wD0 < 0x100 ? FLAG_C : 0));
+#endif
 
 // Math Op. (A D flag isn't being supported.)
+#if K6502_LAZY_FLAGS
+#define ADC(a)                                                            \
+  byD0 = (a);                                                             \
+  wD0 = A + byD0 + (F & FLAG_C);                                          \
+  byD1 = (BYTE)wD0;                                                       \
+  RSTF(FLAG_V | FLAG_C);                                                  \
+  SETF(((~(A ^ byD0) & (A ^ byD1) & 0x80) ? FLAG_V : 0) | (wD0 > 0xff));  \
+  A = byD1;                                                               \
+  NZ = A;
+
+#define SBC(a)                                                            \
+  byD0 = (a);                                                             \
+  wD0 = A - byD0 - (~F & FLAG_C);                                         \
+  byD1 = (BYTE)wD0;                                                       \
+  RSTF(FLAG_V | FLAG_C);                                                  \
+  SETF((((A ^ byD0) & (A ^ byD1) & 0x80) ? FLAG_V : 0) | (wD0 < 0x100));  \
+  A = byD1;                                                               \
+  NZ = A;
+#else
 #define ADC(a)                                                                                 \
   byD0 = (a);                                                                                  \
   wD0 = A + byD0 + (F & FLAG_C);                                                               \
@@ -138,41 +349,100 @@
   RSTF(FLAG_N | FLAG_V | FLAG_Z | FLAG_C);                                                     \
   SETF(g_byTestTable[byD1] | (((A ^ byD0) & (A ^ byD1) & 0x80) ? FLAG_V : 0) | (wD0 < 0x100)); \
   A = byD1;
+#endif
 
-#define DEC(a)            \
-  wA0 = a;                \
-  byD0 = K6502_Read(wA0); \
-  --byD0;                 \
-  K6502_Write(wA0, byD0); \
+#define DEC(a)                        \
+  wA0 = a;                            \
+  byD0 = K6502_Read<CoreMapper>(wA0); \
+  --byD0;                             \
+  WRITE(wA0, byD0);                   \
   TEST(byD0)
-#define INC(a)            \
-  wA0 = a;                \
-  byD0 = K6502_Read(wA0); \
-  ++byD0;                 \
-  K6502_Write(wA0, byD0); \
+#define INC(a)                        \
+  wA0 = a;                            \
+  byD0 = K6502_Read<CoreMapper>(wA0); \
+  ++byD0;                             \
+  WRITE(wA0, byD0);                   \
   TEST(byD0)
 
 // Shift Op.
+#if K6502_LAZY_FLAGS
+#define ASLA         \
+  RSTF(FLAG_C);      \
+  SETF(A >> 7);      \
+  A <<= 1;           \
+  NZ = A
+#define ASL(a)                        \
+  wA0 = a;                            \
+  byD0 = K6502_Read<CoreMapper>(wA0); \
+  RSTF(FLAG_C);                       \
+  SETF(byD0 >> 7);                    \
+  byD0 <<= 1;                         \
+  NZ = byD0;                          \
+  WRITE(wA0, byD0)
+#define LSRA         \
+  RSTF(FLAG_C);      \
+  SETF(A & FLAG_C);  \
+  A >>= 1;           \
+  NZ = A
+#define LSR(a)                        \
+  wA0 = a;                            \
+  byD0 = K6502_Read<CoreMapper>(wA0); \
+  RSTF(FLAG_C);                       \
+  SETF(byD0 & FLAG_C);                \
+  byD0 >>= 1;                         \
+  NZ = byD0;                          \
+  WRITE(wA0, byD0)
+#define ROLA                    \
+  byD0 = F & FLAG_C;            \
+  RSTF(FLAG_C);                 \
+  SETF(A >> 7);                 \
+  A = (A << 1) | byD0;          \
+  NZ = A
+#define ROL(a)                        \
+  byD1 = F & FLAG_C;                  \
+  wA0 = a;                            \
+  byD0 = K6502_Read<CoreMapper>(wA0); \
+  RSTF(FLAG_C);                       \
+  SETF(byD0 >> 7);                    \
+  byD0 = (byD0 << 1) | byD1;          \
+  NZ = byD0;                          \
+  WRITE(wA0, byD0)
+#define RORA                    \
+  byD0 = F & FLAG_C;            \
+  RSTF(FLAG_C);                 \
+  SETF(A & FLAG_C);             \
+  A = (A >> 1) | (byD0 << 7);   \
+  NZ = A
+#define ROR(a)                        \
+  byD1 = F & FLAG_C;                  \
+  wA0 = a;                            \
+  byD0 = K6502_Read<CoreMapper>(wA0); \
+  RSTF(FLAG_C);                       \
+  SETF(byD0 & FLAG_C);                \
+  byD0 = (byD0 >> 1) | (byD1 << 7);   \
+  NZ = byD0;                          \
+  WRITE(wA0, byD0)
+#else
 #define ASLA                      \
   RSTF(FLAG_N | FLAG_Z | FLAG_C); \
   SETF(g_ASLTable[A].byFlag);     \
   A = g_ASLTable[A].byValue
-#define ASL(a)                    \
-  RSTF(FLAG_N | FLAG_Z | FLAG_C); \
-  wA0 = a;                        \
-  byD0 = K6502_Read(wA0);         \
-  SETF(g_ASLTable[byD0].byFlag);  \
-  K6502_Write(wA0, g_ASLTable[byD0].byValue)
+#define ASL(a)                        \
+  RSTF(FLAG_N | FLAG_Z | FLAG_C);     \
+  wA0 = a;                            \
+  byD0 = K6502_Read<CoreMapper>(wA0); \
+  SETF(g_ASLTable[byD0].byFlag);      \
+  WRITE(wA0, g_ASLTable[byD0].byValue)
 #define LSRA                      \
   RSTF(FLAG_N | FLAG_Z | FLAG_C); \
   SETF(g_LSRTable[A].byFlag);     \
   A = g_LSRTable[A].byValue
-#define LSR(a)                    \
-  RSTF(FLAG_N | FLAG_Z | FLAG_C); \
-  wA0 = a;                        \
-  byD0 = K6502_Read(wA0);         \
-  SETF(g_LSRTable[byD0].byFlag);  \
-  K6502_Write(wA0, g_LSRTable[byD0].byValue)
+#define LSR(a)                        \
+  RSTF(FLAG_N | FLAG_Z | FLAG_C);     \
+  wA0 = a;                            \
+  byD0 = K6502_Read<CoreMapper>(wA0); \
+  SETF(g_LSRTable[byD0].byFlag);      \
+  WRITE(wA0, g_LSRTable[byD0].byValue)
 #define ROLA                        \
   byD0 = F & FLAG_C;                \
   RSTF(FLAG_N | FLAG_Z | FLAG_C);   \
@@ -182,9 +452,9 @@
   byD1 = F & FLAG_C;                   \
   RSTF(FLAG_N | FLAG_Z | FLAG_C);      \
   wA0 = a;                             \
-  byD0 = K6502_Read(wA0);              \
+  byD0 = K6502_Read<CoreMapper>(wA0);  \
   SETF(g_ROLTable[byD1][byD0].byFlag); \
-  K6502_Write(wA0, g_ROLTable[byD1][byD0].byValue)
+  WRITE(wA0, g_ROLTable[byD1][byD0].byValue)
 #define RORA                        \
   byD0 = F & FLAG_C;                \
   RSTF(FLAG_N | FLAG_Z | FLAG_C);   \
@@ -194,9 +464,10 @@
   byD1 = F & FLAG_C;                   \
   RSTF(FLAG_N | FLAG_Z | FLAG_C);      \
   wA0 = a;                             \
-  byD0 = K6502_Read(wA0);              \
+  byD0 = K6502_Read<CoreMapper>(wA0);  \
   SETF(g_RORTable[byD1][byD0].byFlag); \
-  K6502_Write(wA0, g_RORTable[byD1][byD0].byValue)
+  WRITE(wA0, g_RORTable[byD1][byD0].byValue)
+#endif
 
 // Jump Op.
 #define JSR      \
@@ -207,9 +478,10 @@
   if (a)                                        \
   {                                             \
     wA0 = PC;                                   \
-    PC += (int8_t)K6502_Read(PC);               \
+    PC += (int8_t)OPERAND_PEEK;                 \
     CLK(3 + ((wA0 & 0x0100) != (PC & 0x0100))); \
     ++PC;                                       \
+    IDLE_CHECK(wA0 - 1);                        \
   }                                             \
   else                                          \
   {                                             \
@@ -218,17 +490,119 @@
   }
 #define JMP(a) PC = a;
 
+// Idle loop check after a taken branch
+#if K6502_IDLE_SKIP
+#define IDLE_CHECK(wBranch)                                                   \
+  if (PC < (wBranch) && (WORD)((wBranch) - PC) <= IDLE_LOOP_MAX_BYTES)      \
+  {                                                                         \
+    CLK(idleLoop(wBranch, wClocks, PC, A, X, Y, GETF(), SP, wPassedClocks)); \
+  }
+#else
+#define IDLE_CHECK(wBranch)
+#endif
+
+// Fetch Op.
+#if K6502_DECODE_CACHE
+#define FETCH()                                                               \
+  {                                                                           \
+    const struct decode_cache_tag *pEntry = &g_DecodeCache[PC & DECODE_MASK]; \
+    if (pEntry->wPC == PC && pEntry->byGen == g_byDecodeGen[(PC >> 13) & 3])  \
+    {                                                                         \
+      byCode = pEntry->byCode;                                                \
+      wOperand = pEntry->wOperand;                                            \
+      ++dwDecodeHits;                                                         \
+    }                                                                         \
+    else                                                                      \
+    {                                                                         \
+      byCode = decode(PC, wOperand);                                          \
+    }                                                                         \
+    ++PC;                                                                     \
+  }
+#else
+#define FETCH() byCode = K6502_Read<CoreMapper>(PC++)
+#endif
+
+// Profile Op.
+// Counts the opcode and the address of an instruction ( K6502_PROFILE )
+#if K6502_PROFILE
+#define PROFILE(wPC, byCode) profile(wPC, byCode)
+#else
+#define PROFILE(wPC, byCode)
+#endif
+
+// Trace Op.
+// Records an instruction and the registers before it ( K6502_TRACE )
+#if K6502_TRACE
+#define TRACE(wPC, byCode, wClock) trace(wPC, byCode, A, X, Y, SP, GETF(), wClock)
+#else
+#define TRACE(wPC, byCode, wClock)
+#endif
+
+// Dispatch Op.
+#if K6502_THREADED_DISPATCH
+// Every handler ends with its own fetch and indirect jump
+#define OP(a) op_##a
+#define OP_DEFAULT op_default
+#define NEXT                            \
+  if (wPassedClocks >= wStop)           \
+    goto op_end;                        \
+  FETCH();                              \
+  K6502_INSTRUCTION_HOOK(byCode);       \
+  PROFILE(PC - 1, byCode);              \
+  TRACE(PC - 1, byCode, wPassedClocks); \
+  goto *dispatchTable[byCode]
+#else
+#define OP(a) case a
+#define OP_DEFAULT default
+#define NEXT break
+#endif
+
+// Fusion Op.
+// NEXT_FUSED(a) fetches like NEXT, and goes straight to the handler
+// of the opcode a ( FUSED(a) ) when it follows. The slice ends between
+// the two instructions just as it does without fusion.
+#if K6502_FUSION && K6502_THREADED_DISPATCH
+#define FUSED(a)
+#define NEXT_FUSED(a)                   \
+  if (wPassedClocks >= wStop)           \
+    goto op_end;                        \
+  FETCH();                              \
+  K6502_INSTRUCTION_HOOK(byCode);       \
+  PROFILE(PC - 1, byCode);              \
+  TRACE(PC - 1, byCode, wPassedClocks); \
+  if (byCode == (a))                    \
+  {                                     \
+    ++dwFusedDispatches;                \
+    goto op_##a;                        \
+  }                                     \
+  goto *dispatchTable[byCode]
+#elif K6502_FUSION
+#define FUSED(a) \
+  fuse_##a:
+#define NEXT_FUSED(a)                   \
+  if (wPassedClocks >= wStop)           \
+    break;                              \
+  FETCH();                              \
+  K6502_INSTRUCTION_HOOK(byCode);       \
+  PROFILE(PC - 1, byCode);              \
+  TRACE(PC - 1, byCode, wPassedClocks); \
+  if (byCode == (a))                    \
+  {                                     \
+    ++dwFusedDispatches;                \
+    goto fuse_##a;                      \
+  }                                     \
+  goto op_dispatch
+#else
+#define FUSED(a)
+#define NEXT_FUSED(a) NEXT
+#endif
+
 /*-------------------------------------------------------------------*/
 /*  Global valiables                                                 */
 /*-------------------------------------------------------------------*/
 
-// 6502 Register
-WORD PC;
-BYTE SP;
-BYTE F;
-BYTE A;
-BYTE X;
-BYTE Y;
+// 6502 Register ( and the clocks of the slice )
+struct K6502Context g_Context;
 
 // The state of the IRQ pin
 BYTE IRQ_State;
@@ -243,13 +617,589 @@ BYTE NMI_State;
 BYTE NMI_Wiring;
 
 // The number of the clocks that it passed
-int g_wPassedClocks;
-int g_wCurrentClocks;
+// ( g_Context.wPassedClocks counts from g_qwBaseClocks, the start of the slice )
+QWORD g_qwBaseClocks;
+
+QWORD getPassedClocks()
+{
+  return g_qwBaseClocks + g_Context.wPassedClocks;
+}
+
+// The number of the clocks that idle loops skipped
+DWORD g_dwIdleClocks;
+
+// The last pass of a short backward branch
+struct idle_loop_tag
+{
+  WORD wBranch; /* 0: none */
+  BYTE byA;
+  BYTE byX;
+  BYTE byY;
+  BYTE byF;
+  BYTE bySP;
+  int nClocks;
+};
+static struct idle_loop_tag g_IdleLoop;
+
+// Dispatches that superinstructions saved
+DWORD g_dwFusedDispatches;
+
+// Fetches served by the instruction cache, and the others
+DWORD g_dwDecodeHits;
+DWORD g_dwDecodeMisses;
+
+#if K6502_DECODE_CACHE
+#define DECODE_ENTRIES (1 << K6502_DECODE_CACHE_BITS)
+#define DECODE_MASK (DECODE_ENTRIES - 1)
+
+// A decoded instruction in ROM
+struct decode_cache_tag
+{
+  WORD wPC;      /* 0: empty ( RAM code is never cached ) */
+  BYTE byCode;
+  BYTE byGen;    /* g_byDecodeGen[] of the bank when it was decoded */
+  WORD wOperand; /* 1 or 2 bytes following the opcode */
+};
+static struct decode_cache_tag g_DecodeCache[DECODE_ENTRIES];
+#endif
+
+#if K6502_DECODE_CACHE || K6502_BLOCK_CACHE
+// Generation of the ROM bank in 0x8000 - 0xffff ( every 8KB )
+static BYTE g_byDecodeGen[4];
+
+// Bytes that a handler reads from the instruction stream
+static const BYTE g_byDecodeLength[256] = {
+    1, 2, 1, 1, 1, 2, 2, 1, 1, 2, 1, 1, 1, 3, 3, 1, /* 0x00 */
+    2, 2, 1, 1, 1, 2, 2, 1, 1, 3, 1, 1, 1, 3, 3, 1, /* 0x10 */
+    3, 2, 1, 1, 2, 2, 2, 1, 1, 2, 1, 1, 3, 3, 3, 1, /* 0x20 */
+    2, 2, 1, 1, 1, 2, 2, 1, 1, 3, 1, 1, 1, 3, 3, 1, /* 0x30 */
+    1, 2, 1, 1, 1, 2, 2, 1, 1, 2, 1, 1, 3, 3, 3, 1, /* 0x40 */
+    2, 2, 1, 1, 1, 2, 2, 1, 1, 3, 1, 1, 1, 3, 3, 1, /* 0x50 */
+    1, 2, 1, 1, 1, 2, 2, 1, 1, 2, 1, 1, 3, 3, 3, 1, /* 0x60 */
+    2, 2, 1, 1, 1, 2, 2, 1, 1, 3, 1, 1, 1, 3, 3, 1, /* 0x70 */
+    1, 2, 1, 1, 2, 2, 2, 1, 1, 1, 1, 1, 3, 3, 3, 1, /* 0x80 */
+    2, 2, 1, 1, 2, 2, 2, 1, 1, 3, 1, 1, 1, 3, 1, 1, /* 0x90 */
+    2, 2, 2, 1, 2, 2, 2, 1, 1, 2, 1, 1, 3, 3, 3, 1, /* 0xA0 */
+    2, 2, 1, 1, 2, 2, 2, 1, 1, 3, 1, 1, 3, 3, 3, 1, /* 0xB0 */
+    2, 2, 1, 1, 2, 2, 2, 1, 1, 2, 1, 1, 3, 3, 3, 1, /* 0xC0 */
+    2, 2, 1, 1, 1, 2, 2, 1, 1, 3, 1, 1, 1, 3, 3, 1, /* 0xD0 */
+    2, 2, 1, 1, 2, 2, 2, 1, 1, 2, 1, 1, 3, 3, 3, 1, /* 0xE0 */
+    2, 2, 1, 1, 1, 2, 2, 1, 1, 3, 1, 1, 1, 3, 3, 1, /* 0xF0 */
+};
+#endif
+
+// Blocks run from the block cache, the instructions in them, and translations
+DWORD g_dwBlockRuns;
+DWORD g_dwBlockInstructions;
+DWORD g_dwBlockTranslations;
+
+// Instructions run by recompiled code, and lookups that went to the interpreter
+DWORD g_dwAotInstructions;
+DWORD g_dwAotMisses;
+
+#if K6502_PROFILE
+#define PROFILE_PC_ENTRIES (1 << K6502_PROFILE_PC_BITS)
+#define PROFILE_PC_MASK (PROFILE_PC_ENTRIES - 1)
+#define PROFILE_PC_PROBES 8
+#define PROFILE_TOP_OPS 16
+#define PROFILE_TOP_PCS 32
+
+// Executed opcodes
+static DWORD g_dwProfileOps[256];
+
+// Hits of an address, open addressed by PC ( no hits: empty )
+static DWORD g_dwProfileKeys[PROFILE_PC_ENTRIES]; /* Bank << 16 | PC, bank 0xffff: not PRG-ROM */
+static DWORD g_dwProfileHits[PROFILE_PC_ENTRIES];
+
+// Samples of addresses that the table had no room for
+static DWORD g_dwProfileDropped;
+
+// Instructions until the next sample
+static int g_nProfileCountdown = K6502_PROFILE;
+
+/*===================================================================*/
+/*                                                                   */
+/*            profile() : Count an instruction in the profile        */
+/*                                                                   */
+/*===================================================================*/
+static inline void __not_in_flash_func(profile)(WORD wPC, BYTE byCode)
+{
+  /*
+ *  Count an instruction in the profile
+ *
+ *  Parameters
+ *    WORD wPC                  (Read)
+ *      The address of the opcode
+ *
+ *    BYTE byCode               (Read)
+ *      The opcode
+ *
+ *  Remarks
+ *    With K6502_PROFILE > 1 only every Nth instruction is counted.
+ */
+
+#if K6502_PROFILE > 1
+  if (--g_nProfileCountdown > 0)
+    return;
+  g_nProfileCountdown = K6502_PROFILE;
+#endif
+
+  ++g_dwProfileOps[byCode];
+
+  int nBank = wPC >= 0x8000 ? K6502_PrgBank((wPC >> 13) & 3) : -1;
+  DWORD dwKey = (DWORD)(WORD)nBank << 16 | wPC;
+  int nIndex = (wPC ^ (nBank << 7)) & PROFILE_PC_MASK;
+  for (int nProbe = 0; nProbe < PROFILE_PC_PROBES; ++nProbe)
+  {
+    if (g_dwProfileHits[nIndex] == 0)
+      g_dwProfileKeys[nIndex] = dwKey;
+    if (g_dwProfileKeys[nIndex] == dwKey)
+    {
+      ++g_dwProfileHits[nIndex];
+      return;
+    }
+    nIndex = (nIndex + 1) & PROFILE_PC_MASK;
+  }
+  ++g_dwProfileDropped;
+}
+#endif
+
+#if K6502_TRACE
+#define TRACE_ENTRIES (1 << K6502_TRACE_BITS)
+#define TRACE_MASK (TRACE_ENTRIES - 1)
+#define TRACE_MAGIC 0x4b363530
+
+// An executed instruction, dumped as it is ( little endian, see k6502_trace_decode.py )
+struct trace_tag
+{
+  uint32_t dwClock;   /* Clocks since power on ( low 32 bits ) before the instruction */
+  WORD wPC;
+  BYTE byCode;
+  BYTE byOperand[2];  /* The bytes following the opcode ( 0 out of RAM and ROM ) */
+  BYTE byA;
+  BYTE byX;
+  BYTE byY;
+  BYTE bySP;
+  BYTE byF;
+  BYTE byBank;        /* 8KB PRG-ROM bank of the PC, 0xff: not PRG-ROM */
+  BYTE byReserved;
+};
+
+// The last instructions, kept over a watchdog reset ( out of .bss )
+static struct trace_tag __uninitialized_ram(g_Trace)[TRACE_ENTRIES];
+
+// Instructions recorded, and TRACE_MAGIC while g_Trace[] holds a trace
+static DWORD __uninitialized_ram(g_dwTraceCount);
+static DWORD __uninitialized_ram(g_dwTraceMagic);
 
-WORD getPassedClocks()
+/*===================================================================*/
+/*                                                                   */
+/*             trace() : Record an instruction in the trace          */
+/*                                                                   */
+/*===================================================================*/
+static inline void __not_in_flash_func(trace)(WORD wPC, BYTE byCode, BYTE byA, BYTE byX, BYTE byY, BYTE bySP,
+                                               BYTE byF, int wClock)
 {
-  return g_wCurrentClocks;
+  /*
+ *  Record an instruction in the trace
+ *
+ *  Parameters
+ *    WORD wPC                  (Read)
+ *      The address of the opcode
+ *
+ *    BYTE byCode               (Read)
+ *      The opcode
+ *
+ *    BYTE byA, byX, byY, bySP, byF (Read)
+ *      The registers before the instruction
+ *
+ *    int wClock                (Read)
+ *      Clocks from the start of the slice
+ *
+ *  Remarks
+ *    The operand is read again for RAM and ROM only, reading I/O
+ *    registers has side effects.
+ */
+
+  struct trace_tag *pEntry = &g_Trace[g_dwTraceCount++ & TRACE_MASK];
+  pEntry->dwClock = (uint32_t)(g_qwBaseClocks + wClock);
+  pEntry->wPC = wPC;
+  pEntry->byCode = byCode;
+  if (wPC + 2 < 0x2000 || wPC >= 0x6000)
+  {
+    pEntry->byOperand[0] = K6502_Read((WORD)(wPC + 1));
+    pEntry->byOperand[1] = K6502_Read((WORD)(wPC + 2));
+  }
+  else
+  {
+    pEntry->byOperand[0] = pEntry->byOperand[1] = 0;
+  }
+  pEntry->byA = byA;
+  pEntry->byX = byX;
+  pEntry->byY = byY;
+  pEntry->bySP = bySP;
+  pEntry->byF = byF;
+  pEntry->byBank = wPC >= 0x8000 ? (BYTE)K6502_PrgBank((wPC >> 13) & 3) : 0xff;
 }
+#endif
+
+#if K6502_AOT
+// A ROM that recompiled code was generated from
+struct aot_game_tag
+{
+  DWORD dwSize; /* Size of the PRG-ROM */
+  DWORD dwHash; /* FNV-1a hash of the PRG-ROM */
+  int nFirst;   /* Its blocks in g_dwAotKeys[] ( bank << 16 | PC, sorted ) */
+  int nBlocks;
+};
+
+#define K6502_AOT_TABLES
+#include K6502_AOT_FILE
+#undef K6502_AOT_TABLES
+
+// The game that runs recompiled ( NULL: none )
+static const struct aot_game_tag *g_pAotGame;
+
+// Clocks that the interpreter runs where there is no recompiled block
+#define AOT_FALLBACK_CLOCKS 16
+#endif
+
+#if K6502_BLOCK_CACHE
+#define BLOCK_SETS (1 << K6502_BLOCK_CACHE_BITS)
+#define BLOCK_SET(wPC) (((wPC) ^ ((wPC) >> K6502_BLOCK_CACHE_BITS)) & (BLOCK_SETS - 1))
+#define BLOCK_WAYS 4
+#define BLOCK_MAX_UOPS 12
+
+// Clocks that the interpreter runs where there is no block
+#define BLOCK_FALLBACK_CLOCKS 16
+
+// Class of a 6502 instruction for the translation
+enum
+{
+  BOP_NONE, /* Not translated */
+
+  // Read a value
+  BOP_LDA, BOP_LDX, BOP_LDY, BOP_ORA, BOP_AND, BOP_EOR,
+  BOP_ADC, BOP_SBC, BOP_CMP, BOP_CPX, BOP_CPY, BOP_BIT,
+
+  // Work on an address
+  BOP_STA, BOP_STX, BOP_STY, BOP_ASL, BOP_LSR, BOP_ROL, BOP_ROR, BOP_INC, BOP_DEC,
+
+  // Implied
+  BOP_ASLA, BOP_LSRA, BOP_ROLA, BOP_RORA, BOP_INX, BOP_INY, BOP_DEX, BOP_DEY,
+  BOP_TAX, BOP_TXA, BOP_TAY, BOP_TYA, BOP_TSX, BOP_TXS,
+  BOP_CLC, BOP_SEC, BOP_SEI, BOP_CLD, BOP_SED, BOP_CLV, BOP_NOP,
+  BOP_PHA, BOP_PHP, BOP_PLA, BOP_PLP,
+
+  // End a block
+  BOP_BRANCH, BOP_JMP, BOP_JSR, BOP_RTS,
+};
+#define BOP_IS_ADDRESS(a) ((a) >= BOP_STA && (a) <= BOP_DEC)
+#define BOP_IS_EXIT(a) ((a) >= BOP_BRANCH)
+
+// Addressing mode of a 6502 instruction
+enum
+{
+  BAM_IMP, BAM_IMM, BAM_ZP, BAM_ZPX, BAM_ZPY, BAM_ABS, BAM_ABSX, BAM_ABSY, BAM_IX, BAM_IY, BAM_REL,
+  BAM_COUNT
+};
+
+// Translation of a 6502 instruction
+struct block_decode_tag
+{
+  BYTE byOp;
+  BYTE byMode;   /* BAM_* */
+  BYTE byClocks; /* Base clocks */
+};
+static const struct block_decode_tag g_BlockDecode[256] = {
+    {BOP_NONE, BAM_IMP, 0}, /* 00 */
+    {BOP_ORA, BAM_IX, 6}, /* 01: ORA (Zpg,X) */
+    {BOP_NONE, BAM_IMP, 0}, /* 02 */
+    {BOP_NONE, BAM_IMP, 0}, /* 03 */
+    {BOP_NONE, BAM_IMP, 0}, /* 04 */
+    {BOP_ORA, BAM_ZP, 3}, /* 05: ORA Zpg */
+    {BOP_ASL, BAM_ZP, 5}, /* 06: ASL Zpg */
+    {BOP_NONE, BAM_IMP, 0}, /* 07 */
+    {BOP_PHP, BAM_IMP, 3}, /* 08: PHP */
+    {BOP_ORA, BAM_IMM, 2}, /* 09: ORA #Imm */
+    {BOP_ASLA, BAM_IMP, 2}, /* 0A: ASL A */
+    {BOP_NONE, BAM_IMP, 0}, /* 0B */
+    {BOP_NONE, BAM_IMP, 0}, /* 0C */
+    {BOP_ORA, BAM_ABS, 4}, /* 0D: ORA Abs */
+    {BOP_ASL, BAM_ABS, 6}, /* 0E: ASL Abs */
+    {BOP_NONE, BAM_IMP, 0}, /* 0F */
+    {BOP_BRANCH, BAM_REL, 2}, /* 10: BPL */
+    {BOP_ORA, BAM_IY, 5}, /* 11: ORA (Zpg),Y */
+    {BOP_NONE, BAM_IMP, 0}, /* 12 */
+    {BOP_NONE, BAM_IMP, 0}, /* 13 */
+    {BOP_NONE, BAM_IMP, 0}, /* 14 */
+    {BOP_ORA, BAM_ZPX, 4}, /* 15: ORA Zpg,X */
+    {BOP_ASL, BAM_ZPX, 6}, /* 16: ASL Zpg,X */
+    {BOP_NONE, BAM_IMP, 0}, /* 17 */
+    {BOP_CLC, BAM_IMP, 2}, /* 18: CLC */
+    {BOP_ORA, BAM_ABSY, 4}, /* 19: ORA Abs,Y */
+    {BOP_NONE, BAM_IMP, 0}, /* 1A */
+    {BOP_NONE, BAM_IMP, 0}, /* 1B */
+    {BOP_NONE, BAM_IMP, 0}, /* 1C */
+    {BOP_ORA, BAM_ABSX, 4}, /* 1D: ORA Abs,X */
+    {BOP_ASL, BAM_ABSX, 7}, /* 1E: ASL Abs,X */
+    {BOP_NONE, BAM_IMP, 0}, /* 1F */
+    {BOP_JSR, BAM_ABS, 6}, /* 20: JSR Abs */
+    {BOP_AND, BAM_IX, 6}, /* 21: AND (Zpg,X) */
+    {BOP_NONE, BAM_IMP, 0}, /* 22 */
+    {BOP_NONE, BAM_IMP, 0}, /* 23 */
+    {BOP_BIT, BAM_ZP, 3}, /* 24: BIT Zpg */
+    {BOP_AND, BAM_ZP, 3}, /* 25: AND Zpg */
+    {BOP_ROL, BAM_ZP, 5}, /* 26: ROL Zpg */
+    {BOP_NONE, BAM_IMP, 0}, /* 27 */
+    {BOP_PLP, BAM_IMP, 4}, /* 28: PLP */
+    {BOP_AND, BAM_IMM, 2}, /* 29: AND #Imm */
+    {BOP_ROLA, BAM_IMP, 2}, /* 2A: ROL A */
+    {BOP_NONE, BAM_IMP, 0}, /* 2B */
+    {BOP_BIT, BAM_ABS, 4}, /* 2C: BIT Abs */
+    {BOP_AND, BAM_ABS, 4}, /* 2D: AND Abs */
+    {BOP_ROL, BAM_ABS, 6}, /* 2E: ROL Abs */
+    {BOP_NONE, BAM_IMP, 0}, /* 2F */
+    {BOP_BRANCH, BAM_REL, 2}, /* 30: BMI */
+    {BOP_AND, BAM_IY, 5}, /* 31: AND (Zpg),Y */
+    {BOP_NONE, BAM_IMP, 0}, /* 32 */
+    {BOP_NONE, BAM_IMP, 0}, /* 33 */
+    {BOP_NONE, BAM_IMP, 0}, /* 34 */
+    {BOP_AND, BAM_ZPX, 4}, /* 35: AND Zpg,X */
+    {BOP_ROL, BAM_ZPX, 6}, /* 36: ROL Zpg,X */
+    {BOP_NONE, BAM_IMP, 0}, /* 37 */
+    {BOP_SEC, BAM_IMP, 2}, /* 38: SEC */
+    {BOP_AND, BAM_ABSY, 4}, /* 39: AND Abs,Y */
+    {BOP_NONE, BAM_IMP, 0}, /* 3A */
+    {BOP_NONE, BAM_IMP, 0}, /* 3B */
+    {BOP_NONE, BAM_IMP, 0}, /* 3C */
+    {BOP_AND, BAM_ABSX, 4}, /* 3D: AND Abs,X */
+    {BOP_ROL, BAM_ABSX, 7}, /* 3E: ROL Abs,X */
+    {BOP_NONE, BAM_IMP, 0}, /* 3F */
+    {BOP_NONE, BAM_IMP, 0}, /* 40 */
+    {BOP_EOR, BAM_IX, 6}, /* 41: EOR (Zpg,X) */
+    {BOP_NONE, BAM_IMP, 0}, /* 42 */
+    {BOP_NONE, BAM_IMP, 0}, /* 43 */
+    {BOP_NONE, BAM_IMP, 0}, /* 44 */
+    {BOP_EOR, BAM_ZP, 3}, /* 45: EOR Zpg */
+    {BOP_LSR, BAM_ZP, 5}, /* 46: LSR Zpg */
+    {BOP_NONE, BAM_IMP, 0}, /* 47 */
+    {BOP_PHA, BAM_IMP, 3}, /* 48: PHA */
+    {BOP_EOR, BAM_IMM, 2}, /* 49: EOR #Imm */
+    {BOP_LSRA, BAM_IMP, 2}, /* 4A: LSR A */
+    {BOP_NONE, BAM_IMP, 0}, /* 4B */
+    {BOP_JMP, BAM_ABS, 3}, /* 4C: JMP Abs */
+    {BOP_EOR, BAM_ABS, 4}, /* 4D: EOR Abs */
+    {BOP_LSR, BAM_ABS, 6}, /* 4E: LSR Abs */
+    {BOP_NONE, BAM_IMP, 0}, /* 4F */
+    {BOP_BRANCH, BAM_REL, 2}, /* 50: BVC */
+    {BOP_EOR, BAM_IY, 5}, /* 51: EOR (Zpg),Y */
+    {BOP_NONE, BAM_IMP, 0}, /* 52 */
+    {BOP_NONE, BAM_IMP, 0}, /* 53 */
+    {BOP_NONE, BAM_IMP, 0}, /* 54 */
+    {BOP_EOR, BAM_ZPX, 4}, /* 55: EOR Zpg,X */
+    {BOP_LSR, BAM_ZPX, 6}, /* 56: LSR Zpg,X */
+    {BOP_NONE, BAM_IMP, 0}, /* 57 */
+    {BOP_NONE, BAM_IMP, 0}, /* 58 */
+    {BOP_EOR, BAM_ABSY, 4}, /* 59: EOR Abs,Y */
+    {BOP_NONE, BAM_IMP, 0}, /* 5A */
+    {BOP_NONE, BAM_IMP, 0}, /* 5B */
+    {BOP_NONE, BAM_IMP, 0}, /* 5C */
+    {BOP_EOR, BAM_ABSX, 4}, /* 5D: EOR Abs,X */
+    {BOP_LSR, BAM_ABSX, 7}, /* 5E: LSR Abs,X */
+    {BOP_NONE, BAM_IMP, 0}, /* 5F */
+    {BOP_RTS, BAM_IMP, 6}, /* 60: RTS */
+    {BOP_ADC, BAM_IX, 6}, /* 61: ADC (Zpg,X) */
+    {BOP_NONE, BAM_IMP, 0}, /* 62 */
+    {BOP_NONE, BAM_IMP, 0}, /* 63 */
+    {BOP_NONE, BAM_IMP, 0}, /* 64 */
+    {BOP_ADC, BAM_ZP, 3}, /* 65: ADC Zpg */
+    {BOP_ROR, BAM_ZP, 5}, /* 66: ROR Zpg */
+    {BOP_NONE, BAM_IMP, 0}, /* 67 */
+    {BOP_PLA, BAM_IMP, 4}, /* 68: PLA */
+    {BOP_ADC, BAM_IMM, 2}, /* 69: ADC #Imm */
+    {BOP_RORA, BAM_IMP, 2}, /* 6A: ROR A */
+    {BOP_NONE, BAM_IMP, 0}, /* 6B */
+    {BOP_NONE, BAM_IMP, 0}, /* 6C */
+    {BOP_ADC, BAM_ABS, 4}, /* 6D: ADC Abs */
+    {BOP_ROR, BAM_ABS, 6}, /* 6E: ROR Abs */
+    {BOP_NONE, BAM_IMP, 0}, /* 6F */
+    {BOP_BRANCH, BAM_REL, 2}, /* 70: BVS */
+    {BOP_ADC, BAM_IY, 5}, /* 71: ADC (Zpg),Y */
+    {BOP_NONE, BAM_IMP, 0}, /* 72 */
+    {BOP_NONE, BAM_IMP, 0}, /* 73 */
+    {BOP_NONE, BAM_IMP, 0}, /* 74 */
+    {BOP_ADC, BAM_ZPX, 4}, /* 75: ADC Zpg,X */
+    {BOP_ROR, BAM_ZPX, 6}, /* 76: ROR Zpg,X */
+    {BOP_NONE, BAM_IMP, 0}, /* 77 */
+    {BOP_SEI, BAM_IMP, 2}, /* 78: SEI */
+    {BOP_ADC, BAM_ABSY, 4}, /* 79: ADC Abs,Y */
+    {BOP_NONE, BAM_IMP, 0}, /* 7A */
+    {BOP_NONE, BAM_IMP, 0}, /* 7B */
+    {BOP_NONE, BAM_IMP, 0}, /* 7C */
+    {BOP_ADC, BAM_ABSX, 4}, /* 7D: ADC Abs,X */
+    {BOP_ROR, BAM_ABSX, 7}, /* 7E: ROR Abs,X */
+    {BOP_NONE, BAM_IMP, 0}, /* 7F */
+    {BOP_NONE, BAM_IMP, 0}, /* 80 */
+    {BOP_STA, BAM_IX, 6}, /* 81: STA (Zpg,X) */
+    {BOP_NONE, BAM_IMP, 0}, /* 82 */
+    {BOP_NONE, BAM_IMP, 0}, /* 83 */
+    {BOP_STY, BAM_ZP, 3}, /* 84: STY Zpg */
+    {BOP_STA, BAM_ZP, 3}, /* 85: STA Zpg */
+    {BOP_STX, BAM_ZP, 3}, /* 86: STX Zpg */
+    {BOP_NONE, BAM_IMP, 0}, /* 87 */
+    {BOP_DEY, BAM_IMP, 2}, /* 88: DEY */
+    {BOP_NONE, BAM_IMP, 0}, /* 89 */
+    {BOP_TXA, BAM_IMP, 2}, /* 8A: TXA */
+    {BOP_NONE, BAM_IMP, 0}, /* 8B */
+    {BOP_STY, BAM_ABS, 4}, /* 8C: STY Abs */
+    {BOP_STA, BAM_ABS, 4}, /* 8D: STA Abs */
+    {BOP_STX, BAM_ABS, 4}, /* 8E: STX Abs */
+    {BOP_NONE, BAM_IMP, 0}, /* 8F */
+    {BOP_BRANCH, BAM_REL, 2}, /* 90: BCC */
+    {BOP_STA, BAM_IY, 6}, /* 91: STA (Zpg),Y */
+    {BOP_NONE, BAM_IMP, 0}, /* 92 */
+    {BOP_NONE, BAM_IMP, 0}, /* 93 */
+    {BOP_STY, BAM_ZPX, 4}, /* 94: STY Zpg,X */
+    {BOP_STA, BAM_ZPX, 4}, /* 95: STA Zpg,X */
+    {BOP_STX, BAM_ZPY, 4}, /* 96: STX Zpg,Y */
+    {BOP_NONE, BAM_IMP, 0}, /* 97 */
+    {BOP_TYA, BAM_IMP, 2}, /* 98: TYA */
+    {BOP_STA, BAM_ABSY, 5}, /* 99: STA Abs,Y */
+    {BOP_TXS, BAM_IMP, 2}, /* 9A: TXS */
+    {BOP_NONE, BAM_IMP, 0}, /* 9B */
+    {BOP_NONE, BAM_IMP, 0}, /* 9C */
+    {BOP_STA, BAM_ABSX, 5}, /* 9D: STA Abs,X */
+    {BOP_NONE, BAM_IMP, 0}, /* 9E */
+    {BOP_NONE, BAM_IMP, 0}, /* 9F */
+    {BOP_LDY, BAM_IMM, 2}, /* A0: LDY #Imm */
+    {BOP_LDA, BAM_IX, 6}, /* A1: LDA (Zpg,X) */
+    {BOP_LDX, BAM_IMM, 2}, /* A2: LDX #Imm */
+    {BOP_NONE, BAM_IMP, 0}, /* A3 */
+    {BOP_LDY, BAM_ZP, 3}, /* A4: LDY Zpg */
+    {BOP_LDA, BAM_ZP, 3}, /* A5: LDA Zpg */
+    {BOP_LDX, BAM_ZP, 3}, /* A6: LDX Zpg */
+    {BOP_NONE, BAM_IMP, 0}, /* A7 */
+    {BOP_TAY, BAM_IMP, 2}, /* A8: TAY */
+    {BOP_LDA, BAM_IMM, 2}, /* A9: LDA #Imm */
+    {BOP_TAX, BAM_IMP, 2}, /* AA: TAX */
+    {BOP_NONE, BAM_IMP, 0}, /* AB */
+    {BOP_LDY, BAM_ABS, 4}, /* AC: LDY Abs */
+    {BOP_LDA, BAM_ABS, 4}, /* AD: LDA Abs */
+    {BOP_LDX, BAM_ABS, 4}, /* AE: LDX Abs */
+    {BOP_NONE, BAM_IMP, 0}, /* AF */
+    {BOP_BRANCH, BAM_REL, 2}, /* B0: BCS */
+    {BOP_LDA, BAM_IY, 5}, /* B1: LDA (Zpg),Y */
+    {BOP_NONE, BAM_IMP, 0}, /* B2 */
+    {BOP_NONE, BAM_IMP, 0}, /* B3 */
+    {BOP_LDY, BAM_ZPX, 4}, /* B4: LDY Zpg,X */
+    {BOP_LDA, BAM_ZPX, 4}, /* B5: LDA Zpg,X */
+    {BOP_LDX, BAM_ZPY, 4}, /* B6: LDX Zpg,Y */
+    {BOP_NONE, BAM_IMP, 0}, /* B7 */
+    {BOP_CLV, BAM_IMP, 2}, /* B8: CLV */
+    {BOP_LDA, BAM_ABSY, 4}, /* B9: LDA Abs,Y */
+    {BOP_TSX, BAM_IMP, 2}, /* BA: TSX */
+    {BOP_NONE, BAM_IMP, 0}, /* BB */
+    {BOP_LDY, BAM_ABSX, 4}, /* BC: LDY Abs,X */
+    {BOP_LDA, BAM_ABSX, 4}, /* BD: LDA Abs,X */
+    {BOP_LDX, BAM_ABSY, 4}, /* BE: LDX Abs,Y */
+    {BOP_NONE, BAM_IMP, 0}, /* BF */
+    {BOP_CPY, BAM_IMM, 2}, /* C0: CPY #Imm */
+    {BOP_CMP, BAM_IX, 6}, /* C1: CMP (Zpg,X) */
+    {BOP_NONE, BAM_IMP, 0}, /* C2 */
+    {BOP_NONE, BAM_IMP, 0}, /* C3 */
+    {BOP_CPY, BAM_ZP, 3}, /* C4: CPY Zpg */
+    {BOP_CMP, BAM_ZP, 3}, /* C5: CMP Zpg */
+    {BOP_DEC, BAM_ZP, 5}, /* C6: DEC Zpg */
+    {BOP_NONE, BAM_IMP, 0}, /* C7 */
+    {BOP_INY, BAM_IMP, 2}, /* C8: INY */
+    {BOP_CMP, BAM_IMM, 2}, /* C9: CMP #Imm */
+    {BOP_DEX, BAM_IMP, 2}, /* CA: DEX */
+    {BOP_NONE, BAM_IMP, 0}, /* CB */
+    {BOP_CPY, BAM_ABS, 4}, /* CC: CPY Abs */
+    {BOP_CMP, BAM_ABS, 4}, /* CD: CMP Abs */
+    {BOP_DEC, BAM_ABS, 6}, /* CE: DEC Abs */
+    {BOP_NONE, BAM_IMP, 0}, /* CF */
+    {BOP_BRANCH, BAM_REL, 2}, /* D0: BNE */
+    {BOP_CMP, BAM_IY, 5}, /* D1: CMP (Zpg),Y */
+    {BOP_NONE, BAM_IMP, 0}, /* D2 */
+    {BOP_NONE, BAM_IMP, 0}, /* D3 */
+    {BOP_NONE, BAM_IMP, 0}, /* D4 */
+    {BOP_CMP, BAM_ZPX, 4}, /* D5: CMP Zpg,X */
+    {BOP_DEC, BAM_ZPX, 6}, /* D6: DEC Zpg,X */
+    {BOP_NONE, BAM_IMP, 0}, /* D7 */
+    {BOP_CLD, BAM_IMP, 2}, /* D8: CLD */
+    {BOP_CMP, BAM_ABSY, 4}, /* D9: CMP Abs,Y */
+    {BOP_NONE, BAM_IMP, 0}, /* DA */
+    {BOP_NONE, BAM_IMP, 0}, /* DB */
+    {BOP_NONE, BAM_IMP, 0}, /* DC */
+    {BOP_CMP, BAM_ABSX, 4}, /* DD: CMP Abs,X */
+    {BOP_DEC, BAM_ABSX, 7}, /* DE: DEC Abs,X */
+    {BOP_NONE, BAM_IMP, 0}, /* DF */
+    {BOP_CPX, BAM_IMM, 2}, /* E0: CPX #Imm */
+    {BOP_SBC, BAM_IX, 6}, /* E1: SBC (Zpg,X) */
+    {BOP_NONE, BAM_IMP, 0}, /* E2 */
+    {BOP_NONE, BAM_IMP, 0}, /* E3 */
+    {BOP_CPX, BAM_ZP, 3}, /* E4: CPX Zpg */
+    {BOP_SBC, BAM_ZP, 3}, /* E5: SBC Zpg */
+    {BOP_INC, BAM_ZP, 5}, /* E6: INC Zpg */
+    {BOP_NONE, BAM_IMP, 0}, /* E7 */
+    {BOP_INX, BAM_IMP, 2}, /* E8: INX */
+    {BOP_SBC, BAM_IMM, 2}, /* E9: SBC #Imm */
+    {BOP_NOP, BAM_IMP, 2}, /* EA: NOP */
+    {BOP_NONE, BAM_IMP, 0}, /* EB */
+    {BOP_CPX, BAM_ABS, 4}, /* EC: CPX Abs */
+    {BOP_SBC, BAM_ABS, 4}, /* ED: SBC Abs */
+    {BOP_INC, BAM_ABS, 6}, /* EE: INC Abs */
+    {BOP_NONE, BAM_IMP, 0}, /* EF */
+    {BOP_BRANCH, BAM_REL, 2}, /* F0: BEQ */
+    {BOP_SBC, BAM_IY, 5}, /* F1: SBC (Zpg),Y */
+    {BOP_NONE, BAM_IMP, 0}, /* F2 */
+    {BOP_NONE, BAM_IMP, 0}, /* F3 */
+    {BOP_NONE, BAM_IMP, 0}, /* F4 */
+    {BOP_SBC, BAM_ZPX, 4}, /* F5: SBC Zpg,X */
+    {BOP_INC, BAM_ZPX, 6}, /* F6: INC Zpg,X */
+    {BOP_NONE, BAM_IMP, 0}, /* F7 */
+    {BOP_SED, BAM_IMP, 2}, /* F8: SED */
+    {BOP_SBC, BAM_ABSY, 4}, /* F9: SBC Abs,Y */
+    {BOP_NONE, BAM_IMP, 0}, /* FA */
+    {BOP_NONE, BAM_IMP, 0}, /* FB */
+    {BOP_NONE, BAM_IMP, 0}, /* FC */
+    {BOP_SBC, BAM_ABSX, 4}, /* FD: SBC Abs,X */
+    {BOP_INC, BAM_ABSX, 7}, /* FE: INC Abs,X */
+    {BOP_NONE, BAM_IMP, 0}, /* FF */
+};
+
+// A micro-op ( wOp is the opcode, and UOP_NF when N and Z of the result are never read )
+#define UOP_NF 0x0100
+struct block_uop_tag
+{
+  WORD wOp;
+  WORD wArg;    /* Resolved address, base address or value */
+  BYTE byClock; /* Base clocks of the block before this micro-op */
+#if K6502_PROFILE || K6502_TRACE
+  WORD wPC;     /* The address of the instruction */
+#endif
+};
+
+// A basic block of ROM code
+struct block_tag
+{
+  WORD wPC;           /* 0: empty */
+  BYTE byGen;         /* g_byDecodeGen[] of the bank when it was translated */
+  BYTE byUops;
+  BYTE byClocks;      /* Base clocks of the micro-ops */
+  BYTE byMaxClocks;   /* ... with every page crossing */
+  BYTE byExit;        /* BOP_BRANCH, BOP_JMP, BOP_JSR, BOP_RTS, or BOP_NONE to go on to wNext */
+  BYTE byExitCode;    /* The opcode of the exit */
+  BYTE byTakenClocks; /* Clocks of a taken branch */
+  WORD wNext;         /* The address after the block */
+  WORD wTarget;       /* The address that the exit goes to */
+  DWORD dwUsed;       /* g_dwBlockRuns when it ran last ( LRU ) */
+  struct block_uop_tag Uops[BLOCK_MAX_UOPS];
+};
+static struct block_tag g_Blocks[BLOCK_SETS][BLOCK_WAYS];
+#endif
 
 // A table for the test
 BYTE g_byTestTable[256];
@@ -396,95 +1346,648 @@ void K6502_Reset()
  *
  */
 
+  LOAD_CONTEXT();
+
   // Reset Registers
   PC = K6502_ReadW(VECTOR_RESET);
   SP = 0xFF;
   A = X = Y = 0;
   F = FLAG_Z | FLAG_R | FLAG_I;
+  LOADNZ();
 
   // Set up the state of the Interrupt pin.
   NMI_State = NMI_Wiring;
   IRQ_State = IRQ_Wiring;
 
-  // Reset Passed Clocks
-  g_wPassedClocks = 0;
-  g_wCurrentClocks = 0;
+  // Reset Passed Clocks ( the total keeps counting )
+  g_qwBaseClocks += wPassedClocks;
+  wPassedClocks = 0;
+
+  SAVE_CONTEXT();
+
+  // Reset idle loop detection
+  g_dwIdleClocks = 0;
+  g_IdleLoop.wBranch = 0;
+
+  // Reset the instruction cache and the block cache
+#if K6502_DECODE_CACHE
+  memset(g_DecodeCache, 0, sizeof g_DecodeCache);
+#endif
+#if K6502_BLOCK_CACHE
+  memset(g_Blocks, 0, sizeof g_Blocks);
+#endif
+  g_dwDecodeHits = g_dwDecodeMisses = 0;
+  g_dwBlockRuns = g_dwBlockInstructions = g_dwBlockTranslations = 0;
+  g_dwAotInstructions = g_dwAotMisses = 0;
+  g_dwFusedDispatches = 0;
+
+  // Reset the profile and the trace ( the former game is dumped before )
+  K6502_ProfileReset();
+  K6502_TraceReset();
 }
 
 /*===================================================================*/
 /*                                                                   */
-/*    K6502_Set_Int_Wiring() : Set up wiring of the interrupt pin    */
+/*   K6502_InvalidateBank() : Drop decoded instructions of a bank    */
 /*                                                                   */
 /*===================================================================*/
-void K6502_Set_Int_Wiring(BYTE byNMI_Wiring, BYTE byIRQ_Wiring)
+void K6502_InvalidateBank(int nBank)
 {
   /*
- * Set up wiring of the interrupt pin
+ *  Drop decoded instructions of a bank
+ *
+ *  Parameters
+ *    int nBank                 (Read)
+ *      ROMBANK index ( 0: 0x8000 - 3: 0xe000 )
  *
+ *  Remarks
+ *    Called when a mapper switches ROMBANK[ nBank ].
+ *    The entries and blocks of the bank are dropped at once by moving
+ *    it to a new generation, the caches are cleared when it wraps.
  */
 
-  NMI_Wiring = byNMI_Wiring;
-  IRQ_Wiring = byIRQ_Wiring;
+#if K6502_DECODE_CACHE || K6502_BLOCK_CACHE
+  if (++g_byDecodeGen[nBank & 3] == 0)
+  {
+#if K6502_DECODE_CACHE
+    memset(g_DecodeCache, 0, sizeof g_DecodeCache);
+#endif
+#if K6502_BLOCK_CACHE
+    memset(g_Blocks, 0, sizeof g_Blocks);
+#endif
+  }
+#else
+  (void)nBank;
+#endif
 }
 
-static void __not_in_flash_func(procNMI)()
+/*===================================================================*/
+/*                                                                   */
+/*       K6502_AotSelect() : Select recompiled code for a ROM        */
+/*                                                                   */
+/*===================================================================*/
+bool K6502_AotSelect(const BYTE *pPrg, DWORD dwSize)
 {
-  // Dispose of it if there is an interrupt requirement
-  if (NMI_State != NMI_Wiring)
-  {
-    // NMI Interrupt
-    NMI_State = NMI_Wiring;
-    CLK(7);
-
-    PUSHW(PC);
-    PUSH(F & ~FLAG_B);
+  /*
+ *  Select recompiled code for a ROM
+ *
+ *  Parameters
+ *    const BYTE *pPrg          (Read)
+ *      The PRG-ROM
+ *
+ *    DWORD dwSize              (Read)
+ *      Size of the PRG-ROM
+ *
+ *  Return values
+ *    true when the code of the ROM was recompiled
+ *
+ *  Remarks
+ *    The ROM is matched by the size and hash of its PRG-ROM, any other
+ *    ROM is left to the interpreter.
+ */
 
-    RSTF(FLAG_D);
-    SETF(FLAG_I);
+#if K6502_AOT
+  g_pAotGame = NULL;
 
-    PC = K6502_ReadW(VECTOR_NMI);
-  }
-  else if (IRQ_State != IRQ_Wiring)
+  DWORD dwHash = 0;
+  bool bHashed = false;
+  for (const struct aot_game_tag &game : g_AotGames)
   {
-    // IRQ Interrupt
-    // Execute IRQ if an I flag isn't being set
-    if (!(F & FLAG_I))
-    {
-      IRQ_State = IRQ_Wiring;
-      CLK(7);
-
-      PUSHW(PC);
-      PUSH(F & ~FLAG_B);
-
-      RSTF(FLAG_D);
-      SETF(FLAG_I);
+    if (game.dwSize != dwSize)
+      continue;
 
-      PC = K6502_ReadW(VECTOR_IRQ);
+    if (!bHashed)
+    {
+      dwHash = 0x811c9dc5;
+      for (DWORD i = 0; i < dwSize; ++i)
+        dwHash = ((dwHash ^ pPrg[i]) * 0x01000193) & 0xffffffff;
+      bHashed = true;
+    }
+    if (game.dwHash == dwHash)
+    {
+      g_pAotGame = &game;
+      return true;
     }
   }
+#else
+  (void)pPrg;
+  (void)dwSize;
+#endif
+  return false;
 }
 
-static void __not_in_flash_func(step)(int wClocks)
+#if K6502_PROFILE
+// Insert a count into the largest ones so far ( largest first )
+static void profileTop(const DWORD *pdwCounts, int nIndex, int *pnTop, int &nTop, int nMax)
+{
+  DWORD dwCount = pdwCounts[nIndex];
+  if (dwCount == 0 || (nTop == nMax && dwCount <= pdwCounts[pnTop[nTop - 1]]))
+    return;
+
+  int nPos = nTop < nMax ? nTop++ : nMax - 1;
+  for (; nPos > 0 && pdwCounts[pnTop[nPos - 1]] < dwCount; --nPos)
+    pnTop[nPos] = pnTop[nPos - 1];
+  pnTop[nPos] = nIndex;
+}
+#endif
+
+/*===================================================================*/
+/*                                                                   */
+/*         K6502_ProfileDump() : Print the execution profile         */
+/*                                                                   */
+/*===================================================================*/
+void K6502_ProfileDump()
 {
   /*
- *  Only the specified number of the clocks execute Op.
+ *  Print the execution profile
  *
- *  Parameters
- *    WORD wClocks              (Read)
- *      The number of the clocks
+ *  Remarks
+ *    Prints the most executed opcodes and addresses to stdout ( UART ),
+ *    nothing when no instruction was counted since the profile was reset.
+ *    Addresses are shown as bank:PC, the 8KB PRG-ROM bank of the window
+ *    that the PC was in, or as RAM:PC for code out of PRG-ROM.
  */
 
-  BYTE byCode;
+#if K6502_PROFILE
+  DWORD dwTotal = 0;
+  for (int nCode = 0; nCode < 256; ++nCode)
+    dwTotal += g_dwProfileOps[nCode];
+  if (dwTotal == 0)
+    return;
+
+  printf("K6502 profile: %lu instructions counted ( every %d )\n", (unsigned long)dwTotal, K6502_PROFILE);
+
+  int nTop[PROFILE_TOP_PCS];
+  int nTops = 0;
+  for (int nCode = 0; nCode < 256; ++nCode)
+    profileTop(g_dwProfileOps, nCode, nTop, nTops, PROFILE_TOP_OPS);
+  printf("  opcode   count       %%\n");
+  for (int i = 0; i < nTops; ++i)
+  {
+    DWORD dwCount = g_dwProfileOps[nTop[i]];
+    printf("  %02X       %-10lu %5.2f\n", nTop[i], (unsigned long)dwCount, 100.0 * dwCount / dwTotal);
+  }
 
-  WORD wA0;
-  BYTE byD0;
+  nTops = 0;
+  for (int nIndex = 0; nIndex < PROFILE_PC_ENTRIES; ++nIndex)
+    profileTop(g_dwProfileHits, nIndex, nTop, nTops, PROFILE_TOP_PCS);
+  printf("  bank:PC  count       %%\n");
+  for (int i = 0; i < nTops; ++i)
+  {
+    DWORD dwKey = g_dwProfileKeys[nTop[i]];
+    DWORD dwCount = g_dwProfileHits[nTop[i]];
+    if ((dwKey >> 16) == 0xffff)
+      printf("  RAM:%04X %-10lu %5.2f\n", (unsigned)(dwKey & 0xffff), (unsigned long)dwCount, 100.0 * dwCount / dwTotal);
+    else
+      printf("  %03X:%04X %-10lu %5.2f\n", (unsigned)(dwKey >> 16), (unsigned)(dwKey & 0xffff), (unsigned long)dwCount,
+             100.0 * dwCount / dwTotal);
+  }
+  if (g_dwProfileDropped)
+    printf("  %lu counts dropped, the address table is full ( K6502_PROFILE_PC_BITS )\n", (unsigned long)g_dwProfileDropped);
+#endif
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*         K6502_ProfileReset() : Clear the execution profile        */
+/*                                                                   */
+/*===================================================================*/
+void K6502_ProfileReset()
+{
+#if K6502_PROFILE
+  memset(g_dwProfileOps, 0, sizeof g_dwProfileOps);
+  memset(g_dwProfileKeys, 0, sizeof g_dwProfileKeys);
+  memset(g_dwProfileHits, 0, sizeof g_dwProfileHits);
+  g_dwProfileDropped = 0;
+  g_nProfileCountdown = K6502_PROFILE;
+#endif
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*        K6502_TraceDump() : Print the last executed instructions   */
+/*                                                                   */
+/*===================================================================*/
+void K6502_TraceDump()
+{
+  /*
+ *  Print the last executed instructions
+ *
+ *  Remarks
+ *    The entries are printed oldest first to stdout ( UART ), one
+ *    16 byte entry as 32 hex digits a line, between a "K6502 TRACE"
+ *    line and a "K6502 TRACE END" line. k6502_trace_decode.py turns a
+ *    log that has them into a nestest style listing. Text is used,
+ *    since stdio may translate the line feeds of binary data.
+ *    Nothing is printed when there is no trace ( e.g. after power on ).
+ */
+
+#if K6502_TRACE
+  if (g_dwTraceMagic != TRACE_MAGIC || g_dwTraceCount == 0)
+    return;
+
+  DWORD dwEntries = g_dwTraceCount < TRACE_ENTRIES ? g_dwTraceCount : TRACE_ENTRIES;
+  printf("K6502 TRACE %lu %u\n", (unsigned long)dwEntries, (unsigned)sizeof(struct trace_tag));
+  for (DWORD dwIndex = g_dwTraceCount - dwEntries; dwIndex != g_dwTraceCount; ++dwIndex)
+  {
+    const BYTE *pbyEntry = (const BYTE *)&g_Trace[dwIndex & TRACE_MASK];
+    for (unsigned i = 0; i < sizeof(struct trace_tag); ++i)
+      printf("%02X", pbyEntry[i]);
+    printf("\n");
+  }
+  printf("K6502 TRACE END\n");
+#endif
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*        K6502_TraceReset() : Clear the trace                       */
+/*                                                                   */
+/*===================================================================*/
+void K6502_TraceReset()
+{
+#if K6502_TRACE
+  g_dwTraceCount = 0;
+  g_dwTraceMagic = TRACE_MAGIC;
+#endif
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*    K6502_Set_Int_Wiring() : Set up wiring of the interrupt pin    */
+/*                                                                   */
+/*===================================================================*/
+void K6502_Set_Int_Wiring(BYTE byNMI_Wiring, BYTE byIRQ_Wiring)
+{
+  /*
+ * Set up wiring of the interrupt pin
+ *
+ */
+
+  NMI_Wiring = byNMI_Wiring;
+  IRQ_Wiring = byIRQ_Wiring;
+}
+
+static void __not_in_flash_func(procNMI)()
+{
+  LOAD_CONTEXT();
+
+  // Dispose of it if there is an interrupt requirement
+  if (NMI_State != NMI_Wiring)
+  {
+    // NMI Interrupt
+    NMI_State = NMI_Wiring;
+    CLK(7);
+
+    PUSHW(PC);
+    PUSH(GETF() & ~FLAG_B);
+
+    RSTF(FLAG_D);
+    SETF(FLAG_I);
+
+    PC = K6502_ReadW(VECTOR_NMI);
+  }
+  else if (IRQ_State != IRQ_Wiring)
+  {
+    // IRQ Interrupt
+    // Execute IRQ if an I flag isn't being set
+    if (!(F & FLAG_I))
+    {
+      IRQ_State = IRQ_Wiring;
+      CLK(7);
+
+      PUSHW(PC);
+      PUSH(GETF() & ~FLAG_B);
+
+      RSTF(FLAG_D);
+      SETF(FLAG_I);
+
+      PC = K6502_ReadW(VECTOR_IRQ);
+    }
+  }
+
+  SAVE_CONTEXT();
+}
+
+#if K6502_DECODE_CACHE
+/*===================================================================*/
+/*                                                                   */
+/*      decode() : Read an instruction into the instruction cache    */
+/*                                                                   */
+/*===================================================================*/
+static BYTE __not_in_flash_func(decode)(WORD wPC, WORD &wOperand)
+{
+  /*
+ *  Read an instruction into the instruction cache
+ *
+ *  Parameters
+ *    WORD wPC                  (Read)
+ *      The address of the opcode
+ *
+ *    WORD &wOperand            (Write)
+ *      The bytes following the opcode
+ *
+ *  Return values
+ *    The opcode
+ *
+ *  Remarks
+ *    Only the bytes that the handler would read are read, so code
+ *    running from RAM or I/O sees the same reads as without the cache.
+ *    Only ROM ( 0x8000 - 0xffff ) is cached, it is assumed that
+ *    nothing writes to the memory behind ROMBANK[].
+ */
+
+  BYTE byCode = K6502_Read(wPC);
+  BYTE byLength = g_byDecodeLength[byCode];
+
+  if (byLength == 3)
+    wOperand = K6502_ReadW(wPC + 1);
+  else if (byLength == 2)
+    wOperand = K6502_Read(wPC + 1);
+  else
+    wOperand = 0;
+
+  ++g_dwDecodeMisses;
+
+  // An instruction across two banks is not cached, it has two generations
+  if (wPC >= 0x8000 && (wPC & 0x1fff) <= 0x1ffd)
+  {
+    struct decode_cache_tag *pEntry = &g_DecodeCache[wPC & DECODE_MASK];
+    pEntry->wPC = wPC;
+    pEntry->byCode = byCode;
+    pEntry->byGen = g_byDecodeGen[(wPC >> 13) & 3];
+    pEntry->wOperand = wOperand;
+  }
+  return byCode;
+}
+#endif /* K6502_DECODE_CACHE */
+
+#if K6502_IDLE_SKIP
+/*===================================================================*/
+/*                                                                   */
+/*   idleLoopBody() : Check that a loop body only reads memory       */
+/*                                                                   */
+/*===================================================================*/
+static bool __not_in_flash_func(idleLoopBody)(WORD wTop, WORD wBranch, BYTE X, BYTE Y)
+{
+  /*
+ *  Check that a loop body only reads memory
+ *
+ *  Parameters
+ *    WORD wTop                 (Read)
+ *      The first instruction of the loop
+ *
+ *    WORD wBranch              (Read)
+ *      The backward branch that closes the loop
+ *
+ *    BYTE X, BYTE Y            (Read)
+ *      Index registers
+ *
+ *  Return values
+ *    true : Every instruction is a load, compare or register operation
+ *           whose operand K6502_IsIdleRead() accepts, and every branch
+ *           inside the body stays inside the body
+ *
+ *  Remarks
+ *    The whitelist is small on purpose, it covers the usual
+ *    "LDA $2002 / BPL" and "LDA zp / BEQ" wait loops.
+ */
+  WORD wAddr = wTop;
+
+  while (wAddr < wBranch)
+  {
+    if (!K6502_IsIdleRead(wAddr))
+      return false;
+
+    BYTE byCode = K6502_Read(wAddr);
+    WORD wOperand;
+
+    switch (byCode)
+    {
+    case 0x18: // CLC
+    case 0x38: // SEC
+    case 0xB8: // CLV
+    case 0xEA: // NOP
+    case 0xAA: // TAX
+    case 0x8A: // TXA
+    case 0xA8: // TAY
+    case 0x98: // TYA
+      wAddr += 1;
+      continue;
+
+    case 0x09: // ORA #Oper
+    case 0x29: // AND #Oper
+    case 0x49: // EOR #Oper
+    case 0xA9: // LDA #Oper
+    case 0xA2: // LDX #Oper
+    case 0xA0: // LDY #Oper
+    case 0xC9: // CMP #Oper
+    case 0xE0: // CPX #Oper
+    case 0xC0: // CPY #Oper
+    case 0x05: // ORA Zpg
+    case 0x25: // AND Zpg
+    case 0x45: // EOR Zpg
+    case 0xA5: // LDA Zpg
+    case 0xA6: // LDX Zpg
+    case 0xA4: // LDY Zpg
+    case 0x24: // BIT Zpg
+    case 0xC5: // CMP Zpg
+    case 0xE4: // CPX Zpg
+    case 0xC4: // CPY Zpg
+    case 0xB5: // LDA Zpg,X
+    case 0xB4: // LDY Zpg,X
+    case 0xD5: // CMP Zpg,X
+      wAddr += 2;
+      continue;
+
+    case 0x10: // BPL
+    case 0x30: // BMI
+    case 0x50: // BVC
+    case 0x70: // BVS
+    case 0x90: // BCC
+    case 0xB0: // BCS
+    case 0xD0: // BNE
+    case 0xF0: // BEQ
+      wOperand = wAddr + 2 + (int8_t)K6502_Read(wAddr + 1);
+      if (wOperand < wTop || wOperand >= wBranch)
+        return false;
+      wAddr += 2;
+      continue;
+
+    case 0x0D: // ORA Abs
+    case 0x2D: // AND Abs
+    case 0x4D: // EOR Abs
+    case 0xAD: // LDA Abs
+    case 0xAE: // LDX Abs
+    case 0xAC: // LDY Abs
+    case 0x2C: // BIT Abs
+    case 0xCD: // CMP Abs
+    case 0xEC: // CPX Abs
+    case 0xCC: // CPY Abs
+      wOperand = K6502_ReadW(wAddr + 1);
+      break;
+
+    case 0xBD: // LDA Abs,X
+    case 0xBC: // LDY Abs,X
+    case 0xDD: // CMP Abs,X
+      wOperand = K6502_ReadW(wAddr + 1) + X;
+      break;
+
+    case 0xB9: // LDA Abs,Y
+    case 0xBE: // LDX Abs,Y
+    case 0xD9: // CMP Abs,Y
+      wOperand = K6502_ReadW(wAddr + 1) + Y;
+      break;
+
+    default:
+      return false;
+    }
+
+    if (!K6502_IsIdleRead(wOperand))
+      return false;
+    wAddr += 3;
+  }
+
+  return wAddr == wBranch;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*       idleLoop() : Fast-forward a side-effect free spin loop      */
+/*                                                                   */
+/*===================================================================*/
+static int __not_in_flash_func(idleLoop)(WORD wBranch, int wClocks,
+                                         WORD PC, BYTE A, BYTE X, BYTE Y, BYTE F, BYTE SP,
+                                         int wPassedClocks)
+{
+  /*
+ *  Fast-forward a side-effect free spin loop
+ *
+ *  Parameters
+ *    WORD wBranch              (Read)
+ *      The short backward branch that was just taken
+ *
+ *    int wClocks               (Read)
+ *      The end of the current slice
+ *
+ *    PC ... wPassedClocks      (Read)
+ *      Registers ( F complete ) and clocks after the branch
+ *
+ *  Return values
+ *    The number of the clocks to skip
+ *
+ *  Remarks
+ *    When the same branch is taken twice in a slice with identical
+ *    registers and the loop body only reads memory, the loop is at a
+ *    fixed point: nothing it reads can change before the next event
+ *    ( the end of the slice ), so the remaining iterations are only
+ *    counted instead of executed.
+ */
+  if (g_IdleLoop.wBranch == wBranch &&
+      g_IdleLoop.byA == A && g_IdleLoop.byX == X && g_IdleLoop.byY == Y &&
+      g_IdleLoop.byF == F && g_IdleLoop.bySP == SP)
+  {
+    int nIteration = wPassedClocks - g_IdleLoop.nClocks;
+    int nSkip = 0;
+
+    if (nIteration > 0 && wPassedClocks < wClocks && idleLoopBody(PC, wBranch, X, Y))
+    {
+      nSkip = (wClocks - wPassedClocks + nIteration - 1) / nIteration * nIteration;
+      g_dwIdleClocks += nSkip;
+    }
+    g_IdleLoop.wBranch = 0;
+    return nSkip;
+  }
+
+  g_IdleLoop.wBranch = wBranch;
+  g_IdleLoop.byA = A;
+  g_IdleLoop.byX = X;
+  g_IdleLoop.byY = Y;
+  g_IdleLoop.byF = F;
+  g_IdleLoop.bySP = SP;
+  g_IdleLoop.nClocks = wPassedClocks;
+  return 0;
+}
+#endif /* K6502_IDLE_SKIP */
+
+template <class CoreMapper>
+static void __not_in_flash_func(run)(int wClocks, int wStop)
+{
+  /*
+ *  Interpret Op. until the clocks pass wStop
+ *
+ *  Parameters
+ *    int wClocks               (Read)
+ *      The end of the slice ( idle loops are skipped up to it )
+ *
+ *    int wStop                 (Read)
+ *      The clocks to stop at ( wClocks, or earlier for a block cache fallback )
+ *
+ *  Remarks
+ *    CoreMapper is the mapper hooks of reading/writing, so that they
+ *    are called directly ( or left out ) instead of through MapperWrite
+ *    and MapperReadApu. It is picked by K6502_SelectCore().
+ */
+
+  LOAD_CONTEXT();
+
+  BYTE byCode;
+#if K6502_DECODE_CACHE
+  WORD wOperand;
+  DWORD dwDecodeHits = 0;
+#endif
+#if K6502_FUSION
+  DWORD dwFusedDispatches = 0;
+#endif
+
+  WORD wA0;
+  BYTE byD0;
   BYTE byD1;
   WORD wD0;
 
-  auto prePassedClocks = g_wPassedClocks;
-
+#if K6502_THREADED_DISPATCH
+  // Handler table ( unlisted opcodes go to op_default )
+  static const void *dispatchTable[256] = {
+      &&op_0x00, &&op_0x01, &&op_default, &&op_default, &&op_0x04, &&op_0x05, &&op_0x06, &&op_default,
+      &&op_0x08, &&op_0x09, &&op_0x0A, &&op_default, &&op_0x0C, &&op_0x0D, &&op_0x0E, &&op_default,
+      &&op_0x10, &&op_0x11, &&op_default, &&op_default, &&op_0x14, &&op_0x15, &&op_0x16, &&op_default,
+      &&op_0x18, &&op_0x19, &&op_0x1A, &&op_default, &&op_0x1C, &&op_0x1D, &&op_0x1E, &&op_default,
+      &&op_0x20, &&op_0x21, &&op_default, &&op_default, &&op_0x24, &&op_0x25, &&op_0x26, &&op_default,
+      &&op_0x28, &&op_0x29, &&op_0x2A, &&op_default, &&op_0x2C, &&op_0x2D, &&op_0x2E, &&op_default,
+      &&op_0x30, &&op_0x31, &&op_default, &&op_default, &&op_0x34, &&op_0x35, &&op_0x36, &&op_default,
+      &&op_0x38, &&op_0x39, &&op_0x3A, &&op_default, &&op_0x3C, &&op_0x3D, &&op_0x3E, &&op_default,
+      &&op_0x40, &&op_0x41, &&op_default, &&op_default, &&op_0x44, &&op_0x45, &&op_0x46, &&op_default,
+      &&op_0x48, &&op_0x49, &&op_0x4A, &&op_default, &&op_0x4C, &&op_0x4D, &&op_0x4E, &&op_default,
+      &&op_0x50, &&op_0x51, &&op_default, &&op_default, &&op_0x54, &&op_0x55, &&op_0x56, &&op_default,
+      &&op_0x58, &&op_0x59, &&op_0x5A, &&op_default, &&op_0x5C, &&op_0x5D, &&op_0x5E, &&op_default,
+      &&op_0x60, &&op_0x61, &&op_default, &&op_default, &&op_0x64, &&op_0x65, &&op_0x66, &&op_default,
+      &&op_0x68, &&op_0x69, &&op_0x6A, &&op_default, &&op_0x6C, &&op_0x6D, &&op_0x6E, &&op_default,
+      &&op_0x70, &&op_0x71, &&op_default, &&op_default, &&op_0x74, &&op_0x75, &&op_0x76, &&op_default,
+      &&op_0x78, &&op_0x79, &&op_0x7A, &&op_default, &&op_0x7C, &&op_0x7D, &&op_0x7E, &&op_default,
+      &&op_0x80, &&op_0x81, &&op_0x82, &&op_default, &&op_0x84, &&op_0x85, &&op_0x86, &&op_default,
+      &&op_0x88, &&op_0x89, &&op_0x8A, &&op_default, &&op_0x8C, &&op_0x8D, &&op_0x8E, &&op_default,
+      &&op_0x90, &&op_0x91, &&op_default, &&op_default, &&op_0x94, &&op_0x95, &&op_0x96, &&op_default,
+      &&op_0x98, &&op_0x99, &&op_0x9A, &&op_default, &&op_default, &&op_0x9D, &&op_default, &&op_default,
+      &&op_0xA0, &&op_0xA1, &&op_0xA2, &&op_default, &&op_0xA4, &&op_0xA5, &&op_0xA6, &&op_default,
+      &&op_0xA8, &&op_0xA9, &&op_0xAA, &&op_default, &&op_0xAC, &&op_0xAD, &&op_0xAE, &&op_default,
+      &&op_0xB0, &&op_0xB1, &&op_default, &&op_default, &&op_0xB4, &&op_0xB5, &&op_0xB6, &&op_default,
+      &&op_0xB8, &&op_0xB9, &&op_0xBA, &&op_default, &&op_0xBC, &&op_0xBD, &&op_0xBE, &&op_default,
+      &&op_0xC0, &&op_0xC1, &&op_0xC2, &&op_default, &&op_0xC4, &&op_0xC5, &&op_0xC6, &&op_default,
+      &&op_0xC8, &&op_0xC9, &&op_0xCA, &&op_default, &&op_0xCC, &&op_0xCD, &&op_0xCE, &&op_default,
+      &&op_0xD0, &&op_0xD1, &&op_default, &&op_default, &&op_0xD4, &&op_0xD5, &&op_0xD6, &&op_default,
+      &&op_0xD8, &&op_0xD9, &&op_0xDA, &&op_default, &&op_0xDC, &&op_0xDD, &&op_0xDE, &&op_default,
+      &&op_0xE0, &&op_0xE1, &&op_0xE2, &&op_default, &&op_0xE4, &&op_0xE5, &&op_0xE6, &&op_default,
+      &&op_0xE8, &&op_0xE9, &&op_0xEA, &&op_default, &&op_0xEC, &&op_0xED, &&op_0xEE, &&op_default,
+      &&op_0xF0, &&op_0xF1, &&op_default, &&op_default, &&op_0xF4, &&op_0xF5, &&op_0xF6, &&op_default,
+      &&op_0xF8, &&op_0xF9, &&op_0xFA, &&op_default, &&op_0xFC, &&op_0xFD, &&op_0xFE, &&op_default,
+  };
+
+  // Fetch the first instruction, every handler dispatches the next one
+  NEXT;
+  {
+#else
   // It has a loop until a constant clock passes
-  while (g_wPassedClocks < wClocks)
+  while (wPassedClocks < wStop)
   {
     // if (PC == 0xc449 || PC == 0xc955)
     // {
@@ -497,237 +2000,246 @@ static void __not_in_flash_func(step)(int wClocks)
     // }
 
     // Read an instruction
-    byCode = K6502_Read(PC++);
+    FETCH();
+    K6502_INSTRUCTION_HOOK(byCode);
+    PROFILE(PC - 1, byCode);
+    TRACE(PC - 1, byCode, wPassedClocks);
 
     //    printf("PC %04x %02x\n", PC - 1, byCode);
 
+#if K6502_FUSION
+  op_dispatch:
+#endif
     // Execute an instruction.
     switch (byCode)
     {
-    case 0x00: // BRK
+#endif
+    OP(0x00): // BRK
       ++PC;
       PUSHW(PC);
       SETF(FLAG_B);
-      PUSH(F);
+      PUSH(GETF());
       SETF(FLAG_I);
       RSTF(FLAG_D);
-      PC = K6502_ReadW(VECTOR_IRQ);
+      PC = K6502_ReadW<CoreMapper>(VECTOR_IRQ);
       CLK(7);
-      break;
+      NEXT;
 
-    case 0x01: // ORA (Zpg,X)
+    OP(0x01): // ORA (Zpg,X)
       ORA(A_IX);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x05: // ORA Zpg
+    OP(0x05): // ORA Zpg
       ORA(A_ZP);
       CLK(3);
-      break;
+      NEXT;
 
-    case 0x06: // ASL Zpg
+    OP(0x06): // ASL Zpg
       ASL(AA_ZP);
       CLK(5);
-      break;
+      NEXT;
 
-    case 0x08: // PHP
+    OP(0x08): // PHP
       SETF(FLAG_B);
-      PUSH(F);
+      PUSH(GETF());
       CLK(3);
-      break;
+      NEXT;
 
-    case 0x09: // ORA #Oper
+    OP(0x09): // ORA #Oper
       ORA(A_IMM);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0x0A: // ASL A
+    OP(0x0A): // ASL A
       ASLA;
       CLK(2);
-      break;
+      NEXT;
 
-    case 0x0D: // ORA Abs
+    OP(0x0D): // ORA Abs
       ORA(A_ABS);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x0e: // ASL Abs
+    OP(0x0E): // ASL Abs
       ASL(AA_ABS);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x10: // BPL Oper
-      BRA(!(F & FLAG_N));
-      break;
+    OP(0x10): // BPL Oper
+      BRA(!IS_N);
+      NEXT;
 
-    case 0x11: // ORA (Zpg),Y
+    OP(0x11): // ORA (Zpg),Y
       ORA(A_IY);
       CLK(5);
-      break;
+      NEXT;
 
-    case 0x15: // ORA Zpg,X
+    OP(0x15): // ORA Zpg,X
       ORA(A_ZPX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x16: // ASL Zpg,X
+    OP(0x16): // ASL Zpg,X
       ASL(AA_ZPX);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x18: // CLC
+    OP(0x18): // CLC
       RSTF(FLAG_C);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0x19: // ORA Abs,Y
+    OP(0x19): // ORA Abs,Y
       ORA(A_ABSY);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x1D: // ORA Abs,X
+    OP(0x1D): // ORA Abs,X
       ORA(A_ABSX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x1E: // ASL Abs,X
+    OP(0x1E): // ASL Abs,X
       ASL(AA_ABSX);
       CLK(7);
-      break;
+      NEXT;
 
-    case 0x20: // JSR Abs
+    OP(0x20): // JSR Abs
       JSR;
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x21: // AND (Zpg,X)
+    OP(0x21): // AND (Zpg,X)
       AND(A_IX);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x24: // BIT Zpg
+    OP(0x24): // BIT Zpg
       BIT(A_ZP);
       CLK(3);
-      break;
+      NEXT;
 
-    case 0x25: // AND Zpg
+    OP(0x25): // AND Zpg
       AND(A_ZP);
       CLK(3);
-      break;
+      NEXT;
 
-    case 0x26: // ROL Zpg
+    OP(0x26): // ROL Zpg
       ROL(AA_ZP);
       CLK(5);
-      break;
+      NEXT;
 
-    case 0x28: // PLP
+    OP(0x28): // PLP
       POP(F);
       SETF(FLAG_R);
+      LOADNZ();
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x29: // AND #Oper
+    OP(0x29): // AND #Oper
       AND(A_IMM);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0x2A: // ROL A
+    OP(0x2A): // ROL A
       ROLA;
       CLK(2);
-      break;
+      NEXT;
 
-    case 0x2C: // BIT Abs
+    OP(0x2C): // BIT Abs
       BIT(A_ABS);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x2D: // AND Abs
+    OP(0x2D): // AND Abs
       AND(A_ABS);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x2E: // ROL Abs
+    OP(0x2E): // ROL Abs
       ROL(AA_ABS);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x30: // BMI Oper
-      BRA(F & FLAG_N);
-      break;
+    OP(0x30): // BMI Oper
+      BRA(IS_N);
+      NEXT;
 
-    case 0x31: // AND (Zpg),Y
+    OP(0x31): // AND (Zpg),Y
       AND(A_IY);
       CLK(5);
-      break;
+      NEXT;
 
-    case 0x35: // AND Zpg,X
+    OP(0x35): // AND Zpg,X
       AND(A_ZPX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x36: // ROL Zpg,X
+    OP(0x36): // ROL Zpg,X
       ROL(AA_ZPX);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x38: // SEC
+    OP(0x38): // SEC
       SETF(FLAG_C);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0x39: // AND Abs,Y
+    OP(0x39): // AND Abs,Y
       AND(A_ABSY);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x3D: // AND Abs,X
+    OP(0x3D): // AND Abs,X
       AND(A_ABSX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x3E: // ROL Abs,X
+    OP(0x3E): // ROL Abs,X
       ROL(AA_ABSX);
       CLK(7);
-      break;
+      NEXT;
 
-    case 0x40: // RTI
+    OP(0x40): // RTI
       POP(F);
       SETF(FLAG_R);
+      LOADNZ();
       POPW(PC);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x41: // EOR (Zpg,X)
+    OP(0x41): // EOR (Zpg,X)
       EOR(A_IX);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x45: // EOR Zpg
+    OP(0x45): // EOR Zpg
       EOR(A_ZP);
       CLK(3);
-      break;
+      NEXT;
 
-    case 0x46: // LSR Zpg
+    OP(0x46): // LSR Zpg
       LSR(AA_ZP);
       CLK(5);
-      break;
+      NEXT;
 
-    case 0x48: // PHA
+    OP(0x48): // PHA
       PUSH(A);
       CLK(3);
-      break;
+      NEXT;
 
-    case 0x49: // EOR #Oper
+    OP(0x49): // EOR #Oper
       EOR(A_IMM);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0x4A: // LSR A
+    OP(0x4A): // LSR A
       LSRA;
       CLK(2);
-      break;
+      NEXT;
 
-    case 0x4C: // JMP Abs
+    OP(0x4C): // JMP Abs
 #if 0
       JMP(AA_ABS);
       CLK(3);
@@ -737,11 +2249,13 @@ static void __not_in_flash_func(step)(int wClocks)
       if (addr == PC - 3)
       {
         JMP(addr);
+        auto preClocks = wPassedClocks;
         do
         {
           CLK(3);
-        } while (g_wPassedClocks < wClocks);
-        break;
+        } while (wPassedClocks < wClocks);
+        g_dwIdleClocks += wPassedClocks - preClocks;
+        NEXT;
       }
       else
       {
@@ -750,38 +2264,38 @@ static void __not_in_flash_func(step)(int wClocks)
       }
     }
 #endif
-      break;
+      NEXT;
 
-    case 0x4D: // EOR Abs
+    OP(0x4D): // EOR Abs
       EOR(A_ABS);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x4E: // LSR Abs
+    OP(0x4E): // LSR Abs
       LSR(AA_ABS);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x50: // BVC
+    OP(0x50): // BVC
       BRA(!(F & FLAG_V));
-      break;
+      NEXT;
 
-    case 0x51: // EOR (Zpg),Y
+    OP(0x51): // EOR (Zpg),Y
       EOR(A_IY);
       CLK(5);
-      break;
+      NEXT;
 
-    case 0x55: // EOR Zpg,X
+    OP(0x55): // EOR Zpg,X
       EOR(A_ZPX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x56: // LSR Zpg,X
+    OP(0x56): // LSR Zpg,X
       LSR(AA_ZPX);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x58: // CLI
+    OP(0x58): // CLI
       byD0 = F;
       RSTF(FLAG_I);
       CLK(2);
@@ -791,637 +2305,1449 @@ static void __not_in_flash_func(step)(int wClocks)
         CLK(7);
 
         PUSHW(PC);
-        PUSH(F & ~FLAG_B);
+        PUSH(GETF() & ~FLAG_B);
 
         RSTF(FLAG_D);
         SETF(FLAG_I);
 
-        PC = K6502_ReadW(VECTOR_IRQ);
+        PC = K6502_ReadW<CoreMapper>(VECTOR_IRQ);
       }
-      break;
+      NEXT;
 
-    case 0x59: // EOR Abs,Y
+    OP(0x59): // EOR Abs,Y
       EOR(A_ABSY);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x5D: // EOR Abs,X
+    OP(0x5D): // EOR Abs,X
       EOR(A_ABSX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x5E: // LSR Abs,X
+    OP(0x5E): // LSR Abs,X
       LSR(AA_ABSX);
       CLK(7);
-      break;
+      NEXT;
 
-    case 0x60: // RTS
+    OP(0x60): // RTS
       POPW(PC);
       ++PC;
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x61: // ADC (Zpg,X)
+    OP(0x61): // ADC (Zpg,X)
       ADC(A_IX);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x65: // ADC Zpg
+    OP(0x65): // ADC Zpg
       ADC(A_ZP);
       CLK(3);
-      break;
+      NEXT;
 
-    case 0x66: // ROR Zpg
+    OP(0x66): // ROR Zpg
       ROR(AA_ZP);
       CLK(5);
-      break;
+      NEXT;
 
-    case 0x68: // PLA
+    OP(0x68): // PLA
       POP(A);
       TEST(A);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x69: // ADC #Oper
+    OP(0x69): // ADC #Oper
       ADC(A_IMM);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0x6A: // ROR A
+    OP(0x6A): // ROR A
       RORA;
       CLK(2);
-      break;
+      NEXT;
 
-    case 0x6C: // JMP (Abs)
-      JMP(K6502_ReadW2(AA_ABS));
+    OP(0x6C): // JMP (Abs)
+      JMP(K6502_ReadW2<CoreMapper>(AA_ABS));
       CLK(5);
-      break;
+      NEXT;
 
-    case 0x6D: // ADC Abs
+    OP(0x6D): // ADC Abs
       ADC(A_ABS);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x6E: // ROR Abs
+    OP(0x6E): // ROR Abs
       ROR(AA_ABS);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x70: // BVS
+    OP(0x70): // BVS
       BRA(F & FLAG_V);
-      break;
+      NEXT;
 
-    case 0x71: // ADC (Zpg),Y
+    OP(0x71): // ADC (Zpg),Y
       ADC(A_IY);
       CLK(5);
-      break;
+      NEXT;
 
-    case 0x75: // ADC Zpg,X
+    OP(0x75): // ADC Zpg,X
       ADC(A_ZPX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x76: // ROR Zpg,X
+    OP(0x76): // ROR Zpg,X
       ROR(AA_ZPX);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x78: // SEI
+    OP(0x78): // SEI
       SETF(FLAG_I);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0x79: // ADC Abs,Y
+    OP(0x79): // ADC Abs,Y
       ADC(A_ABSY);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x7D: // ADC Abs,X
+    OP(0x7D): // ADC Abs,X
       ADC(A_ABSX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x7E: // ROR Abs,X
+    OP(0x7E): // ROR Abs,X
       ROR(AA_ABSX);
       CLK(7);
-      break;
+      NEXT;
 
-    case 0x81: // STA (Zpg,X)
+    OP(0x81): // STA (Zpg,X)
       STA(AA_IX);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x84: // STY Zpg
+    OP(0x84): // STY Zpg
       STY(AA_ZP);
       CLK(3);
-      break;
+      NEXT;
 
-    case 0x85: // STA Zpg
+    OP(0x85): // STA Zpg
       STA(AA_ZP);
       CLK(3);
-      break;
+      NEXT;
 
-    case 0x86: // STX Zpg
+    OP(0x86): // STX Zpg
       STX(AA_ZP);
       CLK(3);
-      break;
+      NEXT;
 
-    case 0x88: // DEY
+    OP(0x88): // DEY
       --Y;
       TEST(Y);
       CLK(2);
-      break;
+      NEXT_FUSED(0xD0); // DEY; BNE
 
-    case 0x8A: // TXA
+    OP(0x8A): // TXA
       A = X;
       TEST(A);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0x8C: // STY Abs
+    OP(0x8C): // STY Abs
       STY(AA_ABS);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x8D: // STA Abs
+    OP(0x8D): // STA Abs
+      FUSED(0x8D)
       STA(AA_ABS);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x8E: // STX Abs
+    OP(0x8E): // STX Abs
       STX(AA_ABS);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x90: // BCC
+    OP(0x90): // BCC
       BRA(!(F & FLAG_C));
-      break;
+      NEXT;
 
-    case 0x91: // STA (Zpg),Y
+    OP(0x91): // STA (Zpg),Y
       STA(AA_IY);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x94: // STY Zpg,X
+    OP(0x94): // STY Zpg,X
       STY(AA_ZPX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x95: // STA Zpg,X
+    OP(0x95): // STA Zpg,X
       STA(AA_ZPX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x96: // STX Zpg,Y
+    OP(0x96): // STX Zpg,Y
       STX(AA_ZPY);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x98: // TYA
+    OP(0x98): // TYA
       A = Y;
       TEST(A);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0x99: // STA Abs,Y
+    OP(0x99): // STA Abs,Y
       STA(AA_ABSY);
       CLK(5);
-      break;
+      NEXT;
 
-    case 0x9A: // TXS
+    OP(0x9A): // TXS
       SP = X;
       CLK(2);
-      break;
+      NEXT;
 
-    case 0x9D: // STA Abs,X
+    OP(0x9D): // STA Abs,X
       STA(AA_ABSX);
       CLK(5);
-      break;
+      NEXT;
 
-    case 0xA0: // LDY #Oper
+    OP(0xA0): // LDY #Oper
       LDY(A_IMM);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0xA1: // LDA (Zpg,X)
+    OP(0xA1): // LDA (Zpg,X)
       LDA(A_IX);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0xA2: // LDX #Oper
+    OP(0xA2): // LDX #Oper
       LDX(A_IMM);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0xA4: // LDY Zpg
+    OP(0xA4): // LDY Zpg
       LDY(A_ZP);
       CLK(3);
-      break;
+      NEXT;
 
-    case 0xA5: // LDA Zpg
+    OP(0xA5): // LDA Zpg
       LDA(A_ZP);
       CLK(3);
-      break;
+      NEXT_FUSED(0x8D); // LDA Zpg; STA Abs
 
-    case 0xA6: // LDX Zpg
+    OP(0xA6): // LDX Zpg
       LDX(A_ZP);
       CLK(3);
-      break;
+      NEXT;
 
-    case 0xA8: // TAY
+    OP(0xA8): // TAY
       Y = A;
       TEST(A);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0xA9: // LDA #Oper
+    OP(0xA9): // LDA #Oper
       LDA(A_IMM);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0xAA: // TAX
+    OP(0xAA): // TAX
       X = A;
       TEST(A);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0xAC: // LDY Abs
+    OP(0xAC): // LDY Abs
       LDY(A_ABS);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0xAD: // LDA Abs
+    OP(0xAD): // LDA Abs
       LDA(A_ABS);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0xAE: // LDX Abs
+    OP(0xAE): // LDX Abs
       LDX(A_ABS);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0xB0: // BCS
+    OP(0xB0): // BCS
       BRA(F & FLAG_C);
-      break;
+      NEXT;
 
-    case 0xB1: // LDA (Zpg),Y
+    OP(0xB1): // LDA (Zpg),Y
       LDA(A_IY);
       CLK(5);
-      break;
+      NEXT;
 
-    case 0xB4: // LDY Zpg,X
+    OP(0xB4): // LDY Zpg,X
       LDY(A_ZPX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0xB5: // LDA Zpg,X
+    OP(0xB5): // LDA Zpg,X
       LDA(A_ZPX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0xB6: // LDX Zpg,Y
+    OP(0xB6): // LDX Zpg,Y
       LDX(A_ZPY);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0xB8: // CLV
+    OP(0xB8): // CLV
       RSTF(FLAG_V);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0xB9: // LDA Abs,Y
+    OP(0xB9): // LDA Abs,Y
       LDA(A_ABSY);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0xBA: // TSX
+    OP(0xBA): // TSX
       X = SP;
       TEST(X);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0xBC: // LDY Abs,X
+    OP(0xBC): // LDY Abs,X
       LDY(A_ABSX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0xBD: // LDA Abs,X
+    OP(0xBD): // LDA Abs,X
       LDA(A_ABSX);
       CLK(4);
-      break;
+      NEXT_FUSED(0x8D); // LDA Abs,X; STA Abs ( $2007 )
 
-    case 0xBE: // LDX Abs,Y
+    OP(0xBE): // LDX Abs,Y
       LDX(A_ABSY);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0xC0: // CPY #Oper
+    OP(0xC0): // CPY #Oper
       CPY(A_IMM);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0xC1: // CMP (Zpg,X)
+    OP(0xC1): // CMP (Zpg,X)
       CMP(A_IX);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0xC4: // CPY Zpg
+    OP(0xC4): // CPY Zpg
       CPY(A_ZP);
       CLK(3);
-      break;
+      NEXT;
 
-    case 0xC5: // CMP Zpg
+    OP(0xC5): // CMP Zpg
       CMP(A_ZP);
       CLK(3);
-      break;
+      NEXT;
 
-    case 0xC6: // DEC Zpg
+    OP(0xC6): // DEC Zpg
       DEC(AA_ZP);
       CLK(5);
-      break;
+      NEXT;
 
-    case 0xC8: // INY
+    OP(0xC8): // INY
       ++Y;
       TEST(Y);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0xC9: // CMP #Oper
+    OP(0xC9): // CMP #Oper
       CMP(A_IMM);
       CLK(2);
+      NEXT;
+
+    OP(0xCA): // DEX
+      --X;
+      TEST(X);
+      CLK(2);
+      NEXT_FUSED(0xD0); // DEX; BNE
+
+    OP(0xCC): // CPY Abs
+      CPY(A_ABS);
+      CLK(4);
+      NEXT;
+
+    OP(0xCD): // CMP Abs
+      CMP(A_ABS);
+      CLK(4);
+      NEXT;
+
+    OP(0xCE): // DEC Abs
+      DEC(AA_ABS);
+      CLK(6);
+      NEXT;
+
+    OP(0xD0): // BNE
+      FUSED(0xD0)
+      BRA(!IS_Z);
+      NEXT;
+
+    OP(0xD1): // CMP (Zpg),Y
+      CMP(A_IY);
+      CLK(5);
+      NEXT;
+
+    OP(0xD5): // CMP Zpg,X
+      CMP(A_ZPX);
+      CLK(4);
+      NEXT;
+
+    OP(0xD6): // DEC Zpg,X
+      DEC(AA_ZPX);
+      CLK(6);
+      NEXT;
+
+    OP(0xD8): // CLD
+      RSTF(FLAG_D);
+      CLK(2);
+      NEXT;
+
+    OP(0xD9): // CMP Abs,Y
+      CMP(A_ABSY);
+      CLK(4);
+      NEXT;
+
+    OP(0xDD): // CMP Abs,X
+      CMP(A_ABSX);
+      CLK(4);
+      NEXT;
+
+    OP(0xDE): // DEC Abs,X
+      DEC(AA_ABSX);
+      CLK(7);
+      NEXT;
+
+    OP(0xE0): // CPX #Oper
+      CPX(A_IMM);
+      CLK(2);
+      NEXT;
+
+    OP(0xE1): // SBC (Zpg,X)
+      SBC(A_IX);
+      CLK(6);
+      NEXT;
+
+    OP(0xE4): // CPX Zpg
+      CPX(A_ZP);
+      CLK(3);
+      NEXT;
+
+    OP(0xE5): // SBC Zpg
+      SBC(A_ZP);
+      CLK(3);
+      NEXT;
+
+    OP(0xE6): // INC Zpg
+      INC(AA_ZP);
+      CLK(5);
+      NEXT_FUSED(0xD0); // INC Zpg; BNE
+
+    OP(0xE8): // INX
+      ++X;
+      TEST(X);
+      CLK(2);
+      NEXT;
+
+    OP(0xE9): // SBC #Oper
+      SBC(A_IMM);
+      CLK(2);
+      NEXT;
+
+    OP(0xEA): // NOP
+      CLK(2);
+      NEXT;
+
+    OP(0xEC): // CPX Abs
+      CPX(A_ABS);
+      CLK(4);
+      NEXT;
+
+    OP(0xED): // SBC Abs
+      SBC(A_ABS);
+      CLK(4);
+      NEXT;
+
+    OP(0xEE): // INC Abs
+      INC(AA_ABS);
+      CLK(6);
+      NEXT;
+
+    OP(0xF0): // BEQ
+      BRA(IS_Z);
+      NEXT;
+
+    OP(0xF1): // SBC (Zpg),Y
+      SBC(A_IY);
+      CLK(5);
+      NEXT;
+
+    OP(0xF5): // SBC Zpg,X
+      SBC(A_ZPX);
+      CLK(4);
+      NEXT;
+
+    OP(0xF6): // INC Zpg,X
+      INC(AA_ZPX);
+      CLK(6);
+      NEXT;
+
+    OP(0xF8): // SED
+      SETF(FLAG_D);
+      CLK(2);
+      NEXT;
+
+    OP(0xF9): // SBC Abs,Y
+      SBC(A_ABSY);
+      CLK(4);
+      NEXT;
+
+    OP(0xFD): // SBC Abs,X
+      SBC(A_ABSX);
+      CLK(4);
+      NEXT;
+
+    OP(0xFE): // INC Abs,X
+      INC(AA_ABSX);
+      CLK(7);
+      NEXT;
+
+      /*-----------------------------------------------------------*/
+      /*  Unlisted Instructions ( thanks to virtualnes )           */
+      /*-----------------------------------------------------------*/
+
+    OP(0x1A): // NOP (Unofficial)
+    OP(0x3A): // NOP (Unofficial)
+    OP(0x5A): // NOP (Unofficial)
+    OP(0x7A): // NOP (Unofficial)
+    OP(0xDA): // NOP (Unofficial)
+    OP(0xFA): // NOP (Unofficial)
+      CLK(2);
+      NEXT;
+
+    OP(0x80): // DOP (CYCLES 2)
+    OP(0x82): // DOP (CYCLES 2)
+    OP(0x89): // DOP (CYCLES 2)
+    OP(0xC2): // DOP (CYCLES 2)
+    OP(0xE2): // DOP (CYCLES 2)
+      PC++;
+      CLK(2);
+      NEXT;
+
+    OP(0x04): // DOP (CYCLES 3)
+    OP(0x44): // DOP (CYCLES 3)
+    OP(0x64): // DOP (CYCLES 3)
+      PC++;
+      CLK(3);
+      NEXT;
+
+    OP(0x14): // DOP (CYCLES 4)
+    OP(0x34): // DOP (CYCLES 4)
+    OP(0x54): // DOP (CYCLES 4)
+    OP(0x74): // DOP (CYCLES 4)
+    OP(0xD4): // DOP (CYCLES 4)
+    OP(0xF4): // DOP (CYCLES 4)
+      PC++;
+      CLK(4);
+      NEXT;
+
+    OP(0x0C): // TOP
+    OP(0x1C): // TOP
+    OP(0x3C): // TOP
+    OP(0x5C): // TOP
+    OP(0x7C): // TOP
+    OP(0xDC): // TOP
+    OP(0xFC): // TOP
+      PC += 2;
+      CLK(4);
+      NEXT;
+
+    OP_DEFAULT: // Unknown Instruction
+      CLK(2);
+#if 0
+        InfoNES_MessageBox( "0x%02x is unknown instruction.\n", byCode ) ;
+#endif
+      NEXT;
+
+#if K6502_THREADED_DISPATCH
+  }
+op_end:
+#else
+    } /* end of switch ( byCode ) */
+
+  } /* end of while ... */
+#endif
+
+#if K6502_LAZY_FLAGS
+  // F is complete between slices
+  F = GETF();
+#endif
+
+#if K6502_DECODE_CACHE
+  g_dwDecodeHits += dwDecodeHits;
+#endif
+#if K6502_FUSION
+  g_dwFusedDispatches += dwFusedDispatches;
+#endif
+
+  SAVE_CONTEXT();
+}
+
+// The interpreter of the mapper in use
+static void (*g_pRun)(int wClocks, int wStop) = run<K6502_MapperAny>;
+
+#if K6502_BLOCK_CACHE
+static void runBlocks(int wClocks);
+#endif
+#if K6502_AOT
+static void runAot(int wClocks);
+#endif
+
+static void __not_in_flash_func(step)(int wClocks)
+{
+  /*
+ *  Only the specified number of the clocks execute Op.
+ *
+ *  Parameters
+ *    WORD wClocks              (Read)
+ *      The number of the clocks
+ */
+
+  // Events run between slices, so a loop seen in a former slice is stale
+  g_IdleLoop.wBranch = 0;
+
+#if K6502_AOT
+  if (g_pAotGame)
+    runAot(wClocks);
+  else
+#endif
+#if K6502_BLOCK_CACHE
+  runBlocks(wClocks);
+#else
+  g_pRun(wClocks, wClocks);
+#endif
+
+  // Correct the number of the clocks
+  g_qwBaseClocks += wClocks;
+  g_Context.wPassedClocks -= wClocks;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*  K6502_Step() :                                                   */
+/*          Only the specified number of the clocks execute Op.      */
+/*                                                                   */
+/*===================================================================*/
+void __not_in_flash_func(K6502_Step)(int wClocks)
+{
+  if (NMI_State != NMI_Wiring)
+  {
+    // NMI前に少し実行したい
+    step(7);
+    wClocks -= 7;
+  }
+  procNMI();
+  step(wClocks);
+}
+
+#if K6502_AOT
+/*===================================================================*/
+/*                                                                   */
+/*                  6502 Recompiled ROM code ( AOT )                 */
+/*                                                                   */
+/*===================================================================*/
+
+// Read an indexed address, a clock more when a page is crossed
+#define AOT_INDEXED(base, index)                                    \
+  (wEA = (base), wPassedClocks += (((wEA + (index)) ^ wEA) >> 8) & 1, \
+   K6502_Read((WORD)(wEA + (index))))
+
+// An entry ( every instruction of a block ), and a block that others jump to
+#define AOT_BLOCK(n) case (n):
+#define AOT_TARGET(n) aot_##n:
+
+// An instruction, it stops the block at the end of the slice
+#define AOT_OP(wPC, byCode)          \
+  if (wPassedClocks >= wClocks)      \
+  {                                  \
+    PC = (wPC);                      \
+    break;                           \
+  }                                  \
+  ++dwInstructions;                  \
+  PROFILE(wPC, byCode);              \
+  TRACE(wPC, byCode, wPassedClocks); \
+  K6502_INSTRUCTION_HOOK(byCode)
+
+// Go on to a block in the same bank, or look the next one up
+#define AOT_CHAIN(n) goto aot_##n
+#define AOT_LOOKUP() continue
+
+/*===================================================================*/
+/*                                                                   */
+/*            aotLookup() : Look a recompiled block up               */
+/*                                                                   */
+/*===================================================================*/
+static int __not_in_flash_func(aotLookup)(WORD wPC)
+{
+  /*
+ *  Look a recompiled block up
+ *
+ *  Parameters
+ *    WORD wPC                  (Read)
+ *      The address
+ *
+ *  Return values
+ *    The block, or -1 when the interpreter runs the address
+ */
+
+  if (wPC < 0x8000)
+    return -1;
+
+  int nBank = K6502_PrgBank((wPC >> 13) & 3);
+  if (nBank < 0)
+    return -1;
+
+  // Binary search
+  DWORD dwKey = (DWORD)nBank << 16 | wPC;
+  int nLow = g_pAotGame->nFirst;
+  int nHigh = nLow + g_pAotGame->nBlocks;
+  const int nEnd = nHigh;
+  while (nLow < nHigh)
+  {
+    int nMid = (nLow + nHigh) >> 1;
+    if (g_dwAotKeys[nMid] < dwKey)
+      nLow = nMid + 1;
+    else
+      nHigh = nMid;
+  }
+  return nLow < nEnd && g_dwAotKeys[nLow] == dwKey ? nLow : -1;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*            aotChain() : Run recompiled blocks                     */
+/*                                                                   */
+/*===================================================================*/
+static int __not_in_flash_func(aotChain)(int wClocks)
+{
+  /*
+ *  Run recompiled blocks
+ *
+ *  Parameters
+ *    int wClocks               (Read)
+ *      The end of the slice
+ *
+ *  Return values
+ *    The clocks that the interpreter runs to
+ *
+ *  Remarks
+ *    Every instruction checks the end of the slice as the interpreter
+ *    does, so the slice ends on the same instruction, and the next
+ *    slice enters the block again at that instruction.
+ *    Addresses without a block go to the interpreter for
+ *    AOT_FALLBACK_CLOCKS.
+ */
+
+  LOAD_CONTEXT();
+
+  WORD wA0;
+  BYTE byD0;
+  BYTE byD1;
+  WORD wD0;
+  WORD wEA;
+
+  DWORD dwInstructions = 0;
+  int wStop = wClocks;
+
+  while (wPassedClocks < wClocks)
+  {
+    int nBlock = aotLookup(PC);
+    if (nBlock < 0)
+    {
+      ++g_dwAotMisses;
+      if (wPassedClocks + AOT_FALLBACK_CLOCKS < wClocks)
+        wStop = wPassedClocks + AOT_FALLBACK_CLOCKS;
       break;
+    }
+
+    switch (nBlock)
+    {
+#include K6502_AOT_FILE
+    }
+  }
+
+  g_dwAotInstructions += dwInstructions;
+
+#if K6502_LAZY_FLAGS
+  // F is complete between slices
+  F = GETF();
+#endif
+
+  SAVE_CONTEXT();
+  return wStop;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*     runAot() : Run a slice from recompiled code and interpreter   */
+/*                                                                   */
+/*===================================================================*/
+static void __not_in_flash_func(runAot)(int wClocks)
+{
+  /*
+ *  Run a slice from recompiled code and the interpreter
+ *
+ *  Parameters
+ *    int wClocks               (Read)
+ *      The end of the slice
+ */
 
-    case 0xCA: // DEX
-      --X;
-      TEST(X);
-      CLK(2);
-      break;
+  while (g_Context.wPassedClocks < wClocks)
+  {
+    int wStop = aotChain(wClocks);
+    if (g_Context.wPassedClocks < wStop)
+      g_pRun(wClocks, wStop);
+  }
+}
+#endif /* K6502_AOT */
 
-    case 0xCC: // CPY Abs
-      CPY(A_ABS);
-      CLK(4);
-      break;
+#if K6502_BLOCK_CACHE
+/*===================================================================*/
+/*                                                                   */
+/*                6502 Basic Block Cache ( micro-ops )               */
+/*                                                                   */
+/*===================================================================*/
 
-    case 0xCD: // CMP Abs
-      CMP(A_ABS);
-      CLK(4);
-      break;
+// Clocks of the micro-ops are added once per block,
+// so a write adds those of the micro-ops before it
+#undef WRITE_CLOCKS
+#define WRITE_CLOCKS (wPassedClocks + pUop->byClock)
+
+// Operands of the micro-ops : values ( UV_* ) and addresses ( UE_* )
+#define UV_IMM ((BYTE)pUop->wArg)
+#define UV_ZP K6502_ReadZp((BYTE)pUop->wArg)
+#define UV_ZPX K6502_ReadZp((BYTE)(pUop->wArg + X))
+#define UV_ZPY K6502_ReadZp((BYTE)(pUop->wArg + Y))
+#define UV_ABS K6502_Read(pUop->wArg)
+#define UV_ABSX UV_INDEXED(pUop->wArg, X)
+#define UV_ABSY UV_INDEXED(pUop->wArg, Y)
+#define UV_IX K6502_Read(K6502_ReadZpW((BYTE)(pUop->wArg + X)))
+#define UV_IY UV_INDEXED(K6502_ReadZpW((BYTE)pUop->wArg), Y)
+#define UE_ZP pUop->wArg
+#define UE_ZPX (BYTE)(pUop->wArg + X)
+#define UE_ZPY (BYTE)(pUop->wArg + Y)
+#define UE_ABS pUop->wArg
+#define UE_ABSX (WORD)(pUop->wArg + X)
+#define UE_ABSY (WORD)(pUop->wArg + Y)
+#define UE_IX K6502_ReadZpW((BYTE)(pUop->wArg + X))
+#define UE_IY (WORD)(K6502_ReadZpW((BYTE)pUop->wArg) + Y)
+
+// Read an indexed address, a clock more when a page is crossed
+#define UV_INDEXED(base, index)                                     \
+  (wEA = (base), wPassedClocks += (((wEA + (index)) ^ wEA) >> 8) & 1, \
+   K6502_Read((WORD)(wEA + (index))))
+
+#define UCASE(a) case (a):
+#define UCASE_NF(a) case (a) | UOP_NF:
 
-    case 0xCE: // DEC Abs
-      DEC(AA_ABS);
-      CLK(6);
-      break;
+/*===================================================================*/
+/*                                                                   */
+/*     blockTranslate() : Translate a basic block into micro-ops     */
+/*                                                                   */
+/*===================================================================*/
+static bool __not_in_flash_func(blockTranslate)(struct block_tag *pBlock, WORD wPC)
+{
+  /*
+ *  Translate a basic block into micro-ops
+ *
+ *  Parameters
+ *    struct block_tag *pBlock  (Write)
+ *      The block
+ *
+ *    WORD wPC                  (Read)
+ *      The address of the first instruction ( in ROM )
+ *
+ *  Return values
+ *    false when the first instruction is left to the interpreter
+ *
+ *  Remarks
+ *    A block ends with a branch, JMP, JSR or RTS, before an instruction
+ *    that is not translated ( BRK, RTI, CLI, JMP (Abs), unofficial ),
+ *    at the end of the bank, or after a write that may reach a mapper,
+ *    since it may switch the bank under the block.
+ *    Addresses and clocks are resolved here, and N and Z are not
+ *    computed for a micro-op when a later one sets them again.
+ */
 
-    case 0xD0: // BNE
-      BRA(!(F & FLAG_Z));
-      break;
+  const WORD wBank = wPC & 0xe000;
+  WORD wAddr = wPC;
+  int nUops = 0;
+  int nClocks = 0;
+  int nMaxClocks = 0;
+  struct block_uop_tag *pUop;
 
-    case 0xD1: // CMP (Zpg),Y
-      CMP(A_IY);
-      CLK(5);
-      break;
+  pBlock->byExit = BOP_NONE;
 
-    case 0xD5: // CMP Zpg,X
-      CMP(A_ZPX);
-      CLK(4);
-      break;
+  while (nUops < BLOCK_MAX_UOPS)
+  {
+    BYTE byCode = K6502_Read(wAddr);
+    const struct block_decode_tag *pDecode = &g_BlockDecode[byCode];
+    int nLength = g_byDecodeLength[byCode];
 
-    case 0xD6: // DEC Zpg,X
-      DEC(AA_ZPX);
-      CLK(6);
+    // The whole instruction has to be in the bank of the block
+    if (pDecode->byOp == BOP_NONE || ((wAddr + nLength - 1) & 0xe000) != wBank)
       break;
 
-    case 0xD8: // CLD
-      RSTF(FLAG_D);
-      CLK(2);
-      break;
+    WORD wArg = 0;
+    if (nLength == 3)
+      wArg = K6502_ReadW(wAddr + 1);
+    else if (nLength == 2)
+      wArg = K6502_Read(wAddr + 1);
 
-    case 0xD9: // CMP Abs,Y
-      CMP(A_ABSY);
-      CLK(4);
-      break;
+    if (BOP_IS_EXIT(pDecode->byOp))
+    {
+      // JMP to itself is left to the interpreter, which counts idle clocks
+      if (pDecode->byOp == BOP_JMP && wArg == wAddr)
+        break;
 
-    case 0xDD: // CMP Abs,X
-      CMP(A_ABSX);
-      CLK(4);
-      break;
+      pBlock->byExit = pDecode->byOp;
+      pBlock->byExitCode = byCode;
+      pBlock->wTarget = wArg;
+      wAddr += nLength;
 
-    case 0xDE: // DEC Abs,X
-      DEC(AA_ABSX);
-      CLK(7);
+      if (pDecode->byOp == BOP_BRANCH)
+      {
+        // As BRA(), a page is crossed between the operand and the target - 1
+        WORD wTarget = wAddr - 1 + (int8_t)wArg;
+        pBlock->byTakenClocks = 3 + (((wAddr - 1) & 0x0100) != (wTarget & 0x0100));
+        pBlock->wTarget = wTarget + 1;
+      }
       break;
+    }
 
-    case 0xE0: // CPX #Oper
-      CPX(A_IMM);
-      CLK(2);
-      break;
+    pUop = &pBlock->Uops[nUops++];
+    pUop->wOp = byCode;
+    pUop->wArg = wArg;
+    pUop->byClock = nClocks;
+#if K6502_PROFILE || K6502_TRACE
+    pUop->wPC = wAddr;
+#endif
 
-    case 0xE1: // SBC (Zpg,X)
-      SBC(A_IX);
-      CLK(6);
-      break;
+    nClocks += pDecode->byClocks;
+    nMaxClocks += pDecode->byClocks;
+    if (pDecode->byOp <= BOP_BIT &&
+        (pDecode->byMode == BAM_ABSX || pDecode->byMode == BAM_ABSY || pDecode->byMode == BAM_IY))
+      ++nMaxClocks;
+    wAddr += nLength;
 
-    case 0xE4: // CPX Zpg
-      CPX(A_ZP);
-      CLK(3);
+    // Stop after a write that may reach a mapper ( 0x4018 - 0xffff )
+    if (BOP_IS_ADDRESS(pDecode->byOp) &&
+        !(pDecode->byMode == BAM_ZP || pDecode->byMode == BAM_ZPX || pDecode->byMode == BAM_ZPY ||
+          (pDecode->byMode == BAM_ABS && wArg < 0x4018) ||
+          ((pDecode->byMode == BAM_ABSX || pDecode->byMode == BAM_ABSY) && wArg < 0x4018 - 0xff)))
       break;
+  }
 
-    case 0xE5: // SBC Zpg
-      SBC(A_ZP);
-      CLK(3);
-      break;
+  if (nUops == 0 && pBlock->byExit == BOP_NONE)
+  {
+    pBlock->wPC = 0;
+    return false;
+  }
 
-    case 0xE6: // INC Zpg
-      INC(AA_ZP);
-      CLK(5);
+  // Prune N and Z that a later micro-op sets again ( they are live at the end )
+  bool bNZLive = true;
+  for (int nUop = nUops - 1; nUop >= 0; --nUop)
+  {
+    pUop = &pBlock->Uops[nUop];
+    switch (g_BlockDecode[pUop->wOp].byOp)
+    {
+    case BOP_LDA: case BOP_LDX: case BOP_LDY: case BOP_ORA: case BOP_AND: case BOP_EOR:
+    case BOP_INC: case BOP_DEC: case BOP_INX: case BOP_INY: case BOP_DEX: case BOP_DEY:
+    case BOP_TAX: case BOP_TXA: case BOP_TAY: case BOP_TYA: case BOP_TSX: case BOP_PLA:
+      // Set N and Z only
+      if (!bNZLive)
+        pUop->wOp |= UOP_NF;
+      bNZLive = false;
       break;
 
-    case 0xE8: // INX
-      ++X;
-      TEST(X);
-      CLK(2);
+    case BOP_ADC: case BOP_SBC: case BOP_CMP: case BOP_CPX: case BOP_CPY: case BOP_BIT:
+    case BOP_ASL: case BOP_LSR: case BOP_ROL: case BOP_ROR:
+    case BOP_ASLA: case BOP_LSRA: case BOP_ROLA: case BOP_RORA: case BOP_PLP:
+      // Set N and Z with other flags
+      bNZLive = false;
       break;
 
-    case 0xE9: // SBC #Oper
-      SBC(A_IMM);
-      CLK(2);
+    case BOP_PHP:
+      // Read all flags
+      bNZLive = true;
       break;
+    }
+  }
 
-    case 0xEA: // NOP
-      CLK(2);
-      break;
+  pBlock->wPC = wPC;
+  pBlock->byGen = g_byDecodeGen[(wPC >> 13) & 3];
+  pBlock->byUops = nUops;
+  pBlock->byClocks = nClocks;
+  pBlock->byMaxClocks = nMaxClocks;
+  pBlock->wNext = wAddr;
 
-    case 0xEC: // CPX Abs
-      CPX(A_ABS);
-      CLK(4);
-      break;
+  ++g_dwBlockTranslations;
+  return true;
+}
 
-    case 0xED: // SBC Abs
-      SBC(A_ABS);
-      CLK(4);
-      break;
+/*===================================================================*/
+/*                                                                   */
+/*          blockChain() : Run blocks from the block cache           */
+/*                                                                   */
+/*===================================================================*/
+static int __not_in_flash_func(blockChain)(int wClocks)
+{
+  /*
+ *  Run blocks from the block cache
+ *
+ *  Parameters
+ *    int wClocks               (Read)
+ *      The end of the slice
+ *
+ *  Return values
+ *    The clocks that the interpreter runs to
+ *
+ *  Remarks
+ *    A block runs only when the interpreter would run all of it in
+ *    this slice, so the slice ends on the same instruction.
+ *    Code in RAM and instructions that are not translated go to the
+ *    interpreter for BLOCK_FALLBACK_CLOCKS, the end of a slice that
+ *    a block does not fit goes to the interpreter as a whole.
+ */
 
-    case 0xEE: // INC Abs
-      INC(AA_ABS);
-      CLK(6);
-      break;
+  LOAD_CONTEXT();
 
-    case 0xF0: // BEQ
-      BRA(F & FLAG_Z);
-      break;
+  WORD wA0;
+  BYTE byD0;
+  BYTE byD1;
+  WORD wD0;
+  WORD wEA;
 
-    case 0xF1: // SBC (Zpg),Y
-      SBC(A_IY);
-      CLK(5);
-      break;
+  DWORD dwRuns = g_dwBlockRuns;
+  DWORD dwInstructions = 0;
+  int wStop = wClocks;
 
-    case 0xF5: // SBC Zpg,X
-      SBC(A_ZPX);
-      CLK(4);
-      break;
+  while (wPassedClocks < wClocks)
+  {
+    // Look the block up ( translate it into the least recently used way )
+    struct block_tag *pBlock = NULL;
+    if (PC >= 0x8000)
+    {
+      struct block_tag *pSet = g_Blocks[BLOCK_SET(PC)];
+      struct block_tag *pVictim = &pSet[0];
+      BYTE byGen = g_byDecodeGen[(PC >> 13) & 3];
 
-    case 0xF6: // INC Zpg,X
-      INC(AA_ZPX);
-      CLK(6);
-      break;
+      for (int nWay = 0; nWay < BLOCK_WAYS; ++nWay)
+      {
+        if (pSet[nWay].wPC == PC && pSet[nWay].byGen == byGen)
+        {
+          pBlock = &pSet[nWay];
+          break;
+        }
+        if (pSet[nWay].dwUsed < pVictim->dwUsed)
+          pVictim = &pSet[nWay];
+      }
+      if (!pBlock && blockTranslate(pVictim, PC))
+        pBlock = pVictim;
+    }
 
-    case 0xF8: // SED
-      SETF(FLAG_D);
-      CLK(2);
+    if (!pBlock)
+    {
+      if (wPassedClocks + BLOCK_FALLBACK_CLOCKS < wClocks)
+        wStop = wPassedClocks + BLOCK_FALLBACK_CLOCKS;
       break;
-
-    case 0xF9: // SBC Abs,Y
-      SBC(A_ABSY);
-      CLK(4);
+    }
+    if (wPassedClocks + pBlock->byMaxClocks >= wClocks)
       break;
 
-    case 0xFD: // SBC Abs,X
-      SBC(A_ABSX);
-      CLK(4);
-      break;
+    pBlock->dwUsed = ++dwRuns;
 
-    case 0xFE: // INC Abs,X
-      INC(AA_ABSX);
-      CLK(7);
-      break;
+    // Micro-ops
+    const struct block_uop_tag *pUop = pBlock->Uops;
+    const struct block_uop_tag *pEnd = pUop + pBlock->byUops;
+    for (; pUop < pEnd; ++pUop)
+    {
+      K6502_INSTRUCTION_HOOK((BYTE)pUop->wOp);
+      PROFILE(pUop->wPC, (BYTE)pUop->wOp);
+      TRACE(pUop->wPC, (BYTE)pUop->wOp, wPassedClocks + pUop->byClock);
 
-      /*-----------------------------------------------------------*/
-      /*  Unlisted Instructions ( thanks to virtualnes )           */
-      /*-----------------------------------------------------------*/
+      switch (pUop->wOp)
+      {
+      // clang-format off
+      UCASE(0x01) ORA(UV_IX); break;                               // ORA (Zpg,X)
+      UCASE_NF(0x01) A |= UV_IX; break;                            // ORA (Zpg,X)
+      UCASE(0x05) ORA(UV_ZP); break;                               // ORA Zpg
+      UCASE_NF(0x05) A |= UV_ZP; break;                            // ORA Zpg
+      UCASE(0x06) ASL(UE_ZP); break;                               // ASL Zpg
+      UCASE(0x08) SETF(FLAG_B); PUSH(GETF()); break;               // PHP
+      UCASE(0x09) ORA(UV_IMM); break;                              // ORA #Imm
+      UCASE_NF(0x09) A |= UV_IMM; break;                           // ORA #Imm
+      UCASE(0x0A) ASLA; break;                                     // ASL A
+      UCASE(0x0D) ORA(UV_ABS); break;                              // ORA Abs
+      UCASE_NF(0x0D) A |= UV_ABS; break;                           // ORA Abs
+      UCASE(0x0E) ASL(UE_ABS); break;                              // ASL Abs
+      UCASE(0x11) ORA(UV_IY); break;                               // ORA (Zpg),Y
+      UCASE_NF(0x11) A |= UV_IY; break;                            // ORA (Zpg),Y
+      UCASE(0x15) ORA(UV_ZPX); break;                              // ORA Zpg,X
+      UCASE_NF(0x15) A |= UV_ZPX; break;                           // ORA Zpg,X
+      UCASE(0x16) ASL(UE_ZPX); break;                              // ASL Zpg,X
+      UCASE(0x18) RSTF(FLAG_C); break;                             // CLC
+      UCASE(0x19) ORA(UV_ABSY); break;                             // ORA Abs,Y
+      UCASE_NF(0x19) A |= UV_ABSY; break;                          // ORA Abs,Y
+      UCASE(0x1D) ORA(UV_ABSX); break;                             // ORA Abs,X
+      UCASE_NF(0x1D) A |= UV_ABSX; break;                          // ORA Abs,X
+      UCASE(0x1E) ASL(UE_ABSX); break;                             // ASL Abs,X
+      UCASE(0x21) AND(UV_IX); break;                               // AND (Zpg,X)
+      UCASE_NF(0x21) A &= UV_IX; break;                            // AND (Zpg,X)
+      UCASE(0x24) BIT(UV_ZP); break;                               // BIT Zpg
+      UCASE(0x25) AND(UV_ZP); break;                               // AND Zpg
+      UCASE_NF(0x25) A &= UV_ZP; break;                            // AND Zpg
+      UCASE(0x26) ROL(UE_ZP); break;                               // ROL Zpg
+      UCASE(0x28) POP(F); SETF(FLAG_R); LOADNZ(); break;           // PLP
+      UCASE(0x29) AND(UV_IMM); break;                              // AND #Imm
+      UCASE_NF(0x29) A &= UV_IMM; break;                           // AND #Imm
+      UCASE(0x2A) ROLA; break;                                     // ROL A
+      UCASE(0x2C) BIT(UV_ABS); break;                              // BIT Abs
+      UCASE(0x2D) AND(UV_ABS); break;                              // AND Abs
+      UCASE_NF(0x2D) A &= UV_ABS; break;                           // AND Abs
+      UCASE(0x2E) ROL(UE_ABS); break;                              // ROL Abs
+      UCASE(0x31) AND(UV_IY); break;                               // AND (Zpg),Y
+      UCASE_NF(0x31) A &= UV_IY; break;                            // AND (Zpg),Y
+      UCASE(0x35) AND(UV_ZPX); break;                              // AND Zpg,X
+      UCASE_NF(0x35) A &= UV_ZPX; break;                           // AND Zpg,X
+      UCASE(0x36) ROL(UE_ZPX); break;                              // ROL Zpg,X
+      UCASE(0x38) SETF(FLAG_C); break;                             // SEC
+      UCASE(0x39) AND(UV_ABSY); break;                             // AND Abs,Y
+      UCASE_NF(0x39) A &= UV_ABSY; break;                          // AND Abs,Y
+      UCASE(0x3D) AND(UV_ABSX); break;                             // AND Abs,X
+      UCASE_NF(0x3D) A &= UV_ABSX; break;                          // AND Abs,X
+      UCASE(0x3E) ROL(UE_ABSX); break;                             // ROL Abs,X
+      UCASE(0x41) EOR(UV_IX); break;                               // EOR (Zpg,X)
+      UCASE_NF(0x41) A ^= UV_IX; break;                            // EOR (Zpg,X)
+      UCASE(0x45) EOR(UV_ZP); break;                               // EOR Zpg
+      UCASE_NF(0x45) A ^= UV_ZP; break;                            // EOR Zpg
+      UCASE(0x46) LSR(UE_ZP); break;                               // LSR Zpg
+      UCASE(0x48) PUSH(A); break;                                  // PHA
+      UCASE(0x49) EOR(UV_IMM); break;                              // EOR #Imm
+      UCASE_NF(0x49) A ^= UV_IMM; break;                           // EOR #Imm
+      UCASE(0x4A) LSRA; break;                                     // LSR A
+      UCASE(0x4D) EOR(UV_ABS); break;                              // EOR Abs
+      UCASE_NF(0x4D) A ^= UV_ABS; break;                           // EOR Abs
+      UCASE(0x4E) LSR(UE_ABS); break;                              // LSR Abs
+      UCASE(0x51) EOR(UV_IY); break;                               // EOR (Zpg),Y
+      UCASE_NF(0x51) A ^= UV_IY; break;                            // EOR (Zpg),Y
+      UCASE(0x55) EOR(UV_ZPX); break;                              // EOR Zpg,X
+      UCASE_NF(0x55) A ^= UV_ZPX; break;                           // EOR Zpg,X
+      UCASE(0x56) LSR(UE_ZPX); break;                              // LSR Zpg,X
+      UCASE(0x59) EOR(UV_ABSY); break;                             // EOR Abs,Y
+      UCASE_NF(0x59) A ^= UV_ABSY; break;                          // EOR Abs,Y
+      UCASE(0x5D) EOR(UV_ABSX); break;                             // EOR Abs,X
+      UCASE_NF(0x5D) A ^= UV_ABSX; break;                          // EOR Abs,X
+      UCASE(0x5E) LSR(UE_ABSX); break;                             // LSR Abs,X
+      UCASE(0x61) ADC(UV_IX); break;                               // ADC (Zpg,X)
+      UCASE(0x65) ADC(UV_ZP); break;                               // ADC Zpg
+      UCASE(0x66) ROR(UE_ZP); break;                               // ROR Zpg
+      UCASE(0x68) POP(A); TEST(A); break;                          // PLA
+      UCASE_NF(0x68) POP(A); break;                                // PLA
+      UCASE(0x69) ADC(UV_IMM); break;                              // ADC #Imm
+      UCASE(0x6A) RORA; break;                                     // ROR A
+      UCASE(0x6D) ADC(UV_ABS); break;                              // ADC Abs
+      UCASE(0x6E) ROR(UE_ABS); break;                              // ROR Abs
+      UCASE(0x71) ADC(UV_IY); break;                               // ADC (Zpg),Y
+      UCASE(0x75) ADC(UV_ZPX); break;                              // ADC Zpg,X
+      UCASE(0x76) ROR(UE_ZPX); break;                              // ROR Zpg,X
+      UCASE(0x78) SETF(FLAG_I); break;                             // SEI
+      UCASE(0x79) ADC(UV_ABSY); break;                             // ADC Abs,Y
+      UCASE(0x7D) ADC(UV_ABSX); break;                             // ADC Abs,X
+      UCASE(0x7E) ROR(UE_ABSX); break;                             // ROR Abs,X
+      UCASE(0x81) STA(UE_IX); break;                               // STA (Zpg,X)
+      UCASE(0x84) STY(UE_ZP); break;                               // STY Zpg
+      UCASE(0x85) STA(UE_ZP); break;                               // STA Zpg
+      UCASE(0x86) STX(UE_ZP); break;                               // STX Zpg
+      UCASE(0x88) --Y; TEST(Y); break;                             // DEY
+      UCASE_NF(0x88) --Y; break;                                   // DEY
+      UCASE(0x8A) A = X; TEST(A); break;                           // TXA
+      UCASE_NF(0x8A) A = X; break;                                 // TXA
+      UCASE(0x8C) STY(UE_ABS); break;                              // STY Abs
+      UCASE(0x8D) STA(UE_ABS); break;                              // STA Abs
+      UCASE(0x8E) STX(UE_ABS); break;                              // STX Abs
+      UCASE(0x91) STA(UE_IY); break;                               // STA (Zpg),Y
+      UCASE(0x94) STY(UE_ZPX); break;                              // STY Zpg,X
+      UCASE(0x95) STA(UE_ZPX); break;                              // STA Zpg,X
+      UCASE(0x96) STX(UE_ZPY); break;                              // STX Zpg,Y
+      UCASE(0x98) A = Y; TEST(A); break;                           // TYA
+      UCASE_NF(0x98) A = Y; break;                                 // TYA
+      UCASE(0x99) STA(UE_ABSY); break;                             // STA Abs,Y
+      UCASE(0x9A) SP = X; break;                                   // TXS
+      UCASE(0x9D) STA(UE_ABSX); break;                             // STA Abs,X
+      UCASE(0xA0) LDY(UV_IMM); break;                              // LDY #Imm
+      UCASE_NF(0xA0) Y = UV_IMM; break;                            // LDY #Imm
+      UCASE(0xA1) LDA(UV_IX); break;                               // LDA (Zpg,X)
+      UCASE_NF(0xA1) A = UV_IX; break;                             // LDA (Zpg,X)
+      UCASE(0xA2) LDX(UV_IMM); break;                              // LDX #Imm
+      UCASE_NF(0xA2) X = UV_IMM; break;                            // LDX #Imm
+      UCASE(0xA4) LDY(UV_ZP); break;                               // LDY Zpg
+      UCASE_NF(0xA4) Y = UV_ZP; break;                             // LDY Zpg
+      UCASE(0xA5) LDA(UV_ZP); break;                               // LDA Zpg
+      UCASE_NF(0xA5) A = UV_ZP; break;                             // LDA Zpg
+      UCASE(0xA6) LDX(UV_ZP); break;                               // LDX Zpg
+      UCASE_NF(0xA6) X = UV_ZP; break;                             // LDX Zpg
+      UCASE(0xA8) Y = A; TEST(Y); break;                           // TAY
+      UCASE_NF(0xA8) Y = A; break;                                 // TAY
+      UCASE(0xA9) LDA(UV_IMM); break;                              // LDA #Imm
+      UCASE_NF(0xA9) A = UV_IMM; break;                            // LDA #Imm
+      UCASE(0xAA) X = A; TEST(X); break;                           // TAX
+      UCASE_NF(0xAA) X = A; break;                                 // TAX
+      UCASE(0xAC) LDY(UV_ABS); break;                              // LDY Abs
+      UCASE_NF(0xAC) Y = UV_ABS; break;                            // LDY Abs
+      UCASE(0xAD) LDA(UV_ABS); break;                              // LDA Abs
+      UCASE_NF(0xAD) A = UV_ABS; break;                            // LDA Abs
+      UCASE(0xAE) LDX(UV_ABS); break;                              // LDX Abs
+      UCASE_NF(0xAE) X = UV_ABS; break;                            // LDX Abs
+      UCASE(0xB1) LDA(UV_IY); break;                               // LDA (Zpg),Y
+      UCASE_NF(0xB1) A = UV_IY; break;                             // LDA (Zpg),Y
+      UCASE(0xB4) LDY(UV_ZPX); break;                              // LDY Zpg,X
+      UCASE_NF(0xB4) Y = UV_ZPX; break;                            // LDY Zpg,X
+      UCASE(0xB5) LDA(UV_ZPX); break;                              // LDA Zpg,X
+      UCASE_NF(0xB5) A = UV_ZPX; break;                            // LDA Zpg,X
+      UCASE(0xB6) LDX(UV_ZPY); break;                              // LDX Zpg,Y
+      UCASE_NF(0xB6) X = UV_ZPY; break;                            // LDX Zpg,Y
+      UCASE(0xB8) RSTF(FLAG_V); break;                             // CLV
+      UCASE(0xB9) LDA(UV_ABSY); break;                             // LDA Abs,Y
+      UCASE_NF(0xB9) A = UV_ABSY; break;                           // LDA Abs,Y
+      UCASE(0xBA) X = SP; TEST(X); break;                          // TSX
+      UCASE_NF(0xBA) X = SP; break;                                // TSX
+      UCASE(0xBC) LDY(UV_ABSX); break;                             // LDY Abs,X
+      UCASE_NF(0xBC) Y = UV_ABSX; break;                           // LDY Abs,X
+      UCASE(0xBD) LDA(UV_ABSX); break;                             // LDA Abs,X
+      UCASE_NF(0xBD) A = UV_ABSX; break;                           // LDA Abs,X
+      UCASE(0xBE) LDX(UV_ABSY); break;                             // LDX Abs,Y
+      UCASE_NF(0xBE) X = UV_ABSY; break;                           // LDX Abs,Y
+      UCASE(0xC0) CPY(UV_IMM); break;                              // CPY #Imm
+      UCASE(0xC1) CMP(UV_IX); break;                               // CMP (Zpg,X)
+      UCASE(0xC4) CPY(UV_ZP); break;                               // CPY Zpg
+      UCASE(0xC5) CMP(UV_ZP); break;                               // CMP Zpg
+      UCASE(0xC6) DEC(UE_ZP); break;                               // DEC Zpg
+      UCASE_NF(0xC6) wA0 = UE_ZP; WRITE(wA0, K6502_Read(wA0) - 1); break; // DEC Zpg
+      UCASE(0xC8) ++Y; TEST(Y); break;                             // INY
+      UCASE_NF(0xC8) ++Y; break;                                   // INY
+      UCASE(0xC9) CMP(UV_IMM); break;                              // CMP #Imm
+      UCASE(0xCA) --X; TEST(X); break;                             // DEX
+      UCASE_NF(0xCA) --X; break;                                   // DEX
+      UCASE(0xCC) CPY(UV_ABS); break;                              // CPY Abs
+      UCASE(0xCD) CMP(UV_ABS); break;                              // CMP Abs
+      UCASE(0xCE) DEC(UE_ABS); break;                              // DEC Abs
+      UCASE_NF(0xCE) wA0 = UE_ABS; WRITE(wA0, K6502_Read(wA0) - 1); break; // DEC Abs
+      UCASE(0xD1) CMP(UV_IY); break;                               // CMP (Zpg),Y
+      UCASE(0xD5) CMP(UV_ZPX); break;                              // CMP Zpg,X
+      UCASE(0xD6) DEC(UE_ZPX); break;                              // DEC Zpg,X
+      UCASE_NF(0xD6) wA0 = UE_ZPX; WRITE(wA0, K6502_Read(wA0) - 1); break; // DEC Zpg,X
+      UCASE(0xD8) RSTF(FLAG_D); break;                             // CLD
+      UCASE(0xD9) CMP(UV_ABSY); break;                             // CMP Abs,Y
+      UCASE(0xDD) CMP(UV_ABSX); break;                             // CMP Abs,X
+      UCASE(0xDE) DEC(UE_ABSX); break;                             // DEC Abs,X
+      UCASE_NF(0xDE) wA0 = UE_ABSX; WRITE(wA0, K6502_Read(wA0) - 1); break; // DEC Abs,X
+      UCASE(0xE0) CPX(UV_IMM); break;                              // CPX #Imm
+      UCASE(0xE1) SBC(UV_IX); break;                               // SBC (Zpg,X)
+      UCASE(0xE4) CPX(UV_ZP); break;                               // CPX Zpg
+      UCASE(0xE5) SBC(UV_ZP); break;                               // SBC Zpg
+      UCASE(0xE6) INC(UE_ZP); break;                               // INC Zpg
+      UCASE_NF(0xE6) wA0 = UE_ZP; WRITE(wA0, K6502_Read(wA0) + 1); break; // INC Zpg
+      UCASE(0xE8) ++X; TEST(X); break;                             // INX
+      UCASE_NF(0xE8) ++X; break;                                   // INX
+      UCASE(0xE9) SBC(UV_IMM); break;                              // SBC #Imm
+      UCASE(0xEA) break;                                           // NOP
+      UCASE(0xEC) CPX(UV_ABS); break;                              // CPX Abs
+      UCASE(0xED) SBC(UV_ABS); break;                              // SBC Abs
+      UCASE(0xEE) INC(UE_ABS); break;                              // INC Abs
+      UCASE_NF(0xEE) wA0 = UE_ABS; WRITE(wA0, K6502_Read(wA0) + 1); break; // INC Abs
+      UCASE(0xF1) SBC(UV_IY); break;                               // SBC (Zpg),Y
+      UCASE(0xF5) SBC(UV_ZPX); break;                              // SBC Zpg,X
+      UCASE(0xF6) INC(UE_ZPX); break;                              // INC Zpg,X
+      UCASE_NF(0xF6) wA0 = UE_ZPX; WRITE(wA0, K6502_Read(wA0) + 1); break; // INC Zpg,X
+      UCASE(0xF8) SETF(FLAG_D); break;                             // SED
+      UCASE(0xF9) SBC(UV_ABSY); break;                             // SBC Abs,Y
+      UCASE(0xFD) SBC(UV_ABSX); break;                             // SBC Abs,X
+      UCASE(0xFE) INC(UE_ABSX); break;                             // INC Abs,X
+      UCASE_NF(0xFE) wA0 = UE_ABSX; WRITE(wA0, K6502_Read(wA0) + 1); break; // INC Abs,X
+      // clang-format on
+      }
+    }
+    CLK(pBlock->byClocks);
+    dwInstructions += pBlock->byUops;
 
-    case 0x1A: // NOP (Unofficial)
-    case 0x3A: // NOP (Unofficial)
-    case 0x5A: // NOP (Unofficial)
-    case 0x7A: // NOP (Unofficial)
-    case 0xDA: // NOP (Unofficial)
-    case 0xFA: // NOP (Unofficial)
-      CLK(2);
-      break;
+    // Exit
+    PC = pBlock->wNext;
+    if (pBlock->byExit != BOP_NONE)
+    {
+      K6502_INSTRUCTION_HOOK(pBlock->byExitCode);
+      PROFILE(pBlock->wNext - g_byDecodeLength[pBlock->byExitCode], pBlock->byExitCode);
+      TRACE(pBlock->wNext - g_byDecodeLength[pBlock->byExitCode], pBlock->byExitCode, wPassedClocks);
+      ++dwInstructions;
+    }
 
-    case 0x80: // DOP (CYCLES 2)
-    case 0x82: // DOP (CYCLES 2)
-    case 0x89: // DOP (CYCLES 2)
-    case 0xC2: // DOP (CYCLES 2)
-    case 0xE2: // DOP (CYCLES 2)
-      PC++;
-      CLK(2);
+    switch (pBlock->byExit)
+    {
+    case BOP_BRANCH:
+    {
+      bool bTaken;
+      switch (pBlock->byExitCode)
+      {
+      // clang-format off
+      case 0x10: bTaken = !IS_N; break;         // BPL
+      case 0x30: bTaken = IS_N; break;          // BMI
+      case 0x50: bTaken = !(F & FLAG_V); break; // BVC
+      case 0x70: bTaken = F & FLAG_V; break;    // BVS
+      case 0x90: bTaken = !(F & FLAG_C); break; // BCC
+      case 0xB0: bTaken = F & FLAG_C; break;    // BCS
+      case 0xD0: bTaken = !IS_Z; break;         // BNE
+      default: bTaken = IS_Z; break;            // BEQ
+      // clang-format on
+      }
+      if (bTaken)
+      {
+        PC = pBlock->wTarget;
+        CLK(pBlock->byTakenClocks);
+        IDLE_CHECK(pBlock->wNext - 2);
+      }
+      else
+      {
+        CLK(2);
+      }
       break;
+    }
 
-    case 0x04: // DOP (CYCLES 3)
-    case 0x44: // DOP (CYCLES 3)
-    case 0x64: // DOP (CYCLES 3)
-      PC++;
+    case BOP_JMP:
+      PC = pBlock->wTarget;
       CLK(3);
       break;
 
-    case 0x14: // DOP (CYCLES 4)
-    case 0x34: // DOP (CYCLES 4)
-    case 0x54: // DOP (CYCLES 4)
-    case 0x74: // DOP (CYCLES 4)
-    case 0xD4: // DOP (CYCLES 4)
-    case 0xF4: // DOP (CYCLES 4)
-      PC++;
-      CLK(4);
-      break;
-
-    case 0x0C: // TOP
-    case 0x1C: // TOP
-    case 0x3C: // TOP
-    case 0x5C: // TOP
-    case 0x7C: // TOP
-    case 0xDC: // TOP
-    case 0xFC: // TOP
-      PC += 2;
-      CLK(4);
+    case BOP_JSR:
+      PUSHW((WORD)(pBlock->wNext - 1));
+      PC = pBlock->wTarget;
+      CLK(6);
       break;
 
-    default: // Unknown Instruction
-      CLK(2);
-#if 0
-        InfoNES_MessageBox( "0x%02x is unknown instruction.\n", byCode ) ;
-#endif
+    case BOP_RTS:
+      POPW(PC);
+      ++PC;
+      CLK(6);
       break;
+    }
+  }
 
-    } /* end of switch ( byCode ) */
+  g_dwBlockRuns = dwRuns;
+  g_dwBlockInstructions += dwInstructions;
 
-  } /* end of while ... */
+#if K6502_LAZY_FLAGS
+  // F is complete between slices
+  F = GETF();
+#endif
 
-  // Correct the number of the clocks
-  g_wCurrentClocks += (g_wPassedClocks - prePassedClocks);
-  g_wPassedClocks -= wClocks;
+  SAVE_CONTEXT();
+  return wStop;
 }
 
 /*===================================================================*/
 /*                                                                   */
-/*  K6502_Step() :                                                   */
-/*          Only the specified number of the clocks execute Op.      */
+/*   runBlocks() : Run a slice from the block cache and interpreter  */
 /*                                                                   */
 /*===================================================================*/
-void __not_in_flash_func(K6502_Step)(int wClocks)
+static void __not_in_flash_func(runBlocks)(int wClocks)
 {
-  if (NMI_State != NMI_Wiring)
+  /*
+ *  Run a slice from the block cache and the interpreter
+ *
+ *  Parameters
+ *    int wClocks               (Read)
+ *      The end of the slice
+ */
+
+  while (g_Context.wPassedClocks < wClocks)
   {
-    // NMI前に少し実行したい
-    step(7);
-    wClocks -= 7;
+    int wStop = blockChain(wClocks);
+    if (g_Context.wPassedClocks < wStop)
+      g_pRun(wClocks, wStop);
   }
-  procNMI();
-  step(wClocks);
 }
-
-// Addressing Op.
-// Data
-// Absolute,X
-static BYTE __not_in_flash_func(K6502_ReadAbsX)()
-{
-  WORD wA0, wA1;
-  wA0 = AA_ABS;
-  wA1 = wA0 + X;
-  CLK((wA0 & 0x0100) != (wA1 & 0x0100));
-  return K6502_Read(wA1);
-};
-// Absolute,Y
-static BYTE __not_in_flash_func(K6502_ReadAbsY)()
-{
-  WORD wA0, wA1;
-  wA0 = AA_ABS;
-  wA1 = wA0 + Y;
-  CLK((wA0 & 0x0100) != (wA1 & 0x0100));
-  return K6502_Read(wA1);
-};
-// (Indirect),Y
-static BYTE __not_in_flash_func(K6502_ReadIY)()
-{
-  WORD wA0, wA1;
-  wA0 = K6502_ReadZpW(K6502_Read(PC++));
-  wA1 = wA0 + Y;
-  CLK((wA0 & 0x0100) != (wA1 & 0x0100));
-  return K6502_Read(wA1);
-};
+#endif /* K6502_BLOCK_CACHE */
 
 /*===================================================================*/
 /*                                                                   */
 /*                  6502 Reading/Writing Operation                   */
 /*                                                                   */
 /*===================================================================*/
+#ifdef K6502_RW_HEADER
+#include K6502_RW_HEADER
+#else
 #include "K6502_rw.h"
+#endif
+
+/*===================================================================*/
+/*                                                                   */
+/*      K6502_SelectCore() : Select the interpreter of the mapper    */
+/*                                                                   */
+/*===================================================================*/
+
+#if K6502_MAPPER_CORES && defined(K6502_MAPPER_CORE_LIST)
+// Mappers with an interpreter of their own
+static const struct mapper_core_tag
+{
+  const char *pszName;
+  bool (*pMatches)();
+  void (*pRun)(int wClocks, int wStop);
+} g_MapperCores[] = {
+#define MAPPER_CORE(n) {"mapper " #n, K6502_Mapper##n::Matches, run<K6502_Mapper##n>},
+    K6502_MAPPER_CORE_LIST(MAPPER_CORE)
+#undef MAPPER_CORE
+};
+#endif
+
+// The name of the interpreter in use
+static const char *g_pszCoreName = "any mapper";
+
+void K6502_SelectCore()
+{
+  /*
+ *  Select the interpreter of the mapper in use
+ *
+ *  Remarks
+ *    A mapper runs its own interpreter when MapperWrite, MapperApu
+ *    and MapperReadApu are the hooks that it was instantiated on,
+ *    any other mapper runs the one that calls them through the pointers.
+ */
+
+  g_pRun = run<K6502_MapperAny>;
+  g_pszCoreName = "any mapper";
+
+#if K6502_MAPPER_CORES && defined(K6502_MAPPER_CORE_LIST)
+  for (const struct mapper_core_tag &core : g_MapperCores)
+  {
+    if (core.pMatches())
+    {
+      g_pRun = core.pRun;
+      g_pszCoreName = core.pszName;
+      break;
+    }
+  }
+#endif
+}
+
+const char *K6502_CoreName()
+{
+  return g_pszCoreName;
+}
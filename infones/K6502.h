@@ -10,6 +10,10 @@
 #define K6502_H_INCLUDED
 
 // Type definition
+#ifndef QWORD
+typedef unsigned long long QWORD;
+#endif
+
 #ifndef DWORD
 typedef unsigned long DWORD;
 #endif
@@ -56,17 +60,23 @@ void K6502_Reset();
 void K6502_Set_Int_Wiring(BYTE byNMI_Wiring, BYTE byIRQ_Wiring);
 void K6502_Step(int wClocks);
 
+// Mapper hooks that reading/writing calls ( K6502_rw.h ), the interpreter
+// is instantiated on the hooks of the mapper in use ( K6502_MAPPER_CORES )
+struct K6502_MapperAny;
+
 // I/O Operation (User definition)
+template <class Mapper = K6502_MapperAny>
 static inline BYTE K6502_Read(WORD wAddr);
+template <class Mapper = K6502_MapperAny>
 static inline WORD K6502_ReadW(WORD wAddr);
+template <class Mapper = K6502_MapperAny>
 static inline WORD K6502_ReadW2(WORD wAddr);
 static inline BYTE K6502_ReadZp(BYTE byAddr);
 static inline WORD K6502_ReadZpW(BYTE byAddr);
-static inline BYTE K6502_ReadAbsX();
-static inline BYTE K6502_ReadAbsY();
-static inline BYTE K6502_ReadIY();
 
+template <class Mapper = K6502_MapperAny>
 static inline void K6502_Write(WORD wAddr, BYTE byData);
+template <class Mapper = K6502_MapperAny>
 static inline void K6502_WriteW(WORD wAddr, WORD wData);
 
 // The state of the IRQ pin
@@ -75,10 +85,63 @@ extern BYTE IRQ_State;
 // The state of the NMI pin
 extern BYTE NMI_State;
 
-extern WORD PC;
-
-// The number of the clocks that it passed
+// 6502 Register ( and the clocks of the slice )
+// K6502.cpp works on a copy in locals while it runs a slice
+struct K6502Context
+{
+  WORD PC;
+  BYTE SP;
+  BYTE F;
+  BYTE A;
+  BYTE X;
+  BYTE Y;
+  WORD NZ;           /* N and Z of the last result ( K6502_LAZY_FLAGS ) */
+  int wPassedClocks; /* Clocks from the start of the slice */
+};
+extern struct K6502Context g_Context;
+
+// The number of the clocks that it passed ( since power on )
 //extern WORD g_wPassedClocks;
-WORD getPassedClocks();
+QWORD getPassedClocks();
+
+// The number of the clocks that idle loops skipped
+extern DWORD g_dwIdleClocks;
+
+// Dispatches that superinstructions saved ( K6502_FUSION )
+extern DWORD g_dwFusedDispatches;
+
+// Drop decoded instructions and blocks of a ROM bank ( K6502_DECODE_CACHE, K6502_BLOCK_CACHE )
+void K6502_InvalidateBank(int nBank);
+
+// Instruction fetches served by the instruction cache, and the others
+extern DWORD g_dwDecodeHits;
+extern DWORD g_dwDecodeMisses;
+
+// Blocks run from the block cache, the instructions in them, and translations ( K6502_BLOCK_CACHE )
+extern DWORD g_dwBlockRuns;
+extern DWORD g_dwBlockInstructions;
+extern DWORD g_dwBlockTranslations;
+
+// Select the interpreter of the mapper in use ( after the mapper is initialized )
+void K6502_SelectCore();
+
+// The mapper that the interpreter is specialised for, or "any"
+const char *K6502_CoreName();
+
+// Run the recompiled code of the ROM ( K6502_AOT_FILE ), false when there is none
+bool K6502_AotSelect(const BYTE *pPrg, DWORD dwSize);
+
+// Instructions run by recompiled code, and lookups that went to the interpreter
+extern DWORD g_dwAotInstructions;
+extern DWORD g_dwAotMisses;
+
+// Print the most executed opcodes and ( bank, PC ) of the profile, and clear them ( K6502_PROFILE )
+void K6502_ProfileDump();
+void K6502_ProfileReset();
+
+// Print the last executed instructions for k6502_trace_decode.py, and clear them ( K6502_TRACE )
+// The trace is kept over a watchdog reset until K6502_Reset()
+void K6502_TraceDump();
+void K6502_TraceReset();
 
 #endif /* !K6502_H_INCLUDED */
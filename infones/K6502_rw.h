@@ -16,10 +16,75 @@
 
 #include "InfoNES.h"
 #include "InfoNES_System.h"
+#include "InfoNES_Mapper.h"
 #include "InfoNES_pAPU.h"
 #include <pico.h>
 #include <stdio.h>
 
+/*-------------------------------------------------------------------*/
+/*  Mapper hooks                                                     */
+/*-------------------------------------------------------------------*/
+
+// Any mapper, through the pointers that its Init set
+struct K6502_MapperAny
+{
+  static bool Matches() { return true; }
+
+  // Write to 0x8000 - 0xffff, the CPU map follows the bank changes
+  static inline void Write(WORD wAddr, BYTE byData)
+  {
+    MapperWrite(wAddr, byData);
+    InfoNES_SyncCpuMap();
+  }
+
+  // Write to 0x4018 - 0x5fff
+  static inline void Apu(WORD wAddr, BYTE byData)
+  {
+    MapperApu(wAddr, byData);
+    InfoNES_SyncCpuMap();
+  }
+
+  // Read from 0x4018 - 0x5fff
+  static inline BYTE ReadApu(WORD wAddr) { return MapperReadApu(wAddr); }
+};
+
+// A mapper that only has a write to 0x8000 - 0xffff ( Map0_Apu and Map0_ReadApu ),
+// bPrgBanks : whether the write may switch PRG-ROM banks
+template <void (*pWrite)(WORD, BYTE), bool bPrgBanks>
+struct K6502_MapperOf
+{
+  static bool Matches()
+  {
+    return MapperWrite == pWrite && MapperApu == Map0_Apu && MapperReadApu == Map0_ReadApu;
+  }
+
+  static inline void Write(WORD wAddr, BYTE byData)
+  {
+    pWrite(wAddr, byData);
+    if (bPrgBanks)
+    {
+      InfoNES_SyncCpuMap();
+    }
+  }
+
+  static inline void Apu(WORD /* wAddr */, BYTE /* byData */) {}
+  static inline BYTE ReadApu(WORD wAddr) { return (wAddr >> 8); }
+};
+
+// Mapper 0 ( writes to the ROM are ignored )
+struct K6502_Mapper0 : K6502_MapperOf<Map0_Write, false>
+{
+  static inline void Write(WORD /* wAddr */, BYTE /* byData */) {}
+};
+typedef K6502_MapperOf<Map1_Write, true> K6502_Mapper1;
+typedef K6502_MapperOf<Map2_Write, true> K6502_Mapper2;
+typedef K6502_MapperOf<Map3_Write, false> K6502_Mapper3; /* VROM only */
+typedef K6502_MapperOf<Map4_Write, true> K6502_Mapper4;
+typedef K6502_MapperOf<Map7_Write, true> K6502_Mapper7;
+
+// Mappers with an interpreter of their own ( K6502_MAPPER_CORES )
+#define K6502_MAPPER_CORE_LIST(X) X(0) X(1) X(2) X(3) X(4) X(7)
+
 /*===================================================================*/
 /*                                                                   */
 /*            K6502_ReadZp() : Reading from the zero page            */
@@ -43,13 +108,14 @@ static inline BYTE K6502_ReadZp(BYTE byAddr)
 
 /*===================================================================*/
 /*                                                                   */
-/*               K6502_Read() : Reading operation                    */
+/*            K6502_ReadIO() : Reading operation ( decoded )         */
 /*                                                                   */
 /*===================================================================*/
-static inline BYTE __not_in_flash_func(K6502_Read)(WORD wAddr)
+template <class Mapper>
+static BYTE __not_in_flash_func(K6502_ReadIO)(WORD wAddr)
 {
   /*
- *  Reading operation
+ *  Reading operation for the pages that are not in CPU_ReadPage
  *
  *  Parameters
  *    WORD wAddr              (Read)
@@ -124,8 +190,8 @@ static inline BYTE __not_in_flash_func(K6502_Read)(WORD wAddr)
   case 0x4000: /* Sound */
     if (wAddr == 0x4015)
     {
-      // APU control
-      byRet = APU_Reg[0x4015];
+      // APU control ( DMC active and IRQ flags are kept in APU_Reg )
+      byRet = APU_Reg[0x15] & 0xd0;
       if (ApuC1Atl > 0)
         byRet |= (1 << 0);
       if (ApuC2Atl > 0)
@@ -144,7 +210,7 @@ static inline BYTE __not_in_flash_func(K6502_Read)(WORD wAddr)
         byRet |= (1 << 3);
 
       // FrameIRQ
-      APU_Reg[0x4015] &= ~0x40;
+      APU_Reg[0x15] &= ~0x40;
       return byRet;
     }
     else if (wAddr == 0x4016)
@@ -164,7 +230,7 @@ static inline BYTE __not_in_flash_func(K6502_Read)(WORD wAddr)
     else
     {
       /* Return Mapper Register*/
-      return MapperReadApu(wAddr);
+      return Mapper::ReadApu(wAddr);
     }
     break;
     // The other sound registers are not readable.
@@ -196,11 +262,91 @@ static inline BYTE __not_in_flash_func(K6502_Read)(WORD wAddr)
                             address is returned. */
 }
 
+/*===================================================================*/
+/*                                                                   */
+/*               K6502_Read() : Reading operation                    */
+/*                                                                   */
+/*===================================================================*/
+template <class Mapper>
+static inline BYTE __not_in_flash_func(K6502_Read)(WORD wAddr)
+{
+  /*
+ *  Reading operation
+ *
+ *  Parameters
+ *    WORD wAddr              (Read)
+ *      Address to read
+ *
+ *  Return values
+ *    Read data
+ *
+ *  Remarks
+ *    RAM, SRAM and ROM are read straight from CPU_ReadPage.
+ *    The other pages are decoded in K6502_ReadIO().
+ */
+  const BYTE *pPage = CPU_ReadPage[wAddr >> 8];
+  if (pPage)
+  {
+    return pPage[wAddr & 0xff];
+  }
+  return K6502_ReadIO<Mapper>(wAddr);
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*      K6502_IsIdleRead() : Reading has no lasting side effect      */
+/*                                                                   */
+/*===================================================================*/
+static inline bool K6502_IsIdleRead(WORD wAddr)
+{
+  /*
+ *  Whether reading an address again has no side effect
+ *
+ *  Parameters
+ *    WORD wAddr              (Read)
+ *      Address to read
+ *
+ *  Return values
+ *    true : RAM, SRAM, ROM or the PPU status register
+ *
+ *  Remarks
+ *    A PPU status read only clears flags, so repeating it changes
+ *    nothing until the next event sets them again.
+ */
+  return CPU_ReadPage[wAddr >> 8] || (wAddr & 0xe007) == 0x2002;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*          K6502_PrgBank() : The PRG-ROM bank in a window           */
+/*                                                                   */
+/*===================================================================*/
+static inline int K6502_PrgBank(int nWindow)
+{
+  /*
+ *  The 8KB PRG-ROM bank in a window of 0x8000 - 0xffff
+ *
+ *  Parameters
+ *    int nWindow             (Read)
+ *      ROMBANK index ( 0: 0x8000 - 3: 0xe000 )
+ *
+ *  Return values
+ *    The bank, or -1 when the window is not PRG-ROM
+ */
+  int nOffset = ROMBANK[nWindow] - ROM;
+  if (nOffset < 0 || nOffset >= NesHeader.byRomSize * 0x4000)
+  {
+    return -1;
+  }
+  return nOffset >> 13;
+}
+
 /*===================================================================*/
 /*                                                                   */
 /*               K6502_Write() : Writing operation                    */
 /*                                                                   */
 /*===================================================================*/
+template <class Mapper>
 static inline void __not_in_flash_func(K6502_Write)(WORD wAddr, BYTE byData)
 {
   /*
@@ -220,8 +366,16 @@ static inline void __not_in_flash_func(K6502_Write)(WORD wAddr, BYTE byData)
  *    0x6000 - 0x7fff  SRAM ( Battery Backed )
  *    0x8000 - 0xffff  ROM
  *
+ *    RAM pages are written straight through CPU_WritePage.
  */
 
+  BYTE *pPage = CPU_WritePage[wAddr >> 8];
+  if (pPage)
+  {
+    pPage[wAddr & 0xff] = byData;
+    return;
+  }
+
   switch (wAddr & 0xe000)
   {
   case 0x0000: /* RAM */
@@ -232,6 +386,10 @@ static inline void __not_in_flash_func(K6502_Write)(WORD wAddr, BYTE byData)
   break;
 
   case 0x2000: /* PPU */
+#if INFONES_PPU_CATCHUP
+    if (PPU_LogEnable)
+      InfoNES_PpuLogBegin();
+#endif
     switch (wAddr & 0x7)
     {
     case 0: /* 0x2000 */
@@ -262,8 +420,15 @@ static inline void __not_in_flash_func(K6502_Write)(WORD wAddr, BYTE byData)
       break;
 
     case 4: /* 0x2004 */
+#if INFONES_DEFERRED_RENDER
+      // The queued scanlines are rendered from the sprites before the write
+      InfoNES_DeferredFlush();
+#endif
       // Write data to Sprite RAM
       SPRRAM[PPU_R3++] = byData;
+#if INFONES_SPRITE_BINS
+      SprBinUpdate = 1;
+#endif
       break;
 
     case 5: /* 0x2005 */
@@ -321,6 +486,10 @@ static inline void __not_in_flash_func(K6502_Write)(WORD wAddr, BYTE byData)
 
     case 7: /* 0x2007 */
     {
+#if INFONES_DEFERRED_RENDER
+      // The queued scanlines are rendered from the patterns, name tables and palettes before the write
+      InfoNES_DeferredFlush();
+#endif
       WORD addr = PPU_Addr;
 
       // Increment PPU Address
@@ -332,6 +501,12 @@ static inline void __not_in_flash_func(K6502_Write)(WORD wAddr, BYTE byData)
       {
         // Pattern Data
         ChrBufUpdate |= (1 << (addr >> 10));
+#if INFONES_SPRITE_BINS
+        SprRowsValid = 0;
+#endif
+#if INFONES_DRAW8 && INFONES_BG_CACHE
+        BgCacheUpdate = 1;
+#endif
         PPUBANK[addr >> 10][addr & 0x3ff] = byData;
       }
       else if (addr < 0x3f00) /* 0x2000 - 0x3eff */
@@ -339,27 +514,45 @@ static inline void __not_in_flash_func(K6502_Write)(WORD wAddr, BYTE byData)
         // Name Table and mirror
         PPUBANK[addr >> 10][addr & 0x3ff] = byData;
         PPUBANK[(addr ^ 0x1000) >> 10][addr & 0x3ff] = byData;
+#if INFONES_DRAW8 && INFONES_BG_CACHE
+        InfoNES_BgCacheWrite(&PPUBANK[addr >> 10][addr & 0x3ff]);
+        InfoNES_BgCacheWrite(&PPUBANK[(addr ^ 0x1000) >> 10][addr & 0x3ff]);
+#endif
       }
       else if (!(addr & 0xf)) /* 0x3f00 or 0x3f10 */
       {
         // Palette mirror
         PPURAM[0x3f10] = PPURAM[0x3f14] = PPURAM[0x3f18] = PPURAM[0x3f1c] =
             PPURAM[0x3f00] = PPURAM[0x3f04] = PPURAM[0x3f08] = PPURAM[0x3f0c] = byData;
+#if INFONES_DRAW8
+        // The backdrop colour is marked as the transparent background
+        PalTable8[0x00] = PalTable8[0x04] = PalTable8[0x08] = PalTable8[0x0c] =
+            PalTable8[0x10] = PalTable8[0x14] = PalTable8[0x18] = PalTable8[0x1c] = (byData & 0x3f) | PAL8_BG_CLEAR;
+#else
         PalTable[0x00] = PalTable[0x04] = PalTable[0x08] = PalTable[0x0c] =
             PalTable[0x10] = PalTable[0x14] = PalTable[0x18] = PalTable[0x1c] = NesPalette[byData] | 0x8000;
         PalTable8[0x00] = PalTable8[0x04] = PalTable8[0x08] = PalTable8[0x0c] =
             PalTable8[0x10] = PalTable8[0x14] = PalTable8[0x18] = PalTable8[0x1c] = byData ; // | 0x80;
+#endif
       }
       else if (addr & 3)
       {
         // Palette
         PPURAM[addr] = byData;
+#if INFONES_DRAW8
+        PalTable8[addr & 0x1f] = byData & 0x3f;
+#else
         PalTable[addr & 0x1f] = NesPalette[byData];
         PalTable8[addr & 0x1f] = byData;
+#endif
       }
     }
     break;
     }
+#if INFONES_PPU_CATCHUP
+    if (PPU_LogEnable)
+      InfoNES_PpuLogEnd();
+#endif
     break;
 
   case 0x4000: /* Sound */
@@ -391,6 +584,9 @@ static inline void __not_in_flash_func(K6502_Write)(WORD wAddr, BYTE byData)
       break;
 
     case 0x14: /* 0x4014 */
+#if INFONES_DEFERRED_RENDER
+      InfoNES_DeferredFlush();
+#endif
       // Sprite DMA
       switch (byData >> 5)
       {
@@ -418,10 +614,26 @@ static inline void __not_in_flash_func(K6502_Write)(WORD wAddr, BYTE byData)
         InfoNES_MemoryCopy(SPRRAM, &ROMBANK3[((WORD)byData << 8) & 0x1fff], SPRRAM_SIZE);
         break;
       }
+#if INFONES_SPRITE_BINS
+      SprBinUpdate = 1;
+#endif
       break;
 
     case 0x15: /* 0x4015 */
       InfoNES_pAPUWriteControl(wAddr, byData);
+
+      // DMC IRQ at the end of a DPCM sample
+      if (!(byData & 0x10))
+      {
+        InfoNES_CancelEvent(EVENT_DMC);
+      }
+      else if (!(APU_Reg[0x15] & 0x10))
+      {
+        InfoNES_ScheduleEvent(EVENT_DMC, InfoNES_MasterClock() + InfoNES_pAPUDmcClocks() * CLOCKS_PER_CPU);
+      }
+
+      // Keep the frame IRQ flag, a write clears the DMC IRQ flag
+      byData = (byData & 0x1f) | (APU_Reg[0x15] & 0x40);
 #if 0
           /* Unknown */
           if ( byData & 0x10 ) 
@@ -441,15 +653,16 @@ static inline void __not_in_flash_func(K6502_Write)(WORD wAddr, BYTE byData)
       break;
 
     case 0x17: /* 0x4017 */
-      // Frame IRQ
-      FrameStep = 0;
+      // Frame IRQ a frame after the write
       if (!(byData & 0xc0))
       {
         FrameIRQ_Enable = 1;
+        InfoNES_ScheduleEvent(EVENT_FRAME_IRQ, InfoNES_MasterClock() + STEP_PER_FRAME * CLOCKS_PER_CPU);
       }
       else
       {
         FrameIRQ_Enable = 0;
+        InfoNES_CancelEvent(EVENT_FRAME_IRQ);
       }
       break;
     }
@@ -462,7 +675,15 @@ static inline void __not_in_flash_func(K6502_Write)(WORD wAddr, BYTE byData)
     else
     {
       /* Write to APU */
-      MapperApu(wAddr, byData);
+#if INFONES_PPU_CATCHUP
+      if (PPU_LogEnable)
+        InfoNES_PpuLogBegin();
+#endif
+      Mapper::Apu(wAddr, byData);
+#if INFONES_PPU_CATCHUP
+      if (PPU_LogEnable)
+        InfoNES_PpuLogEnd();
+#endif
     }
     break;
 
@@ -473,7 +694,16 @@ static inline void __not_in_flash_func(K6502_Write)(WORD wAddr, BYTE byData)
     /* Write to SRAM, when no SRAM */
     if (!ROM_SRAM)
     {
+#if INFONES_PPU_CATCHUP
+      if (PPU_LogEnable)
+        InfoNES_PpuLogBegin();
+#endif
       MapperSram(wAddr, byData);
+#if INFONES_PPU_CATCHUP
+      if (PPU_LogEnable)
+        InfoNES_PpuLogEnd();
+#endif
+      InfoNES_SyncCpuMap();
     }
     break;
 
@@ -482,30 +712,41 @@ static inline void __not_in_flash_func(K6502_Write)(WORD wAddr, BYTE byData)
   case 0xc000: /* ROM BANK 2 */
   case 0xe000: /* ROM BANK 3 */
     // Write to Mapper
-    MapperWrite(wAddr, byData);
+#if INFONES_PPU_CATCHUP
+    if (PPU_LogEnable)
+      InfoNES_PpuLogBegin();
+#endif
+    Mapper::Write(wAddr, byData);
+#if INFONES_PPU_CATCHUP
+    if (PPU_LogEnable)
+      InfoNES_PpuLogEnd();
+#endif
     break;
   }
 }
 
 // Reading/Writing operation (WORD version)
-static inline WORD K6502_ReadW(WORD wAddr) { return K6502_Read(wAddr) | (WORD)K6502_Read(wAddr + 1) << 8; };
+template <class Mapper>
+static inline WORD K6502_ReadW(WORD wAddr) { return K6502_Read<Mapper>(wAddr) | (WORD)K6502_Read<Mapper>(wAddr + 1) << 8; };
+template <class Mapper>
 static inline void K6502_WriteW(WORD wAddr, WORD wData)
 {
-  K6502_Write(wAddr, wData & 0xff);
-  K6502_Write(wAddr + 1, wData >> 8);
+  K6502_Write<Mapper>(wAddr, wData & 0xff);
+  K6502_Write<Mapper>(wAddr + 1, wData >> 8);
 };
 static inline WORD K6502_ReadZpW(BYTE byAddr) { return K6502_ReadZp(byAddr) | (K6502_ReadZp(byAddr + 1) << 8); };
 
 // 6502's indirect absolute jmp(opcode: 6C) has a bug (added at 01/08/15 )
+template <class Mapper>
 static inline WORD K6502_ReadW2(WORD wAddr)
 {
   if (0x00ff == (wAddr & 0x00ff))
   {
-    return K6502_Read(wAddr) | (WORD)K6502_Read(wAddr - 0x00ff) << 8;
+    return K6502_Read<Mapper>(wAddr) | (WORD)K6502_Read<Mapper>(wAddr - 0x00ff) << 8;
   }
   else
   {
-    return K6502_Read(wAddr) | (WORD)K6502_Read(wAddr + 1) << 8;
+    return K6502_Read<Mapper>(wAddr) | (WORD)K6502_Read<Mapper>(wAddr + 1) << 8;
   }
 }
 
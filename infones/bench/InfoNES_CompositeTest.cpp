@@ -0,0 +1,95 @@
+/*===================================================================*/
+/*                                                                   */
+/*  InfoNES_CompositeTest.cpp : Equivalence test of the sprite       */
+/*                              compositing kernels                  */
+/*                                                                   */
+/*  Checks the 4 pixel kernels of InfoNES_Composite.h against the    */
+/*  one pixel reference, every pair of a sprite and a background     */
+/*  pixel in every byte lane, then random words. The DSP kernel      */
+/*  runs on the model of USUB8 and SEL off the Arm DSP extension.    */
+/*                                                                   */
+/*===================================================================*/
+
+#include "InfoNES_Composite.h"
+
+#include <stdio.h>
+
+using namespace InfoNES_Composite;
+
+namespace
+{
+  uint32_t seed = 1;
+  uint32_t rnd()
+  {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) ^ (seed << 24);
+  }
+
+  uint32_t reference(uint32_t spr, uint32_t bg)
+  {
+    uint32_t r = 0;
+    for (int i = 0; i < 32; i += 8)
+      r |= (uint32_t)compositeSprite8((uint8_t)(spr >> i), (uint8_t)(bg >> i)) << i;
+    return r;
+  }
+
+  struct Kernel
+  {
+    const char *pszName;
+    uint32_t (*func)(uint32_t spr, uint32_t bg);
+    int nErrors;
+  };
+
+  Kernel kernels[] = {
+      {"portable", compositeSprite8x4, 0},
+      {"dsp model", compositeSprite8x4Dsp<DspModel>, 0},
+#if defined(__ARM_FEATURE_SIMD32)
+      {"dsp", compositeSprite8x4Dsp<Dsp>, 0},
+#endif
+  };
+
+  void check(uint32_t spr, uint32_t bg)
+  {
+    const uint32_t expected = reference(spr, bg);
+    for (auto &kernel : kernels)
+    {
+      const uint32_t result = kernel.func(spr, bg);
+      if (result != expected && kernel.nErrors++ < 8)
+        printf("%s: spr %08X bg %08X -> %08X, %08X expected\n",
+               kernel.pszName, (unsigned)spr, (unsigned)bg, (unsigned)result, (unsigned)expected);
+    }
+  }
+}
+
+int main()
+{
+  // Every pair in every lane, the other lanes random
+  for (int nLane = 0; nLane < 32; nLane += 8)
+  {
+    for (uint32_t spr = 0; spr < 256; ++spr)
+    {
+      for (uint32_t bg = 0; bg < 256; ++bg)
+      {
+        const uint32_t lane = 0xffu << nLane;
+        check((rnd() & ~lane) | (spr << nLane), (rnd() & ~lane) | (bg << nLane));
+      }
+    }
+  }
+
+  // Random words, half of them with transparent lanes as sprite lines have
+  for (int i = 0; i < 1000000; ++i)
+  {
+    uint32_t spr = rnd();
+    if (i & 1)
+      spr &= (rnd() & 0x01010101u) * 0xff;
+    check(spr, rnd());
+  }
+
+  int nErrors = 0;
+  for (const auto &kernel : kernels)
+  {
+    printf("%-10s %s\n", kernel.pszName, kernel.nErrors ? "FAILED" : "ok");
+    nErrors += kernel.nErrors;
+  }
+  return nErrors ? 1 : 0;
+}
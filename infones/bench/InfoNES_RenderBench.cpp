@@ -0,0 +1,439 @@
+/*===================================================================*/
+/*                                                                   */
+/*  InfoNES_RenderBench.cpp : Host benchmark for InfoNES_DrawLine    */
+/*                                                                   */
+/*  Renders scanlines of random pattern, name table, sprite and      */
+/*  palette data at random scroll positions, and reports the time    */
+/*  per scanline and a hash of the rendered lines. Every renderer    */
+/*  configuration has to give the same hash.                         */
+/*                                                                   */
+/*===================================================================*/
+
+#include "InfoNES.h"
+#include "InfoNES_System.h"
+#include "K6502.h"
+#include "K6502_rw.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if INFONES_DEFERRED_RENDER
+#include <atomic>
+#include <thread>
+#endif
+
+/*-------------------------------------------------------------------*/
+/*  Stand-ins for the system dependent functions                     */
+/*-------------------------------------------------------------------*/
+
+const WORD NesPalette[64] = {};
+int InfoNES_Menu() { return 0; }
+int InfoNES_ReadRom(const char *) { return 0; }
+void InfoNES_ReleaseRom() {}
+void InfoNES_LoadFrame() {}
+void InfoNES_PadState(DWORD *pdwPad1, DWORD *pdwPad2, DWORD *pdwSystem) { *pdwPad1 = *pdwPad2 = *pdwSystem = 0; }
+void InfoNES_MessageBox(const char *, ...) {}
+void InfoNES_PreDrawLine(int) {}
+void InfoNES_PostDrawLine(int) {}
+void InfoNES_SoundInit() {}
+int InfoNES_SoundOpen(int, int) { return 1; }
+void InfoNES_SoundClose() {}
+void InfoNES_SoundOutput(int, BYTE *, BYTE *, BYTE *, BYTE *, BYTE *) {}
+int InfoNES_GetSoundBufferSize() { return 0; }
+
+namespace
+{
+  // NROM with 32KB of PRG-ROM and CHR-RAM
+  BYTE prgRom[0x8000];
+
+  // A line of the framebuffer, 32 pixels of border on each side
+  constexpr int LINE_BORDER = 32;
+  constexpr int LINE_SIZE = NES_DISP_WIDTH + LINE_BORDER * 2;
+  WORD line16[LINE_SIZE];
+  alignas(4) BYTE line8[LINE_SIZE];
+
+  DWORD seed = 1;
+  DWORD rnd()
+  {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+  }
+
+  // Workloads
+  enum
+  {
+    BG_ONLY,     /* sprites off */
+    BG_SPRITES,  /* background and sprites */
+    MIXED,       /* random R0/R1 and clipping */
+    SCROLL,      /* a few name table writes a frame, scrolled as a game does */
+    WORKLOADS,
+  };
+  const char *const workloadNames[WORKLOADS] = {"bg", "bg+sprites", "mixed", "scroll"};
+
+  /*
+   *  New random PPU memory and registers, as the game would write them
+   */
+  void setupFrame(int nWorkload, int nFrame)
+  {
+    if (nWorkload == SCROLL && nFrame)
+    {
+      // Some tiles and attributes, and new sprites
+      for (int i = 0; i < 8; ++i)
+      {
+        const WORD wAddr = 0x2000 + (rnd() & 0x7ff);
+        K6502_Write(0x2006, wAddr >> 8);
+        K6502_Write(0x2006, wAddr & 0xff);
+        K6502_Write(0x2007, (BYTE)rnd());
+      }
+      for (int i = 0; i < SPRRAM_SIZE; ++i)
+        RAM[0x200 + i] = (BYTE)rnd();
+      K6502_Write(0x4014, 0x02);
+      return;
+    }
+
+    // Pattern and name tables
+    K6502_Write(0x2006, 0x00);
+    K6502_Write(0x2006, 0x00);
+    for (int i = 0; i < 0x3000; ++i)
+      K6502_Write(0x2007, (BYTE)rnd());
+
+    // Sprites, about half of them off the screen
+    for (int i = 0; i < SPRRAM_SIZE; ++i)
+      RAM[0x200 + i] = (BYTE)rnd();
+    for (int i = 0; i < 64; ++i)
+      if (rnd() & 1)
+        RAM[0x200 + i * 4] = 0xf0;
+    K6502_Write(0x4014, 0x02);
+
+    switch (nWorkload)
+    {
+    case BG_ONLY:
+      K6502_Write(0x2000, (BYTE)(rnd() & 0x10));
+      K6502_Write(0x2001, 0x0a);
+      break;
+    case BG_SPRITES:
+    case SCROLL:
+      K6502_Write(0x2000, (BYTE)(rnd() & 0x38));
+      K6502_Write(0x2001, 0x1e);
+      break;
+    default:
+      K6502_Write(0x2000, (BYTE)(rnd() & 0x38));
+      K6502_Write(0x2001, (BYTE)((rnd() & 0x1e) | ((nFrame & 3) == 0 ? 0x18 : 0)));
+      break;
+    }
+
+    // Palettes
+    K6502_Write(0x2006, 0x3f);
+    K6502_Write(0x2006, 0x00);
+    for (int i = 0; i < 32; ++i)
+      K6502_Write(0x2007, (BYTE)(rnd() & 0x3f));
+
+    PPU_UpDown_Clip = nWorkload == MIXED && (rnd() & 7) == 0;
+  }
+
+  /*
+   *  The scroll position of a scanline
+   */
+  void setupLine(int nWorkload, int nFrame, int nLine)
+  {
+    PPU_Scanline = nLine;
+    if (nWorkload == SCROLL)
+    {
+      // Horizontal scroll by 3 pixels a frame, over two name tables
+      const int nScrollX = (nFrame * 3) & 511;
+      PPU_Addr = ((nLine & 7) << 12) | ((nScrollX >> 8) << 10) | ((nLine >> 3) << 5) | ((nScrollX >> 3) & 31);
+      PPU_Scr_H_Bit = nScrollX & 7;
+    }
+    else
+    {
+      PPU_Addr = rnd() & 0x7fff;
+      PPU_Scr_H_Bit = rnd() & 7;
+    }
+    PPU_Scr_H_Byte = PPU_Addr & 31;
+    PPU_NameTableBank = NAME_TABLE0 + ((PPU_Addr >> 10) & 3);
+  }
+
+#if INFONES_DEFERRED_RENDER
+  /*
+   *  Render the queued scanline on this thread with the live PPU state trashed,
+   *  it has to come out of the state captured when it was queued
+   */
+  void renderDeferred()
+  {
+    static BYTE trash[0x400];
+    alignas(4) static BYTE trashLine[LINE_SIZE];
+    memset(trash, 0x5a, sizeof trash);
+
+    BYTE *pbyBank[16];
+    memcpy(pbyBank, PPUBANK, sizeof pbyBank);
+    const BYTE byR0 = PPU_R0;
+    const BYTE byR1 = PPU_R1;
+    const WORD wAddr = PPU_Addr;
+    const BYTE byUpDownClip = PPU_UpDown_Clip;
+
+    for (int i = 0; i < 16; ++i)
+      PPUBANK[i] = trash;
+    PPU_R0 ^= R0_SP_SIZE | R0_BG_ADDR | R0_SP_ADDR;
+    PPU_R1 ^= R1_SHOW_SP | R1_SHOW_SCR | R1_CLIP_SP | R1_CLIP_BG;
+    PPU_Addr ^= 0x7fff;
+    PPU_Scr_H_Byte ^= 31;
+    PPU_Scr_H_Bit ^= 7;
+    PPU_NameTableBank ^= 3;
+    PPU_UpDown_Clip ^= 1;
+    PPU_Scanline ^= 0x55;
+    InfoNES_SetLineBuffer(line16 + LINE_BORDER, trashLine + LINE_BORDER, LINE_SIZE - LINE_BORDER);
+
+    InfoNES_DeferredRender();
+
+    memcpy(PPUBANK, pbyBank, sizeof pbyBank);
+    PPU_R0 = byR0;
+    PPU_R1 = byR1;
+    PPU_Addr = wAddr;
+    PPU_Scr_H_Byte ^= 31;
+    PPU_Scr_H_Bit ^= 7;
+    PPU_NameTableBank ^= 3;
+    PPU_UpDown_Clip = byUpDownClip;
+    PPU_Scanline ^= 0x55;
+    InfoNES_SetLineBuffer(line16 + LINE_BORDER, line8 + LINE_BORDER, LINE_SIZE - LINE_BORDER);
+
+    // R2_MAX_SP of the scanline
+    InfoNES_DeferredFlush();
+  }
+#endif
+
+  /*
+   *  Render the frames of a workload, returns the nanoseconds per scanline
+   */
+  double runWorkload(int nWorkload, int nFrames, uint32_t &dwHash)
+  {
+    double dNanos = 0;
+    for (int nFrame = 0; nFrame < nFrames; ++nFrame)
+    {
+      setupFrame(nWorkload, nFrame);
+      for (int nLine = 0; nLine < NES_DISP_HEIGHT; ++nLine)
+      {
+        setupLine(nWorkload, nFrame, nLine);
+
+        memset(line8, 0xee, sizeof line8);
+        InfoNES_SetLineBuffer(line16 + LINE_BORDER, line8 + LINE_BORDER, LINE_SIZE - LINE_BORDER);
+
+        auto t0 = std::chrono::steady_clock::now();
+        InfoNES_DrawLine();
+#if INFONES_DEFERRED_RENDER
+        renderDeferred();
+#endif
+        dNanos += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+
+        // The palette indices, and the borders that have to stay untouched
+        for (int x = 0; x < LINE_SIZE; ++x)
+        {
+          BYTE v = line8[x];
+          if (x >= LINE_BORDER && x < LINE_BORDER + NES_DISP_WIDTH)
+            v &= 0x3f;
+          dwHash = (dwHash ^ v) * 16777619u;
+        }
+        dwHash = (dwHash ^ PPU_R2) * 16777619u;
+      }
+    }
+    return dNanos / (nFrames * (double)NES_DISP_HEIGHT);
+  }
+
+#if INFONES_PPU_CATCHUP
+  /*
+   *  Writes to $2000/$2001 in the middle of scanlines, the scanline has to be the one
+   *  before the write up to its pixel and the one after it from there, returns the errors
+   */
+  int checkCatchUp(int nLines)
+  {
+    alignas(4) static BYTE before[LINE_SIZE];
+    alignas(4) static BYTE after[LINE_SIZE];
+    int nErrors = 0;
+
+    auto render = [](BYTE *pbyLine) {
+      memset(pbyLine, 0xee, LINE_SIZE);
+      InfoNES_SetLineBuffer(line16 + LINE_BORDER, pbyLine + LINE_BORDER, LINE_SIZE - LINE_BORDER);
+      InfoNES_DrawLine();
+    };
+    auto write = [](WORD wAddr, BYTE byData) {
+      K6502_Write(wAddr, byData);
+      PPU_NameTableBank = NAME_TABLE0 + ((PPU_Addr >> 10) & 3);
+    };
+
+    for (int nLine = 0; nLine < nLines; ++nLine)
+    {
+      if (!(nLine % NES_DISP_HEIGHT))
+        setupFrame(MIXED, nLine / NES_DISP_HEIGHT);
+
+      PPU_Scanline = nLine % NES_DISP_HEIGHT;
+      PPU_Addr = rnd() & 0x7fff;
+      PPU_Scr_H_Bit = rnd() & 7;
+      PPU_Scr_H_Byte = PPU_Addr & 31;
+      PPU_NameTableBank = NAME_TABLE0 + ((PPU_Addr >> 10) & 3);
+
+      const WORD wAddr = (rnd() & 1) ? 0x2001 : 0x2000;
+      const BYTE byOld = wAddr == 0x2001 ? PPU_R1 : PPU_R0;
+      const BYTE byNew = (BYTE)(wAddr == 0x2001 ? rnd() & 0x1e : rnd() & 0x38);
+
+      render(before);
+      write(wAddr, byNew);
+      render(after);
+      write(wAddr, byOld);
+
+      // The write at a dot of the scanline
+      const QWORD qwLineStart = InfoNES_MasterClock();
+      InfoNES_SetupEvents();
+      K6502_Step(rnd() % 100 + 1);
+      const QWORD qwDot = InfoNES_MasterClock() - qwLineStart;
+      const int nX = qwDot < 1 ? 0 : qwDot > NES_DISP_WIDTH ? NES_DISP_WIDTH : (int)qwDot - 1;
+      PPU_LogEnable = 1;
+      write(wAddr, byNew);
+      PPU_LogEnable = 0;
+      render(line8);
+
+      for (int x = 0; x < LINE_SIZE; ++x)
+      {
+        const BYTE byExpected = x < LINE_BORDER + nX ? before[x] : after[x];
+        if (line8[x] != byExpected && nErrors++ < 8)
+          printf("catch-up: line %d, $%04X at pixel %d, pixel %d is %02X, %02X expected\n",
+                 PPU_Scanline, wAddr, nX, x - LINE_BORDER, line8[x], byExpected);
+      }
+      write(wAddr, byOld);
+    }
+    return nErrors;
+  }
+#endif
+
+#if INFONES_DEFERRED_RENDER
+  /*
+   *  Frames of the scroll workload, the scanlines queued to a worker thread or rendered
+   *  on this thread, returns the nanoseconds per scanline on this thread
+   */
+  double renderFrames(int nFrames, bool bDeferred, uint32_t &dwHash)
+  {
+    static WORD frame16[NES_DISP_HEIGHT][LINE_SIZE];
+    alignas(4) static BYTE frame8[NES_DISP_HEIGHT][LINE_SIZE];
+
+    std::atomic<bool> bStop{false};
+    std::thread worker([&bStop] {
+      while (!bStop.load(std::memory_order_relaxed))
+        if (!InfoNES_DeferredRender())
+          std::this_thread::yield();
+    });
+    DeferredRenderEnable = bDeferred;
+
+    seed = 1;
+    double dNanos = 0;
+    for (int nFrame = 0; nFrame < nFrames; ++nFrame)
+    {
+      setupFrame(SCROLL, nFrame);
+      auto t0 = std::chrono::steady_clock::now();
+      for (int nLine = 0; nLine < NES_DISP_HEIGHT; ++nLine)
+      {
+        setupLine(SCROLL, nFrame, nLine);
+        InfoNES_SetLineBuffer(frame16[nLine] + LINE_BORDER, frame8[nLine] + LINE_BORDER, LINE_SIZE - LINE_BORDER);
+        InfoNES_DrawLine();
+      }
+      // The frame is handed over
+      InfoNES_DeferredFlush();
+      dNanos += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+
+      for (const auto &line : frame8)
+        for (int x = LINE_BORDER; x < LINE_BORDER + NES_DISP_WIDTH; ++x)
+          dwHash = (dwHash ^ (line[x] & 0x3f)) * 16777619u;
+    }
+
+    bStop = true;
+    worker.join();
+    return dNanos / (nFrames * (double)NES_DISP_HEIGHT);
+  }
+#endif
+
+  int usage(const char *pszName)
+  {
+    fprintf(stderr, "usage: %s [frames [expected hash]]\n", pszName);
+    return 2;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  if (argc > 3)
+    return usage(argv[0]);
+  int nFrames = argc > 1 ? atoi(argv[1]) : 200;
+  if (nFrames <= 0)
+    return usage(argv[0]);
+
+  memcpy(NesHeader.byID, "NES\x1a", 4);
+  NesHeader.byRomSize = sizeof prgRom / 0x4000;
+  NesHeader.byVRomSize = 0;
+  NesHeader.byInfo1 = 1;
+  ROM = prgRom;
+  VROM = NULL;
+  prgRom[0x7ffc] = 0x00;
+  prgRom[0x7ffd] = 0x80;
+  InfoNES_Reset();
+
+#if INFONES_DEFERRED_RENDER
+  // Scanlines are queued, and rendered by renderDeferred()
+  DeferredRenderEnable = 1;
+#endif
+
+  uint32_t dwHash = 2166136261u;
+  for (int nWorkload = 0; nWorkload < WORKLOADS; ++nWorkload)
+  {
+#if INFONES_DRAW8 && INFONES_BG_CACHE
+    BgCacheHits = BgCacheMisses = BgCacheBypasses = 0;
+#endif
+#if INFONES_CHR_CACHE
+    ChrCacheHits = ChrCacheMisses = 0;
+#endif
+    double dNanos = runWorkload(nWorkload, nFrames, dwHash);
+    printf("%-12s %8.1f ns/line", workloadNames[nWorkload], dNanos);
+#if INFONES_DRAW8 && INFONES_BG_CACHE
+    printf("  bg cache %5.1f%% hits, %lu lines bypassed",
+           BgCacheHits * 100.0 / (BgCacheHits + BgCacheMisses ? BgCacheHits + BgCacheMisses : 1),
+           (unsigned long)BgCacheBypasses);
+#endif
+#if INFONES_CHR_CACHE
+    printf("  chr cache %lu hits, %lu banks decoded", (unsigned long)ChrCacheHits, (unsigned long)ChrCacheMisses);
+#endif
+    printf("\n");
+  }
+#if INFONES_DRAW8 && INFONES_BG_CACHE
+  printf("bg cache %lu bytes\n", (unsigned long)BgCacheBytes);
+#endif
+#if INFONES_CHR_CACHE
+  printf("chr cache %lu bytes\n", (unsigned long)ChrCacheBytes);
+#endif
+  printf("hash %08lX\n", (unsigned long)dwHash);
+
+  if (argc > 2 && dwHash != strtoul(argv[2], NULL, 16))
+  {
+    printf("hash mismatch, %s expected\n", argv[2]);
+    return 1;
+  }
+
+#if INFONES_DEFERRED_RENDER
+  // The same frames with the scanlines rendered by a worker thread
+  uint32_t dwSyncHash = 2166136261u;
+  uint32_t dwDeferredHash = 2166136261u;
+  const int nThreadFrames = nFrames / 4 > 1 ? nFrames / 4 : 1;
+  const double dSyncNanos = renderFrames(nThreadFrames, false, dwSyncHash);
+  const double dDeferredNanos = renderFrames(nThreadFrames, true, dwDeferredHash);
+  printf("worker thread %8.1f ns/line on this thread, %8.1f ns/line rendered here ( %u cpus ), %s\n",
+         dDeferredNanos, dSyncNanos, std::thread::hardware_concurrency(),
+         dwDeferredHash == dwSyncHash ? "ok" : "FAILED");
+  if (dwDeferredHash != dwSyncHash)
+    return 1;
+#endif
+
+#if INFONES_PPU_CATCHUP
+  // After the hash, which is the same with and without the catch-up rendering
+  const int nCatchUpErrors = checkCatchUp(nFrames * NES_DISP_HEIGHT / 4);
+  printf("catch-up %s\n", nCatchUpErrors ? "FAILED" : "ok");
+  if (nCatchUpErrors)
+    return 1;
+#endif
+  return 0;
+}
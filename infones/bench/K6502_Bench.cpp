@@ -0,0 +1,306 @@
+/*===================================================================*/
+/*                                                                   */
+/*  K6502_Bench.cpp : Host benchmark for the K6502 core              */
+/*                                                                   */
+/*  Runs a fixed 6502 workload on a flat 64KB memory and reports     */
+/*  host time and TSC ticks per emulated instruction, so that core   */
+/*  configurations can be compared build against build.              */
+/*  Given a .nes file, it runs the PRG-ROM of the game instead.      */
+/*                                                                   */
+/*===================================================================*/
+
+#include "K6502.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAS_TSC 1
+#else
+#define BENCH_HAS_TSC 0
+#endif
+
+/*-------------------------------------------------------------------*/
+/*  Resources                                                        */
+/*-------------------------------------------------------------------*/
+
+BYTE K6502_FlatMemory[0x10000];
+BYTE K6502_FlatPrgBank[4] = {0, 1, 2, 3};
+unsigned long long K6502_BenchInstructions;
+
+namespace
+{
+  // Scanline slice ( InfoNES_Cycle() alternates 113 and 114 clocks )
+  constexpr int STEP_PER_SCANLINE = 114;
+  constexpr int SCANLINES_PER_FRAME = 262;
+  constexpr int SCANLINE_VBLANK_START = 241;
+  constexpr int SCANLINE_VBLANK_END = 261;
+
+  /*
+   *  Workload : a table transform loop and a shift/rotate subroutine
+   *
+   *  8000: LDX #$00
+   *  8002: LDA $0200,X
+   *  8005: CLC
+   *  8006: ADC #$03
+   *  8008: STA $0300,X
+   *  800B: LDA $10
+   *  800D: EOR $0300,X
+   *  8010: STA $10
+   *  8012: INX
+   *  8013: BNE $8002
+   *  8015: INC $11
+   *  8017: JSR $8020
+   *  801A: JMP $8000
+   *  8020: LDY #$08
+   *  8022: ASL $12
+   *  8024: ROL $13
+   *  8026: DEY
+   *  8027: BNE $8022
+   *  8029: LDA ($14),Y
+   *  802B: CMP #$80
+   *  802D: BCC $8031
+   *  802F: SBC #$40
+   *  8031: STA $0400
+   *  8034: RTS
+   */
+  const BYTE workload[] = {
+      0xA2, 0x00,
+      0xBD, 0x00, 0x02,
+      0x18,
+      0x69, 0x03,
+      0x9D, 0x00, 0x03,
+      0xA5, 0x10,
+      0x5D, 0x00, 0x03,
+      0x85, 0x10,
+      0xE8,
+      0xD0, 0xED,
+      0xE6, 0x11,
+      0x20, 0x20, 0x80,
+      0x4C, 0x00, 0x80,
+      0x00, 0x00, 0x00,
+      0xA0, 0x08,
+      0x06, 0x12,
+      0x26, 0x13,
+      0x88,
+      0xD0, 0xF9,
+      0xB1, 0x14,
+      0xC9, 0x80,
+      0x90, 0x02,
+      0xE9, 0x40,
+      0x8D, 0x00, 0x04,
+      0x60,
+  };
+
+  void setupMemory()
+  {
+    memset(K6502_FlatMemory, 0, sizeof K6502_FlatMemory);
+    memcpy(&K6502_FlatMemory[0x8000], workload, sizeof workload);
+
+    for (int i = 0; i < 256; ++i)
+      K6502_FlatMemory[0x0200 + i] = (BYTE)(i * 7 + 1);
+
+    // ($14) points at the table
+    K6502_FlatMemory[0x14] = 0x00;
+    K6502_FlatMemory[0x15] = 0x02;
+    K6502_FlatMemory[0x12] = 0x5a;
+
+    K6502_FlatMemory[VECTOR_RESET] = 0x00;
+    K6502_FlatMemory[VECTOR_RESET + 1] = 0x80;
+  }
+
+  /*
+   *  Load the PRG-ROM of an iNES file
+   *
+   *  The first 16KB bank goes to 0x8000 and the last one to 0xc000,
+   *  which is the power-on layout of NROM and most simple mappers.
+   *  Mapper writes are ignored, so larger games stay in that layout.
+   *  Recompiled code of the game is selected when the build has it.
+   */
+  bool loadROM(const char *pszFileName)
+  {
+    FILE *fp = fopen(pszFileName, "rb");
+    if (!fp)
+    {
+      fprintf(stderr, "cannot open %s\n", pszFileName);
+      return false;
+    }
+
+    BYTE header[16];
+    bool ok = fread(header, sizeof header, 1, fp) == 1 && memcmp(header, "NES\x1a", 4) == 0 && header[4] > 0;
+    if (ok && (header[6] & 4))
+      ok = fseek(fp, 512, SEEK_CUR) == 0; // trainer
+
+    const int nBanks = ok ? header[4] : 0;
+    std::vector<BYTE> prg(nBanks * 0x4000);
+    if (ok)
+      ok = fread(prg.data(), prg.size(), 1, fp) == 1;
+    fclose(fp);
+
+    if (!ok)
+    {
+      fprintf(stderr, "%s is not an iNES file\n", pszFileName);
+      return false;
+    }
+
+    memcpy(&K6502_FlatMemory[0x8000], &prg[0], 0x4000);
+    memcpy(&K6502_FlatMemory[0xc000], &prg[(nBanks - 1) * 0x4000], 0x4000);
+    K6502_FlatPrgBank[0] = 0;
+    K6502_FlatPrgBank[1] = 1;
+    K6502_FlatPrgBank[2] = nBanks * 2 - 2;
+    K6502_FlatPrgBank[3] = nBanks * 2 - 1;
+    K6502_AotSelect(prg.data(), prg.size());
+    return true;
+  }
+
+  /*
+   *  Stand-in for the PPU of a ROM run : the V-Blank flag in $2002 and
+   *  the NMI at the start of V-Blank when $2000 enables it
+   */
+  void scanline(int nLine)
+  {
+    if (nLine == SCANLINE_VBLANK_START)
+    {
+      K6502_FlatMemory[0x2002] |= 0x80;
+      if (K6502_FlatMemory[0x2000] & 0x80)
+        NMI_REQ;
+    }
+    else if (nLine == SCANLINE_VBLANK_END)
+    {
+      K6502_FlatMemory[0x2002] &= ~0x80;
+    }
+  }
+
+  DWORD checksum()
+  {
+    DWORD sum = 0;
+    for (int i = 0; i < 0x10000; ++i)
+      sum = sum * 31 + K6502_FlatMemory[i];
+    return sum;
+  }
+
+  const char *configName()
+  {
+#if K6502_THREADED_DISPATCH && K6502_LAZY_FLAGS
+    return "threaded dispatch, lazy flags";
+#elif K6502_THREADED_DISPATCH && K6502_DECODE_CACHE
+    return "threaded dispatch, instruction cache";
+#elif K6502_THREADED_DISPATCH && K6502_BLOCK_CACHE
+    return "threaded dispatch, block cache";
+#elif K6502_THREADED_DISPATCH
+    return "threaded dispatch";
+#elif K6502_LAZY_FLAGS
+    return "switch dispatch, lazy flags";
+#elif K6502_DECODE_CACHE
+    return "switch dispatch, instruction cache";
+#elif K6502_BLOCK_CACHE
+    return "switch dispatch, block cache";
+#elif defined(K6502_AOT_FILE)
+    return "switch dispatch, recompiled ROM code";
+#else
+    return "switch dispatch";
+#endif
+  }
+
+  const char *fusionName()
+  {
+#if K6502_FUSION
+    return "superinstructions";
+#else
+    return "no superinstructions";
+#endif
+  }
+}
+
+int main(int argc, char **argv)
+{
+  int frames = argc > 1 ? atoi(argv[1]) : 2000;
+  if (frames <= 0 || argc > 3)
+  {
+    fprintf(stderr, "usage: %s [frames [rom.nes]]\n", argv[0]);
+    return 1;
+  }
+
+  const char *pszROM = argc > 2 ? argv[2] : NULL;
+  setupMemory();
+  if (pszROM)
+  {
+    memset(K6502_FlatMemory, 0, sizeof K6502_FlatMemory);
+    if (!loadROM(pszROM))
+      return 1;
+  }
+  K6502_Init();
+  K6502_Reset();
+  K6502_BenchInstructions = 0;
+
+  const long long slices = (long long)frames * SCANLINES_PER_FRAME;
+
+  auto t0 = std::chrono::steady_clock::now();
+#if BENCH_HAS_TSC
+  auto tsc0 = __rdtsc();
+#endif
+
+  for (long long i = 0; i < slices; ++i)
+  {
+    if (pszROM)
+      scanline((int)(i % SCANLINES_PER_FRAME));
+    K6502_Step(STEP_PER_SCANLINE);
+  }
+
+#if BENCH_HAS_TSC
+  auto tsc1 = __rdtsc();
+#endif
+  auto t1 = std::chrono::steady_clock::now();
+
+  const double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+  const double cycles = (double)slices * STEP_PER_SCANLINE;
+  const double instructions = (double)K6502_BenchInstructions;
+
+  printf("k6502_bench (%s, %s)\n", configName(), fusionName());
+  if (pszROM)
+    printf("  rom      : %s\n", pszROM);
+  printf("  emulated : %.0f cycles, %.0f instructions (%.2f cycles/instr)\n",
+         cycles, instructions, cycles / instructions);
+  printf("  host     : %.1f ms, %.2f ns/instr", ns / 1e6, ns / instructions);
+#if BENCH_HAS_TSC
+  printf(", %.2f TSC ticks/instr", (double)(tsc1 - tsc0) / instructions);
+#endif
+  printf("\n");
+  printf("  speed    : %.1f emulated MHz, %.1f M instr/s\n",
+         cycles / ns * 1e3, instructions / ns * 1e3);
+  printf("  state    : PC=%04X A=%02X X=%02X Y=%02X SP=%02X F=%02X mem=%08lX\n",
+         g_Context.PC, g_Context.A, g_Context.X, g_Context.Y, g_Context.SP, g_Context.F,
+         (unsigned long)checksum());
+#if K6502_FUSION
+  printf("  fusion   : %lu dispatches saved (%.0f per frame, %.2f%% of instructions)\n",
+         (unsigned long)g_dwFusedDispatches, (double)g_dwFusedDispatches / frames,
+         100.0 * g_dwFusedDispatches / instructions);
+#endif
+#if K6502_DECODE_CACHE
+  printf("  icache   : %lu hits, %lu misses (%.2f%% hit rate)\n",
+         (unsigned long)g_dwDecodeHits, (unsigned long)g_dwDecodeMisses,
+         100.0 * g_dwDecodeHits / ((double)g_dwDecodeHits + g_dwDecodeMisses));
+#endif
+#if K6502_BLOCK_CACHE
+  printf("  blocks   : %lu runs, %lu translations, %.2f instr/block, %.2f%% of instructions\n",
+         (unsigned long)g_dwBlockRuns, (unsigned long)g_dwBlockTranslations,
+         (double)g_dwBlockInstructions / g_dwBlockRuns, 100.0 * g_dwBlockInstructions / instructions);
+#endif
+#ifdef K6502_AOT_FILE
+  printf("  aot      : %lu instructions recompiled (%.2f%%), %lu lookups to the interpreter\n",
+         (unsigned long)g_dwAotInstructions, 100.0 * g_dwAotInstructions / instructions,
+         (unsigned long)g_dwAotMisses);
+#endif
+#if K6502_PROFILE
+  K6502_ProfileDump();
+#endif
+#if K6502_TRACE
+  K6502_TraceDump();
+#endif
+
+  return 0;
+}
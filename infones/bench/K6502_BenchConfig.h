@@ -0,0 +1,33 @@
+/*===================================================================*/
+/*                                                                   */
+/*  K6502_BenchConfig.h : K6502 build options for the host benchmark */
+/*                        Force-included into every bench source     */
+/*                                                                   */
+/*===================================================================*/
+
+#ifndef K6502_BENCHCONFIG_H_INCLUDED
+#define K6502_BENCHCONFIG_H_INCLUDED
+
+/* Use the flat 64KB memory instead of the NES memory map */
+#define K6502_RW_HEADER "K6502_rw_flat.h"
+
+/* Count executed instructions */
+extern unsigned long long K6502_BenchInstructions;
+#define K6502_INSTRUCTION_HOOK(byCode) ++K6502_BenchInstructions
+
+/* K6502.cpp default, the bench reports what superinstructions saved */
+#ifndef K6502_FUSION
+#define K6502_FUSION 1
+#endif
+
+/* K6502.cpp default, the bench prints the profile when there is one */
+#ifndef K6502_PROFILE
+#define K6502_PROFILE 0
+#endif
+
+/* K6502.cpp default, the bench dumps the trace when there is one */
+#ifndef K6502_TRACE
+#define K6502_TRACE 0
+#endif
+
+#endif /* !K6502_BENCHCONFIG_H_INCLUDED */
@@ -0,0 +1,436 @@
+/*===================================================================*/
+/*                                                                   */
+/*  K6502_Conformance.cpp : Host conformance harness for K6502       */
+/*                                                                   */
+/*  Checks the clocks of every documented opcode against the 6502    */
+/*  cycle table, runs functional test binaries ( e.g. the 6502       */
+/*  functional test of Klaus Dormann, built without decimal mode )   */
+/*  and reports the throughput of each opcode group, on the same     */
+/*  flat 64KB memory as the benchmark.                               */
+/*                                                                   */
+/*===================================================================*/
+
+#include "K6502.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+/*-------------------------------------------------------------------*/
+/*  Resources                                                        */
+/*-------------------------------------------------------------------*/
+
+BYTE K6502_FlatMemory[0x10000];
+BYTE K6502_FlatPrgBank[4] = {0, 1, 2, 3};
+unsigned long long K6502_BenchInstructions;
+
+namespace
+{
+  /*
+   *  Cycle table of the documented opcodes
+   *
+   *  "mnemonic mode clocks", a '*' after the clocks is a clock more
+   *  when the indexed address crosses a page, NULL is not documented.
+   *  Branches take a clock more when taken and another across a page.
+   */
+  const char *const cycleTable[256] = {
+      /* 0x00 */ "BRK IMP 7", "ORA IZX 6", NULL, NULL, NULL, "ORA ZP 3", "ASL ZP 5", NULL,
+      /* 0x08 */ "PHP IMP 3", "ORA IMM 2", "ASL ACC 2", NULL, NULL, "ORA ABS 4", "ASL ABS 6", NULL,
+      /* 0x10 */ "BPL REL 2", "ORA IZY 5*", NULL, NULL, NULL, "ORA ZPX 4", "ASL ZPX 6", NULL,
+      /* 0x18 */ "CLC IMP 2", "ORA ABY 4*", NULL, NULL, NULL, "ORA ABX 4*", "ASL ABX 7", NULL,
+      /* 0x20 */ "JSR ABS 6", "AND IZX 6", NULL, NULL, "BIT ZP 3", "AND ZP 3", "ROL ZP 5", NULL,
+      /* 0x28 */ "PLP IMP 4", "AND IMM 2", "ROL ACC 2", NULL, "BIT ABS 4", "AND ABS 4", "ROL ABS 6", NULL,
+      /* 0x30 */ "BMI REL 2", "AND IZY 5*", NULL, NULL, NULL, "AND ZPX 4", "ROL ZPX 6", NULL,
+      /* 0x38 */ "SEC IMP 2", "AND ABY 4*", NULL, NULL, NULL, "AND ABX 4*", "ROL ABX 7", NULL,
+      /* 0x40 */ "RTI IMP 6", "EOR IZX 6", NULL, NULL, NULL, "EOR ZP 3", "LSR ZP 5", NULL,
+      /* 0x48 */ "PHA IMP 3", "EOR IMM 2", "LSR ACC 2", NULL, "JMP ABS 3", "EOR ABS 4", "LSR ABS 6", NULL,
+      /* 0x50 */ "BVC REL 2", "EOR IZY 5*", NULL, NULL, NULL, "EOR ZPX 4", "LSR ZPX 6", NULL,
+      /* 0x58 */ "CLI IMP 2", "EOR ABY 4*", NULL, NULL, NULL, "EOR ABX 4*", "LSR ABX 7", NULL,
+      /* 0x60 */ "RTS IMP 6", "ADC IZX 6", NULL, NULL, NULL, "ADC ZP 3", "ROR ZP 5", NULL,
+      /* 0x68 */ "PLA IMP 4", "ADC IMM 2", "ROR ACC 2", NULL, "JMP IND 5", "ADC ABS 4", "ROR ABS 6", NULL,
+      /* 0x70 */ "BVS REL 2", "ADC IZY 5*", NULL, NULL, NULL, "ADC ZPX 4", "ROR ZPX 6", NULL,
+      /* 0x78 */ "SEI IMP 2", "ADC ABY 4*", NULL, NULL, NULL, "ADC ABX 4*", "ROR ABX 7", NULL,
+      /* 0x80 */ NULL, "STA IZX 6", NULL, NULL, "STY ZP 3", "STA ZP 3", "STX ZP 3", NULL,
+      /* 0x88 */ "DEY IMP 2", NULL, "TXA IMP 2", NULL, "STY ABS 4", "STA ABS 4", "STX ABS 4", NULL,
+      /* 0x90 */ "BCC REL 2", "STA IZY 6", NULL, NULL, "STY ZPX 4", "STA ZPX 4", "STX ZPY 4", NULL,
+      /* 0x98 */ "TYA IMP 2", "STA ABY 5", "TXS IMP 2", NULL, NULL, "STA ABX 5", NULL, NULL,
+      /* 0xA0 */ "LDY IMM 2", "LDA IZX 6", "LDX IMM 2", NULL, "LDY ZP 3", "LDA ZP 3", "LDX ZP 3", NULL,
+      /* 0xA8 */ "TAY IMP 2", "LDA IMM 2", "TAX IMP 2", NULL, "LDY ABS 4", "LDA ABS 4", "LDX ABS 4", NULL,
+      /* 0xB0 */ "BCS REL 2", "LDA IZY 5*", NULL, NULL, "LDY ZPX 4", "LDA ZPX 4", "LDX ZPY 4", NULL,
+      /* 0xB8 */ "CLV IMP 2", "LDA ABY 4*", "TSX IMP 2", NULL, "LDY ABX 4*", "LDA ABX 4*", "LDX ABY 4*", NULL,
+      /* 0xC0 */ "CPY IMM 2", "CMP IZX 6", NULL, NULL, "CPY ZP 3", "CMP ZP 3", "DEC ZP 5", NULL,
+      /* 0xC8 */ "INY IMP 2", "CMP IMM 2", "DEX IMP 2", NULL, "CPY ABS 4", "CMP ABS 4", "DEC ABS 6", NULL,
+      /* 0xD0 */ "BNE REL 2", "CMP IZY 5*", NULL, NULL, NULL, "CMP ZPX 4", "DEC ZPX 6", NULL,
+      /* 0xD8 */ "CLD IMP 2", "CMP ABY 4*", NULL, NULL, NULL, "CMP ABX 4*", "DEC ABX 7", NULL,
+      /* 0xE0 */ "CPX IMM 2", "SBC IZX 6", NULL, NULL, "CPX ZP 3", "SBC ZP 3", "INC ZP 5", NULL,
+      /* 0xE8 */ "INX IMP 2", "SBC IMM 2", "NOP IMP 2", NULL, "CPX ABS 4", "SBC ABS 4", "INC ABS 6", NULL,
+      /* 0xF0 */ "BEQ REL 2", "SBC IZY 5*", NULL, NULL, NULL, "SBC ZPX 4", "INC ZPX 6", NULL,
+      /* 0xF8 */ "SED IMP 2", "SBC ABY 4*", NULL, NULL, NULL, "SBC ABX 4*", "INC ABX 7", NULL,
+  };
+
+  // Where a test instruction is placed, and the data that it works on
+  constexpr WORD CODE = 0x8000;
+  constexpr WORD CODE_CROSS = 0x80f0; /* a branch from here crosses a page */
+  constexpr WORD DATA = 0x0300;
+  constexpr WORD DATA_CROSS = 0x02f0; /* + 0x20 crosses a page */
+  constexpr WORD TARGET = 0x8100;     /* JMP, JSR, RTS, RTI and BRK go here */
+
+  /*
+   *  Prepare the memory, the registers and the caches for a run from PC
+   */
+  void setupRun(WORD wPC, BYTE byF, BYTE byIndex)
+  {
+    g_Context.PC = wPC;
+    g_Context.A = 0x40;
+    g_Context.X = byIndex;
+    g_Context.Y = byIndex;
+    g_Context.SP = 0xfb;
+    g_Context.F = byF | FLAG_R;
+    // N and Z as K6502_LAZY_FLAGS keeps them between slices
+    g_Context.NZ = ((byF & FLAG_N) << 1) | ((byF & FLAG_Z) ^ FLAG_Z);
+    g_Context.wPassedClocks = 0;
+
+    // The code changed under the instruction and block caches
+    for (int nBank = 0; nBank < 4; ++nBank)
+      K6502_InvalidateBank(nBank);
+  }
+
+  /*
+   *  Clocks of a test instruction
+   *
+   *  The operands point at DATA, or at DATA_CROSS with X = Y = 0x20
+   *  when bCross is set. Branches are taken when bTaken is set.
+   */
+  int runInstruction(BYTE byCode, const char *pszMode, bool bCross, bool bTaken)
+  {
+    memset(K6502_FlatMemory, 0, sizeof K6502_FlatMemory);
+
+    const WORD wData = bCross ? DATA_CROSS : DATA;
+    const BYTE byIndex = bCross ? 0x20 : 0x00;
+    const WORD wPC = (bCross && !strcmp(pszMode, "REL")) ? CODE_CROSS : CODE;
+
+    // Zero page pointers for (Indirect,X) and (Indirect),Y
+    for (int i = 0x10; i < 0x40; i += 2)
+    {
+      K6502_FlatMemory[i] = wData & 0xff;
+      K6502_FlatMemory[i + 1] = wData >> 8;
+    }
+    // JMP (Indirect), the return address of RTS and RTI, and the BRK vector
+    K6502_FlatMemory[wData] = TARGET & 0xff;
+    K6502_FlatMemory[wData + 1] = TARGET >> 8;
+    K6502_FlatMemory[0x01fc] = FLAG_R;
+    K6502_FlatMemory[0x01fd] = TARGET & 0xff;
+    K6502_FlatMemory[0x01fe] = TARGET >> 8;
+    K6502_FlatMemory[VECTOR_IRQ] = TARGET & 0xff;
+    K6502_FlatMemory[VECTOR_IRQ + 1] = TARGET >> 8;
+
+    K6502_FlatMemory[wPC] = byCode;
+    if (!strcmp(pszMode, "REL"))
+    {
+      K6502_FlatMemory[wPC + 1] = 0x10;
+    }
+    else if (!strncmp(pszMode, "ZP", 2) || !strncmp(pszMode, "IZ", 2) || !strcmp(pszMode, "IMM"))
+    {
+      K6502_FlatMemory[wPC + 1] = 0x10;
+    }
+    else if (strcmp(pszMode, "IMP") && strcmp(pszMode, "ACC"))
+    {
+      WORD wOperand = (byCode == 0x20 || byCode == 0x4c) ? TARGET : wData;
+      K6502_FlatMemory[wPC + 1] = wOperand & 0xff;
+      K6502_FlatMemory[wPC + 2] = wOperand >> 8;
+    }
+
+    // The flags that take the branch ( or not )
+    BYTE byF = 0;
+    switch (byCode)
+    {
+    case 0x10: byF = bTaken ? 0 : FLAG_N; break; // BPL
+    case 0x30: byF = bTaken ? FLAG_N : 0; break; // BMI
+    case 0x50: byF = bTaken ? 0 : FLAG_V; break; // BVC
+    case 0x70: byF = bTaken ? FLAG_V : 0; break; // BVS
+    case 0x90: byF = bTaken ? 0 : FLAG_C; break; // BCC
+    case 0xb0: byF = bTaken ? FLAG_C : 0; break; // BCS
+    case 0xd0: byF = bTaken ? 0 : FLAG_Z; break; // BNE
+    case 0xf0: byF = bTaken ? FLAG_Z : 0; break; // BEQ
+    }
+    setupRun(wPC, byF, byIndex);
+
+    // A slice of one clock runs one instruction
+    QWORD qwStart = getPassedClocks();
+    K6502_Step(1);
+    return (int)(getPassedClocks() - qwStart);
+  }
+
+  /*
+   *  Check the clocks of the documented opcodes, returns the mismatches
+   */
+  int checkCycles()
+  {
+    int nErrors = 0;
+    int nChecks = 0;
+
+    for (int nCode = 0; nCode < 256; ++nCode)
+    {
+      if (!cycleTable[nCode])
+        continue;
+
+      char szMnemonic[4];
+      char szMode[4];
+      char szClocks[4];
+      sscanf(cycleTable[nCode], "%3s %3s %3s", szMnemonic, szMode, szClocks);
+      const int nClocks = atoi(szClocks);
+      const bool bPageCross = szClocks[1] == '*';
+      const bool bBranch = !strcmp(szMode, "REL");
+
+      struct
+      {
+        const char *pszCase;
+        bool bCross;
+        bool bTaken;
+        int nExpected;
+      } cases[] = {
+          {"", false, false, nClocks},
+          {"page cross", true, false, nClocks + 1},
+          {"taken", false, true, nClocks + 1},
+          {"taken, page cross", true, true, nClocks + 2},
+      };
+
+      for (const auto &c : cases)
+      {
+        if ((c.bTaken && !bBranch) || (c.bCross && !bPageCross && !(bBranch && c.bTaken)))
+          continue;
+
+        int nActual = runInstruction((BYTE)nCode, szMode, c.bCross, c.bTaken);
+        ++nChecks;
+        if (nActual != c.nExpected)
+        {
+          printf("  %02X %s %s%s%s: %d clocks, expected %d\n", nCode, szMnemonic, szMode,
+                 *c.pszCase ? ", " : "", c.pszCase, nActual, c.nExpected);
+          ++nErrors;
+        }
+      }
+    }
+
+    printf("cycles     : %d checks, %d mismatches\n", nChecks, nErrors);
+    return nErrors;
+  }
+
+  /*
+   *  Run a functional test binary
+   *
+   *  The 64KB image runs from wStart until it traps in a jump or a
+   *  branch to itself, which passes at wSuccess and fails elsewhere.
+   */
+  bool runFunctional(const char *pszFileName, WORD wStart, WORD wSuccess)
+  {
+    FILE *fp = fopen(pszFileName, "rb");
+    if (!fp)
+    {
+      fprintf(stderr, "cannot open %s\n", pszFileName);
+      return false;
+    }
+    memset(K6502_FlatMemory, 0, sizeof K6502_FlatMemory);
+    size_t nSize = fread(K6502_FlatMemory, 1, sizeof K6502_FlatMemory, fp);
+    fclose(fp);
+
+    K6502_Reset();
+    setupRun(wStart, 0, 0);
+    g_Context.A = g_Context.X = g_Context.Y = 0;
+    g_Context.SP = 0xff;
+
+    // Up to 10 seconds of NES time
+    const QWORD qwLimit = 10ull * 1789773;
+    QWORD qwCycles = 0;
+    unsigned long long nStart = K6502_BenchInstructions;
+    WORD wLast = g_Context.PC;
+    int nSame = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    while (qwCycles < qwLimit)
+    {
+      // One instruction a slice, so that the trap is seen at once
+      QWORD qwBefore = getPassedClocks();
+      K6502_Step(1);
+      qwCycles += getPassedClocks() - qwBefore;
+      g_Context.wPassedClocks = 0;
+
+      // A trap runs the same instruction again and again
+      nSame = g_Context.PC == wLast ? nSame + 1 : 0;
+      wLast = g_Context.PC;
+      if (nSame >= 2)
+        break;
+    }
+    auto t1 = std::chrono::steady_clock::now();
+
+    const double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+    const double cycles = (double)qwCycles;
+    const double instructions = (double)(K6502_BenchInstructions - nStart);
+    const bool bPassed = nSame >= 2 && wLast == wSuccess;
+
+    printf("functional : %s (%lu bytes) %s at PC=%04X, %.0f instructions, %.0f cycles\n",
+           pszFileName, (unsigned long)nSize, bPassed ? "passed" : "FAILED", wLast, instructions, cycles);
+    printf("             A=%02X X=%02X Y=%02X SP=%02X F=%02X, %.1f M instr/s\n",
+           g_Context.A, g_Context.X, g_Context.Y, g_Context.SP, g_Context.F, instructions / ns * 1e3);
+    return bPassed;
+  }
+
+  /*
+   *  Throughput of an opcode group
+   *
+   *  The instructions of a group are repeated to fill a loop at CODE,
+   *  which is run in scanline slices like the benchmark.
+   */
+  struct opcode_group_tag
+  {
+    const char *pszName;
+    std::vector<BYTE> code;
+  };
+
+  const opcode_group_tag opcodeGroups[] = {
+      {"load/store",
+       {
+           0xa5, 0x10,         // LDA $10
+           0x8d, 0x00, 0x03,   // STA $0300
+           0xa2, 0x04,         // LDX #$04
+           0xbc, 0x00, 0x03,   // LDY $0300,X
+           0x86, 0x20,         // STX $20
+           0xb1, 0x10,         // LDA ($10),Y
+           0x95, 0x30          // STA $30,X
+       }},
+      {"alu",
+       {
+           0x69, 0x03,         // ADC #$03
+           0xe5, 0x10,         // SBC $10
+           0x2d, 0x00, 0x03,   // AND $0300
+           0x09, 0x81,         // ORA #$81
+           0x45, 0x11,         // EOR $11
+           0xc9, 0x40,         // CMP #$40
+           0xe0, 0x10,         // CPX #$10
+           0x24, 0x12          // BIT $12
+       }},
+      {"read-modify-write",
+       {
+           0xe6, 0x20,         // INC $20
+           0xce, 0x00, 0x03,   // DEC $0300
+           0x06, 0x21,         // ASL $21
+           0x4a,               // LSR A
+           0x2e, 0x01, 0x03,   // ROL $0301
+           0x76, 0x22          // ROR $22,X
+       }},
+      {"branch",
+       {
+           0x18,               // CLC
+           0x90, 0x00,         // BCC +0 ( taken )
+           0x38,               // SEC
+           0x90, 0x00,         // BCC +0 ( not taken )
+           0xa2, 0x01,         // LDX #$01
+           0xd0, 0x00,         // BNE +0 ( taken )
+           0xf0, 0x00          // BEQ +0 ( not taken )
+       }},
+      {"transfer/flags",
+       {
+           0xaa,               // TAX
+           0x8a,               // TXA
+           0xe8,               // INX
+           0x88,               // DEY
+           0x18,               // CLC
+           0x38,               // SEC
+           0xa8,               // TAY
+           0xea                // NOP
+       }},
+      {"stack/jump",
+       {
+           0x20, 0xf0, 0xbf,   // JSR $BFF0 ( RTS )
+           0x48,               // PHA
+           0x68,               // PLA
+           0x08,               // PHP
+           0x28                // PLP
+       }},
+  };
+
+  void runThroughput(const opcode_group_tag &group, long long nCycles)
+  {
+    memset(K6502_FlatMemory, 0, sizeof K6502_FlatMemory);
+    for (int i = 0x10; i < 0x40; ++i)
+      K6502_FlatMemory[i] = (BYTE)(i * 5);
+    K6502_FlatMemory[0xbff0] = 0x60; // RTS
+
+    // Repeat the group up to about 1KB, then jump back
+    WORD wPC = CODE;
+    while (wPC < CODE + 0x400)
+    {
+      memcpy(&K6502_FlatMemory[wPC], group.code.data(), group.code.size());
+      wPC += group.code.size();
+    }
+    K6502_FlatMemory[wPC] = 0x4c; // JMP CODE
+    K6502_FlatMemory[wPC + 1] = CODE & 0xff;
+    K6502_FlatMemory[wPC + 2] = CODE >> 8;
+
+    K6502_Reset();
+    setupRun(CODE, 0, 0);
+    unsigned long long nStart = K6502_BenchInstructions;
+
+    // Scanline slice ( InfoNES_Cycle() alternates 113 and 114 clocks )
+    constexpr int STEP_PER_SCANLINE = 114;
+    const long long slices = nCycles / STEP_PER_SCANLINE;
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (long long i = 0; i < slices; ++i)
+      K6502_Step(STEP_PER_SCANLINE);
+    auto t1 = std::chrono::steady_clock::now();
+
+    const double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+    const double cycles = (double)slices * STEP_PER_SCANLINE;
+    const double instructions = (double)(K6502_BenchInstructions - nStart);
+    printf("  %-18s: %7.1f M instr/s, %7.1f emulated MHz, %.2f cycles/instr\n",
+           group.pszName, instructions / ns * 1e3, cycles / ns * 1e3, cycles / instructions);
+  }
+
+  int usage(const char *pszName)
+  {
+    fprintf(stderr,
+            "usage: %s [cycles | throughput [cycles] | functional file.bin [start [success]]]\n"
+            "  cycles     : check the clocks of the documented opcodes\n"
+            "  throughput : instructions/s and cycles/s of each opcode group\n"
+            "  functional : run a 64KB test image from start ( hex, 0400 ) until it\n"
+            "               traps, it passes when the trap is at success ( hex, 3469 )\n"
+            "  with no arguments, cycles and throughput\n",
+            pszName);
+    return 2;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  K6502_Init();
+  K6502_Reset();
+
+  const char *pszCommand = argc > 1 ? argv[1] : NULL;
+
+  if (pszCommand && !strcmp(pszCommand, "functional"))
+  {
+    if (argc < 3 || argc > 5)
+      return usage(argv[0]);
+    WORD wStart = argc > 3 ? (WORD)strtoul(argv[3], NULL, 16) : 0x0400;
+    WORD wSuccess = argc > 4 ? (WORD)strtoul(argv[4], NULL, 16) : 0x3469;
+    return runFunctional(argv[2], wStart, wSuccess) ? 0 : 1;
+  }
+
+  bool bCycles = !pszCommand || !strcmp(pszCommand, "cycles");
+  bool bThroughput = !pszCommand || !strcmp(pszCommand, "throughput");
+  if ((!bCycles && !bThroughput) || argc > (bThroughput && pszCommand ? 3 : 2))
+    return usage(argv[0]);
+
+  int nErrors = bCycles ? checkCycles() : 0;
+
+  if (bThroughput)
+  {
+    long long nCycles = argc > 2 ? atoll(argv[2]) : 50000000;
+    printf("throughput : %lld emulated cycles per group\n", nCycles);
+    for (const auto &group : opcodeGroups)
+      runThroughput(group, nCycles);
+  }
+
+  return nErrors ? 1 : 0;
+}
@@ -0,0 +1,60 @@
+/*===================================================================*/
+/*                                                                   */
+/*  K6502_rw_flat.h : 6502 Reading/Writing Operation on a flat       */
+/*                    64KB memory for the host benchmark             */
+/*                    This file is included in K6502.cpp             */
+/*                                                                   */
+/*===================================================================*/
+
+#ifndef K6502_RW_FLAT_H_INCLUDED
+#define K6502_RW_FLAT_H_INCLUDED
+
+/* Flat 64KB address space ( defined by the benchmark ), 0x8000 - 0xffff is ROM */
+extern BYTE K6502_FlatMemory[0x10000];
+
+/* There are no mappers, every core runs the generic one */
+struct K6502_MapperAny
+{
+};
+
+static inline BYTE K6502_ReadZp(BYTE byAddr) { return K6502_FlatMemory[byAddr]; }
+template <class Mapper>
+static inline BYTE K6502_Read(WORD wAddr) { return K6502_FlatMemory[wAddr]; }
+template <class Mapper>
+static inline void K6502_Write(WORD wAddr, BYTE byData)
+{
+  if (wAddr < 0x8000)
+    K6502_FlatMemory[wAddr] = byData;
+}
+static inline bool K6502_IsIdleRead(WORD wAddr) { return true; }
+
+/* 8KB PRG-ROM bank of each window ( set by the benchmark ) */
+extern BYTE K6502_FlatPrgBank[4];
+static inline int K6502_PrgBank(int nWindow) { return K6502_FlatPrgBank[nWindow]; }
+
+// Reading/Writing operation (WORD version)
+template <class Mapper>
+static inline WORD K6502_ReadW(WORD wAddr) { return K6502_Read(wAddr) | (WORD)K6502_Read(wAddr + 1) << 8; };
+template <class Mapper>
+static inline void K6502_WriteW(WORD wAddr, WORD wData)
+{
+  K6502_Write(wAddr, wData & 0xff);
+  K6502_Write(wAddr + 1, wData >> 8);
+};
+static inline WORD K6502_ReadZpW(BYTE byAddr) { return K6502_ReadZp(byAddr) | (K6502_ReadZp(byAddr + 1) << 8); };
+
+// 6502's indirect absolute jmp(opcode: 6C) has a bug
+template <class Mapper>
+static inline WORD K6502_ReadW2(WORD wAddr)
+{
+  if (0x00ff == (wAddr & 0x00ff))
+  {
+    return K6502_Read(wAddr) | (WORD)K6502_Read(wAddr - 0x00ff) << 8;
+  }
+  else
+  {
+    return K6502_Read(wAddr) | (WORD)K6502_Read(wAddr + 1) << 8;
+  }
+}
+
+#endif /* !K6502_RW_FLAT_H_INCLUDED */
@@ -0,0 +1,20 @@
+/*===================================================================*/
+/*                                                                   */
+/*  hardware/timer.h : Host stand-in for the Pico SDK timer          */
+/*                                                                   */
+/*===================================================================*/
+
+#ifndef HARDWARE_TIMER_H_HOST_INCLUDED
+#define HARDWARE_TIMER_H_HOST_INCLUDED
+
+#include <chrono>
+#include <stdint.h>
+
+static inline uint32_t time_us_32()
+{
+  return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+#endif /* !HARDWARE_TIMER_H_HOST_INCLUDED */
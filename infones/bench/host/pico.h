@@ -0,0 +1,17 @@
+/*===================================================================*/
+/*                                                                   */
+/*  pico.h : Host stand-in for the Pico SDK header                   */
+/*                                                                   */
+/*===================================================================*/
+
+#ifndef PICO_H_HOST_INCLUDED
+#define PICO_H_HOST_INCLUDED
+
+#include <stdint.h>
+
+// Code placement is meaningless on the host
+#define __not_in_flash_func(func_name) func_name
+#define __not_in_flash(group)
+#define __uninitialized_ram(group) group
+
+#endif /* !PICO_H_HOST_INCLUDED */
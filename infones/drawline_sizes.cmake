@@ -0,0 +1,54 @@
+# Code size of the InfoNES_DrawLine variants ( INFONES_DRAWLINE_VARIANTS ) of a linked ELF, to keep
+# the code in RAM ( __not_in_flash_func ) in budget
+#   cmake -DNM=<nm> -DELF=<elf> -P drawline_sizes.cmake
+execute_process(
+    COMMAND ${NM} --print-size --demangle ${ELF}
+    OUTPUT_VARIABLE symbols
+    RESULT_VARIABLE result
+)
+if (result)
+    message(FATAL_ERROR "${NM} failed on ${ELF}")
+endif()
+
+# "<address> <size> t drawLine<mode>()", the mode is DRAW_LINE_MODE()
+string(REGEX MATCHALL "[0-9a-fA-F]+ [0-9a-fA-F]+ [tTwW] [^\n]*drawLine<-?[0-9]+>[^\n]*" lines "${symbols}")
+set(total 0)
+foreach(line IN LISTS lines)
+    string(REGEX MATCH "^[0-9a-fA-F]+ ([0-9a-fA-F]+) .*drawLine<(-?[0-9]+)>" matched "${line}")
+    math(EXPR size "0x${CMAKE_MATCH_1}")
+    set(mode ${CMAKE_MATCH_2})
+    math(EXPR total "${total} + ${size}")
+
+    set(desc "")
+    if (mode EQUAL -1)
+        set(desc " any")
+    else()
+        math(EXPR bg "${mode} & 0x08")
+        math(EXPR clipbg "${mode} & 0x02")
+        math(EXPR sp "${mode} & 0x10")
+        math(EXPR clipsp "${mode} & 0x04")
+        math(EXPR sp16 "${mode} & 0x20")
+        if (bg)
+            string(APPEND desc " bg")
+            if (NOT clipbg)
+                string(APPEND desc " clip")
+            endif()
+        endif()
+        if (sp)
+            if (sp16)
+                string(APPEND desc " sp 8x16")
+            else()
+                string(APPEND desc " sp 8x8")
+            endif()
+            if (NOT clipsp)
+                string(APPEND desc " clip")
+            endif()
+        endif()
+        if (desc STREQUAL "")
+            set(desc " off")
+        endif()
+    endif()
+    message("InfoNES_DrawLine mode ${mode}:${desc}, ${size} bytes")
+endforeach()
+list(LENGTH lines count)
+message("InfoNES_DrawLine ${count} variants, ${total} bytes")
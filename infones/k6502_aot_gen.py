@@ -0,0 +1,459 @@
+#!/usr/bin/env python3
+
+# Ahead-of-time recompiler of the PRG-ROM code of NES games for K6502.
+#
+#   k6502_aot_gen.py -o k6502_aot.inc game1.nes [game2.nes ...]
+#
+# The code reachable from the reset, NMI and IRQ vectors is traced and
+# written out as C++, one block per basic block, made of the operation
+# macros of K6502.cpp ( they call K6502_Read() / K6502_Write() as the
+# interpreter does ). K6502.cpp includes the output when it is built with
+# -DK6502_AOT_FILE="k6502_aot.inc", looks blocks up by ( 8KB PRG bank, PC )
+# and leaves everything that was not traced to the interpreter. Every
+# instruction of a block can be entered, since a slice may end anywhere.
+#
+# Bank switching is not followed: the tracer assumes the power-on layout
+# ( the first 16KB at 0x8000 and the last 16KB at 0xc000 ). Code of other
+# banks can be added with --entry BANK:ADDR, e.g. --entry 5:8000.
+#
+# The output only runs for a ROM whose PRG-ROM hash matches, so a build
+# with the code of a handful of games runs any other game interpreted.
+
+import argparse
+import os
+import sys
+
+# Opcodes that are recompiled ( the same set as the block cache of K6502.cpp ):
+# mnemonic, addressing mode, clocks without a page crossing
+OPCODES = {}
+
+
+def _ops(mnemonic, mode, *pairs):
+    for code, clocks in zip(pairs[::2], pairs[1::2]):
+        OPCODES[code] = (mnemonic, mode, clocks)
+
+
+for _m, _base in (('ORA', 0x00), ('AND', 0x20), ('EOR', 0x40), ('ADC', 0x60),
+                  ('LDA', 0xa0), ('CMP', 0xc0), ('SBC', 0xe0)):
+    _ops(_m, 'IX', _base + 0x01, 6)
+    _ops(_m, 'ZP', _base + 0x05, 3)
+    _ops(_m, 'IMM', _base + 0x09, 2)
+    _ops(_m, 'ABS', _base + 0x0d, 4)
+    _ops(_m, 'IY', _base + 0x11, 5)
+    _ops(_m, 'ZPX', _base + 0x15, 4)
+    _ops(_m, 'ABSY', _base + 0x19, 4)
+    _ops(_m, 'ABSX', _base + 0x1d, 4)
+for _m, _base in (('ASL', 0x00), ('ROL', 0x20), ('LSR', 0x40), ('ROR', 0x60)):
+    _ops(_m, 'ZP', _base + 0x06, 5)
+    _ops(_m, 'ACC', _base + 0x0a, 2)
+    _ops(_m, 'ABS', _base + 0x0e, 6)
+    _ops(_m, 'ZPX', _base + 0x16, 6)
+    _ops(_m, 'ABSX', _base + 0x1e, 7)
+_ops('STA', 'IX', 0x81, 6)
+_ops('STA', 'ZP', 0x85, 3)
+_ops('STA', 'ABS', 0x8d, 4)
+_ops('STA', 'IY', 0x91, 6)
+_ops('STA', 'ZPX', 0x95, 4)
+_ops('STA', 'ABSY', 0x99, 5)
+_ops('STA', 'ABSX', 0x9d, 5)
+_ops('STY', 'ZP', 0x84, 3)
+_ops('STY', 'ABS', 0x8c, 4)
+_ops('STY', 'ZPX', 0x94, 4)
+_ops('STX', 'ZP', 0x86, 3)
+_ops('STX', 'ABS', 0x8e, 4)
+_ops('STX', 'ZPY', 0x96, 4)
+_ops('LDY', 'IMM', 0xa0, 2)
+_ops('LDY', 'ZP', 0xa4, 3)
+_ops('LDY', 'ABS', 0xac, 4)
+_ops('LDY', 'ZPX', 0xb4, 4)
+_ops('LDY', 'ABSX', 0xbc, 4)
+_ops('LDX', 'IMM', 0xa2, 2)
+_ops('LDX', 'ZP', 0xa6, 3)
+_ops('LDX', 'ABS', 0xae, 4)
+_ops('LDX', 'ZPY', 0xb6, 4)
+_ops('LDX', 'ABSY', 0xbe, 4)
+_ops('CPY', 'IMM', 0xc0, 2)
+_ops('CPY', 'ZP', 0xc4, 3)
+_ops('CPY', 'ABS', 0xcc, 4)
+_ops('CPX', 'IMM', 0xe0, 2)
+_ops('CPX', 'ZP', 0xe4, 3)
+_ops('CPX', 'ABS', 0xec, 4)
+_ops('BIT', 'ZP', 0x24, 3)
+_ops('BIT', 'ABS', 0x2c, 4)
+_ops('DEC', 'ZP', 0xc6, 5)
+_ops('DEC', 'ABS', 0xce, 6)
+_ops('DEC', 'ZPX', 0xd6, 6)
+_ops('DEC', 'ABSX', 0xde, 7)
+_ops('INC', 'ZP', 0xe6, 5)
+_ops('INC', 'ABS', 0xee, 6)
+_ops('INC', 'ZPX', 0xf6, 6)
+_ops('INC', 'ABSX', 0xfe, 7)
+for _m, _code, _clocks in (('PHP', 0x08, 3), ('CLC', 0x18, 2), ('PLP', 0x28, 4), ('SEC', 0x38, 2),
+                           ('PHA', 0x48, 3), ('PLA', 0x68, 4), ('SEI', 0x78, 2), ('DEY', 0x88, 2),
+                           ('TXA', 0x8a, 2), ('TYA', 0x98, 2), ('TXS', 0x9a, 2), ('TAY', 0xa8, 2),
+                           ('TAX', 0xaa, 2), ('CLV', 0xb8, 2), ('TSX', 0xba, 2), ('INY', 0xc8, 2),
+                           ('DEX', 0xca, 2), ('CLD', 0xd8, 2), ('INX', 0xe8, 2), ('NOP', 0xea, 2),
+                           ('SED', 0xf8, 2)):
+    _ops(_m, 'IMP', _code, _clocks)
+for _m, _code in (('BPL', 0x10), ('BMI', 0x30), ('BVC', 0x50), ('BVS', 0x70),
+                  ('BCC', 0x90), ('BCS', 0xb0), ('BNE', 0xd0), ('BEQ', 0xf0)):
+    _ops(_m, 'REL', _code, 2)
+_ops('JSR', 'ABS', 0x20, 6)
+_ops('JMP', 'ABS', 0x4c, 3)
+_ops('JMP', 'IND', 0x6c, 5)
+_ops('RTS', 'IMP', 0x60, 6)
+
+LENGTH = {'IMP': 1, 'ACC': 1, 'IMM': 2, 'ZP': 2, 'ZPX': 2, 'ZPY': 2, 'IX': 2, 'IY': 2, 'REL': 2,
+          'ABS': 3, 'ABSX': 3, 'ABSY': 3, 'IND': 3}
+
+READ_OPS = ('LDA', 'LDX', 'LDY', 'ORA', 'AND', 'EOR', 'ADC', 'SBC', 'CMP', 'CPX', 'CPY', 'BIT')
+ADDRESS_OPS = ('STA', 'STX', 'STY', 'ASL', 'LSR', 'ROL', 'ROR', 'INC', 'DEC')
+EXIT_OPS = ('JSR', 'JMP', 'RTS', 'BPL', 'BMI', 'BVC', 'BVS', 'BCC', 'BCS', 'BNE', 'BEQ')
+
+# Implied operations in terms of the operation macros
+IMPLIED = {
+    'PHP': 'SETF(FLAG_B); PUSH(GETF());', 'PLP': 'POP(F); SETF(FLAG_R); LOADNZ();',
+    'PHA': 'PUSH(A);', 'PLA': 'POP(A); TEST(A);',
+    'CLC': 'RSTF(FLAG_C);', 'SEC': 'SETF(FLAG_C);', 'SEI': 'SETF(FLAG_I);',
+    'CLD': 'RSTF(FLAG_D);', 'SED': 'SETF(FLAG_D);', 'CLV': 'RSTF(FLAG_V);',
+    'INX': '++X; TEST(X);', 'INY': '++Y; TEST(Y);', 'DEX': '--X; TEST(X);', 'DEY': '--Y; TEST(Y);',
+    'TAX': 'X = A; TEST(X);', 'TXA': 'A = X; TEST(A);', 'TAY': 'Y = A; TEST(Y);',
+    'TYA': 'A = Y; TEST(A);', 'TSX': 'X = SP; TEST(X);', 'TXS': 'SP = X;', 'NOP': '',
+}
+
+# Branch conditions
+BRANCH = {'BPL': '!IS_N', 'BMI': 'IS_N', 'BVC': '!(F & FLAG_V)', 'BVS': '(F & FLAG_V)',
+          'BCC': '!(F & FLAG_C)', 'BCS': '(F & FLAG_C)', 'BNE': '!IS_Z', 'BEQ': 'IS_Z'}
+
+
+def fnv1a(data):
+    h = 0x811c9dc5
+    for b in data:
+        h = ((h ^ b) * 0x01000193) & 0xffffffff
+    return h
+
+
+def load_prg(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+    if len(data) < 16 or data[:4] != b'NES\x1a' or data[4] == 0:
+        sys.exit('%s is not an iNES file' % path)
+    start = 16 + (512 if data[6] & 4 else 0)
+    prg = data[start:start + data[4] * 0x4000]
+    if len(prg) != data[4] * 0x4000:
+        sys.exit('%s is truncated' % path)
+    return prg
+
+
+def power_on_layout(banks):
+    # 8KB PRG bank of each window ( 0x8000, 0xa000, 0xc000, 0xe000 )
+    if banks <= 4:
+        return [n % banks for n in range(4)]
+    return [0, 1, banks - 2, banks - 1]
+
+
+class Game:
+    def __init__(self, path, entries):
+        self.name = os.path.basename(path)
+        self.prg = load_prg(path)
+        self.banks = len(self.prg) // 0x2000
+        self.layout = power_on_layout(self.banks)
+        self.blocks = {}  # ( bank, PC ) -> instructions of the block
+        self.trace(entries)
+
+    def read(self, layout, addr):
+        return self.prg[layout[(addr >> 13) & 3] * 0x2000 + (addr & 0x1fff)]
+
+    def decode(self, layout, addr):
+        # ( code, mnemonic, mode, clocks, operand, length ) or None
+        code = self.read(layout, addr)
+        if code not in OPCODES:
+            return None
+        mnemonic, mode, clocks = OPCODES[code]
+        length = LENGTH[mode]
+        if ((addr + length - 1) & 0xe000) != (addr & 0xe000) or addr + length > 0x10000:
+            return None
+        operand = 0
+        if length == 2:
+            operand = self.read(layout, addr + 1)
+        elif length == 3:
+            operand = self.read(layout, addr + 1) | self.read(layout, addr + 2) << 8
+        return (code, mnemonic, mode, clocks, operand, length)
+
+    def trace(self, entries):
+        # Collect the leaders, then cut the code into blocks at them
+        work = [(list(self.layout), self.read(self.layout, v) | self.read(self.layout, v + 1) << 8)
+                for v in (0xfffc, 0xfffa, 0xfffe)]
+        for bank, addr in entries:
+            layout = list(self.layout)
+            layout[(addr >> 13) & 3] = bank
+            work.append((layout, addr))
+
+        seen = set()
+        starts = []
+        leaders = set()
+        while work:
+            layout, addr = work.pop()
+            if addr < 0x8000:
+                continue
+            key = (layout[(addr >> 13) & 3], addr)
+            leaders.add(key)
+            if key in seen:
+                continue
+            seen.add(key)
+            starts.append((layout, addr))
+
+            # Follow the instructions to the end of the basic block
+            while True:
+                op = self.decode(layout, addr)
+                if op is None:
+                    break
+                code, mnemonic, mode, clocks, operand, length = op
+                nxt = (addr + length) & 0xffff
+                if mnemonic in BRANCH:
+                    work.append((layout, (nxt + (operand ^ 0x80) - 0x80) & 0xffff))
+                    work.append((layout, nxt))
+                    break
+                if mnemonic == 'JSR':
+                    work.append((layout, operand))
+                    work.append((layout, nxt))
+                    break
+                if mnemonic == 'JMP':
+                    if mode == 'ABS' and operand != addr:
+                        work.append((layout, operand))
+                    break
+                if mnemonic == 'RTS':
+                    break
+                if may_switch_bank(mnemonic, mode, operand) or (nxt & 0xe000) != (addr & 0xe000):
+                    work.append((layout, nxt))
+                    break
+                addr = nxt
+
+        # A block that would not run an instruction is left to the interpreter
+        for layout, addr in starts:
+            if self.decode(layout, addr) is not None:
+                leaders.add((layout[(addr >> 13) & 3], addr))
+            else:
+                leaders.discard((layout[(addr >> 13) & 3], addr))
+        for layout, addr in starts:
+            bank = layout[(addr >> 13) & 3]
+            block = self.cut(layout, addr, leaders)
+            if block[0]:
+                self.blocks[(bank, addr)] = block
+
+    def cut(self, layout, addr, leaders):
+        # Instructions of the block at addr, and how it ends
+        bank = layout[(addr >> 13) & 3]
+        insns = []
+        while True:
+            op = self.decode(layout, addr)
+            if op is None or (op[1] == 'JMP' and op[2] == 'ABS' and op[4] == addr):
+                # Not recompiled, JMP to itself is counted as idle by the interpreter
+                return insns, ('lookup', addr)
+            code, mnemonic, mode, clocks, operand, length = op
+            insns.append((addr, op))
+            nxt = (addr + length) & 0xffff
+            if mnemonic in EXIT_OPS or mode == 'IND':
+                return insns, ('exit', None)
+            if may_switch_bank(mnemonic, mode, operand):
+                return insns, ('lookup', nxt)
+            if (nxt & 0xe000) != (addr & 0xe000):
+                return insns, ('lookup', nxt)
+            if (bank, nxt) in leaders:
+                return insns, ('chain', nxt)
+            addr = nxt
+
+
+def may_switch_bank(mnemonic, mode, operand):
+    # A write that may reach a mapper ( 0x4018 - 0xffff )
+    if mnemonic not in ADDRESS_OPS or mode == 'ACC':
+        return False
+    if mode in ('ZP', 'ZPX', 'ZPY'):
+        return False
+    if mode == 'ABS':
+        return operand >= 0x4018
+    if mode in ('ABSX', 'ABSY'):
+        return operand >= 0x4018 - 0xff
+    return True
+
+
+def value(mode, operand):
+    return {
+        'IMM': '0x%02X' % operand,
+        'ZP': 'K6502_ReadZp(0x%02X)' % operand,
+        'ZPX': 'K6502_ReadZp((BYTE)(0x%02X + X))' % operand,
+        'ZPY': 'K6502_ReadZp((BYTE)(0x%02X + Y))' % operand,
+        'ABS': 'K6502_Read(0x%04X)' % operand,
+        'ABSX': 'AOT_INDEXED(0x%04X, X)' % operand,
+        'ABSY': 'AOT_INDEXED(0x%04X, Y)' % operand,
+        'IX': 'K6502_Read(K6502_ReadZpW((BYTE)(0x%02X + X)))' % operand,
+        'IY': 'AOT_INDEXED(K6502_ReadZpW(0x%02X), Y)' % operand,
+    }[mode]
+
+
+def address(mode, operand):
+    return {
+        'ZP': '0x%02X' % operand,
+        'ZPX': '(BYTE)(0x%02X + X)' % operand,
+        'ZPY': '(BYTE)(0x%02X + Y)' % operand,
+        'ABS': '0x%04X' % operand,
+        'ABSX': '(WORD)(0x%04X + X)' % operand,
+        'ABSY': '(WORD)(0x%04X + Y)' % operand,
+        'IX': 'K6502_ReadZpW((BYTE)(0x%02X + X))' % operand,
+        'IY': '(WORD)(K6502_ReadZpW(0x%02X) + Y)' % operand,
+    }[mode]
+
+
+def disassemble(addr, op):
+    code, mnemonic, mode, clocks, operand, length = op
+    fmt = {'IMP': '', 'ACC': ' A', 'IMM': ' #$%02X', 'ZP': ' $%02X', 'ZPX': ' $%02X,X', 'ZPY': ' $%02X,Y',
+           'IX': ' ($%02X,X)', 'IY': ' ($%02X),Y', 'ABS': ' $%04X', 'ABSX': ' $%04X,X', 'ABSY': ' $%04X,Y',
+           'IND': ' ($%04X)', 'REL': ' $%04X'}[mode]
+    if mode == 'REL':
+        operand = (addr + 2 + (operand ^ 0x80) - 0x80) & 0xffff
+    return mnemonic + (fmt % operand if '%' in fmt else fmt)
+
+
+class Writer:
+    def __init__(self, games):
+        self.games = games
+        # Every instruction of a block is an entry ( a slice may end anywhere in it ),
+        # ( game, bank, PC ) -> entry number in the order of g_dwAotKeys[]
+        self.index = {}
+        self.keys = []
+        for g, game in enumerate(games):
+            entries = set()
+            for (bank, pc), (insns, end) in game.blocks.items():
+                entries.update((bank, addr) for addr, op in insns)
+            self.keys.append(sorted(entries))
+            for key in self.keys[g]:
+                self.index[(g, ) + key] = len(self.index)
+        self.targets = set()
+        self.emitted = set()
+
+    def chain(self, g, bank, addr, pc):
+        # Jump straight to a block in the same window ( so in the same bank )
+        n = self.index.get((g, bank, pc))
+        if n is not None and (pc & 0xe000) == (addr & 0xe000):
+            self.targets.add(n)
+            return 'AOT_CHAIN(%d);' % n
+        return 'AOT_LOOKUP();'
+
+    def block(self, g, bank, pc):
+        insns, (end, nxt) = self.games[g].blocks[(bank, pc)]
+        out = []
+        for i, (addr, op) in enumerate(insns):
+            code, mnemonic, mode, clocks, operand, length = op
+            n = self.index[(g, bank, addr)]
+            if i and n not in self.emitted:
+                out.append('AOT_BLOCK(%d) // %04X' % (n, addr))
+            self.emitted.add(n)
+            out.append('AOT_OP(0x%04X, 0x%02X); // %s' % (addr, code, disassemble(addr, op)))
+            nxt_addr = (addr + length) & 0xffff
+            if mnemonic in BRANCH:
+                target = (nxt_addr + (operand ^ 0x80) - 0x80) & 0xffff
+                cross = ((addr + 1) ^ (target - 1)) & 0x100 != 0
+                out.append('if (%s)' % BRANCH[mnemonic])
+                out.append('{')
+                out.append('  CLK(%d);' % (3 + cross))
+                out.append('  PC = 0x%04X;' % target)
+                out.append('  IDLE_CHECK(0x%04X);' % addr)
+                out.append('  ' + self.chain(g, bank, addr, target))
+                out.append('}')
+                out.append('CLK(2);')
+                out.append('PC = 0x%04X;' % nxt_addr)
+                out.append(self.chain(g, bank, addr, nxt_addr))
+            elif mnemonic == 'JSR':
+                out.append('PUSHW(0x%04X);' % ((nxt_addr - 1) & 0xffff))
+                out.append('PC = 0x%04X;' % operand)
+                out.append('CLK(6);')
+                out.append(self.chain(g, bank, addr, operand))
+            elif mnemonic == 'JMP' and mode == 'ABS':
+                out.append('PC = 0x%04X;' % operand)
+                out.append('CLK(3);')
+                out.append(self.chain(g, bank, addr, operand))
+            elif mnemonic == 'JMP':
+                out.append('PC = K6502_ReadW2(0x%04X);' % operand)
+                out.append('CLK(5);')
+                out.append('AOT_LOOKUP();')
+            elif mnemonic == 'RTS':
+                out.append('POPW(PC);')
+                out.append('++PC;')
+                out.append('CLK(6);')
+                out.append('AOT_LOOKUP();')
+            else:
+                if mnemonic in READ_OPS:
+                    body = '%s(%s);' % (mnemonic, value(mode, operand))
+                elif mode == 'ACC':
+                    body = '%sA;' % mnemonic
+                elif mnemonic in ADDRESS_OPS:
+                    body = '%s(%s);' % (mnemonic, address(mode, operand))
+                else:
+                    body = IMPLIED[mnemonic]
+                out.append((body + ' ' if body else '') + 'CLK(%d);' % clocks)
+        if end != 'exit':
+            out.append('PC = 0x%04X;' % nxt)
+            last = insns[-1][0] if insns else pc
+            out.append(self.chain(g, bank, last, nxt) if end == 'chain' else 'AOT_LOOKUP();')
+        return out
+
+    def write(self, f, argv):
+        bodies = []
+        for g, game in enumerate(self.games):
+            for bank, pc in sorted(game.blocks):
+                if self.index[(g, bank, pc)] not in self.emitted:
+                    bodies.append((g, bank, pc, self.block(g, bank, pc)))
+
+        f.write('/*\n')
+        f.write(' *  Recompiled ROM code for K6502.cpp, do not edit\n')
+        f.write(' *  Generated by k6502_aot_gen.py %s\n' % ' '.join(argv))
+        f.write(' */\n\n')
+        f.write('#ifdef K6502_AOT_TABLES\n')
+        f.write('static const struct aot_game_tag g_AotGames[] = {\n')
+        n = 0
+        for g, game in enumerate(self.games):
+            f.write('    {0x%x, 0x%08x, %d, %d}, /* %s */\n' %
+                    (len(game.prg), fnv1a(game.prg), n, len(self.keys[g]), game.name))
+            n += len(self.keys[g])
+        f.write('};\n\n')
+        f.write('static const DWORD g_dwAotKeys[] = {\n')
+        for g, game in enumerate(self.games):
+            for bank, pc in self.keys[g]:
+                f.write('    0x%02x%04x,\n' % (bank, pc))
+        f.write('};\n')
+        f.write('#else\n')
+        for g, bank, pc, body in bodies:
+            n = self.index[(g, bank, pc)]
+            label = ' AOT_TARGET(%d)' % n if n in self.targets else ''
+            f.write('AOT_BLOCK(%d)%s // %s %d:%04X\n' % (n, label, self.games[g].name, bank, pc))
+            for line in body:
+                f.write('  %s\n' % line)
+        f.write('#endif\n')
+
+
+def entry(text):
+    try:
+        bank, addr = text.split(':')
+        return int(bank, 0), int(addr, 16)
+    except ValueError:
+        raise argparse.ArgumentTypeError('%s is not BANK:ADDR' % text)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Recompile the PRG-ROM code of NES games for K6502')
+    parser.add_argument('roms', nargs='+', metavar='rom.nes')
+    parser.add_argument('-o', '--output', required=True, help='the file to write')
+    parser.add_argument('--entry', type=entry, action='append', default=[],
+                        metavar='BANK:ADDR', help='more code to trace ( 8KB bank : hex address )')
+    args = parser.parse_args()
+
+    games = [Game(path, args.entry) for path in args.roms]
+    with open(args.output, 'w') as f:
+        Writer(games).write(f, [os.path.basename(p) for p in args.roms])
+    for game in games:
+        print('%s: %d blocks, %d instructions' %
+              (game.name, len(game.blocks), sum(len(b[0]) for b in game.blocks.values())))
+
+
+if __name__ == '__main__':
+    main()
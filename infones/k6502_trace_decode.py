@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+
+# Decoder of the instruction trace of K6502 ( K6502_TRACE ).
+#
+#   k6502_trace_decode.py [--bank] [uart.log]
+#
+# K6502_TraceDump() prints the last executed instructions between a
+# "K6502 TRACE <entries> <size>" line and a "K6502 TRACE END" line, an
+# entry as the hex digits of struct trace_tag of K6502.cpp. The lines are
+# picked out of a log ( e.g. a capture of the UART, other lines are
+# skipped ) and printed as a nestest style listing:
+#
+#   C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD CYC:7
+#
+# The registers are the ones before the instruction. With --bank, the
+# address is prefixed by the 8KB PRG-ROM bank that it was run from.
+
+import argparse
+import os
+import struct
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from k6502_aot_gen import OPCODES, LENGTH, disassemble  # noqa: E402
+
+# struct trace_tag ( little endian )
+ENTRY = struct.Struct('<IHBBBBBBBBBx')
+
+# Opcodes that the recompiler leaves out
+OTHER_OPCODES = {0x00: ('BRK', 'IMP'), 0x40: ('RTI', 'IMP'), 0x58: ('CLI', 'IMP')}
+
+
+def decode(code, operand, addr):
+    if code in OPCODES:
+        mnemonic, mode, clocks = OPCODES[code]
+    elif code in OTHER_OPCODES:
+        mnemonic, mode = OTHER_OPCODES[code]
+    else:
+        return [code], '.DB $%02X' % code
+    length = LENGTH[mode]
+    raw = [code] + list(operand[:length - 1])
+    value = operand[0] if length == 2 else operand[0] | operand[1] << 8
+    return raw, disassemble(addr, (code, mnemonic, mode, 0, value, length))
+
+
+def entries(lines):
+    """The entries of every trace in the log, oldest first"""
+    size = None
+    for line in lines:
+        line = line.strip()
+        if line.startswith('K6502 TRACE END'):
+            size = None
+        elif line.startswith('K6502 TRACE'):
+            fields = line.split()
+            size = int(fields[3]) if len(fields) > 3 else ENTRY.size
+            if size != ENTRY.size:
+                raise SystemExit('entries of %d bytes, %d expected' % (size, ENTRY.size))
+            yield None
+        elif size:
+            try:
+                data = bytes.fromhex(line)
+            except ValueError:
+                continue
+            if len(data) == size:
+                yield ENTRY.unpack(data)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Print the K6502 trace of a log nestest style')
+    parser.add_argument('log', nargs='?', help='log with the output of K6502_TraceDump() ( stdin )')
+    parser.add_argument('--bank', action='store_true', help='prefix addresses with the PRG-ROM bank')
+    args = parser.parse_args()
+
+    f = open(args.log, errors='replace') if args.log else sys.stdin
+    traces = 0
+    for entry in entries(f):
+        if entry is None:
+            if traces:
+                print()
+            traces += 1
+            continue
+
+        clock, pc, code, op1, op2, a, x, y, sp, p, bank = entry
+        raw, text = decode(code, (op1, op2), pc)
+        addr = '%04X' % pc
+        if args.bank:
+            addr = ('RAM:' if bank == 0xff else '%02X:' % bank) + addr
+        print('%s  %-8s  %-31s A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%d' %
+              (addr, ' '.join('%02X' % b for b in raw), text, a, x, y, p, sp, clock))
+
+    if not traces:
+        print('no K6502 TRACE in the log', file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -6,6 +6,7 @@
 
 BYTE  Map73_IRQ_Enable;
 DWORD Map73_IRQ_Cnt;
+QWORD Map73_IRQ_Clock;   /* Master clock that Map73_IRQ_Cnt is counted to */
 
 /*-------------------------------------------------------------------*/
 /*  Initialize Mapper 73                                             */
@@ -31,7 +32,7 @@ void Map73_Init()
   MapperVSync = Map0_VSync;
 
   /* Callback at HSync */
-  MapperHSync = Map73_HSync;
+  MapperHSync = Map0_HSync;
 
   /* Callback at PPU */
   MapperPPU = Map0_PPU;
@@ -51,6 +52,10 @@ void Map73_Init()
   /* Initialize IRQ Registers */
   Map73_IRQ_Enable = 0;
   Map73_IRQ_Cnt = 0;  
+  Map73_IRQ_Clock = 0;
+
+  /* The IRQ counter runs in CPU clocks */
+  InfoNES_SetEventHandler( EVENT_MAPPER_IRQ, Map73_IrqEvent );
 
   /* Set up wiring of the interrupt pin */
   K6502_Set_Int_Wiring( 1, 1 ); 
@@ -61,6 +66,12 @@ void Map73_Init()
 /*-------------------------------------------------------------------*/
 void Map73_Write( WORD wAddr, BYTE byData )
 {
+  /* The counter runs while the IRQ is enabled, count it up to now
+     ( before the counter or the enable changes ) */
+  const bool bCounter = wAddr >= 0x8000 && wAddr <= 0xb000;
+  if ( ( bCounter || wAddr == 0xc000 ) && ( Map73_IRQ_Enable & 0x02 ) )
+    Map73_IRQ_Cnt += (DWORD)( ( InfoNES_MasterClock() - Map73_IRQ_Clock ) / CLOCKS_PER_CPU );
+
   switch ( wAddr )
   {
     case 0x8000:
@@ -81,6 +92,14 @@ void Map73_Write( WORD wAddr, BYTE byData )
 
     case 0xc000:
       Map73_IRQ_Enable = byData;
+      if ( Map73_IRQ_Enable & 0x02 )
+      {
+        Map73_ScheduleIrq();
+      }
+      else
+      {
+        InfoNES_CancelEvent( EVENT_MAPPER_IRQ );
+      }
       break;
 
     /* Set ROM Banks */
@@ -91,37 +110,37 @@ void Map73_Write( WORD wAddr, BYTE byData )
       ROMBANK1 = ROMPAGE( byData + 1 );
       break;
   }
+
+  /* A new counter while it runs overflows at another time */
+  if ( bCounter && ( Map73_IRQ_Enable & 0x02 ) )
+    Map73_ScheduleIrq();
 }
 
 /*-------------------------------------------------------------------*/
-/*  Mapper 73 H-Sync Function                                        */
+/*  Mapper 73 IRQ Schedule Function                                  */
 /*-------------------------------------------------------------------*/
-void Map73_HSync()
+void Map73_ScheduleIrq()
 {
 /*
- *  Callback at HSync
+ *  Schedule the IRQ when the counter overflows, counting from now
  *
  */
-#if 1
-  if ( Map73_IRQ_Enable & 0x02 )
-  {
-    if ( ( Map73_IRQ_Cnt += STEP_PER_SCANLINE ) > 0xffff )
-    {
-      Map73_IRQ_Cnt &= 0xffff;
-      IRQ_REQ;
-      Map73_IRQ_Enable = 0;
-    }
-  }
-#else
-  if ( Map73_IRQ_Enable )
-  {
-    if ( Map73_IRQ_Cnt > 0xffff - 114 )
-    {
-      IRQ_REQ;
-      Map73_IRQ_Enable = 0;
-    } else {
-      Map73_IRQ_Cnt += 114;
-    }
-  }
-#endif
+  Map73_IRQ_Cnt &= 0xffff;
+  Map73_IRQ_Clock = InfoNES_MasterClock();
+  InfoNES_ScheduleEvent( EVENT_MAPPER_IRQ, Map73_IRQ_Clock +
+                         ( 0x10000 - Map73_IRQ_Cnt ) * CLOCKS_PER_CPU );
+}
+
+/*-------------------------------------------------------------------*/
+/*  Mapper 73 IRQ Event Function                                     */
+/*-------------------------------------------------------------------*/
+void Map73_IrqEvent()
+{
+/*
+ *  Callback when the IRQ counter overflows
+ *
+ */
+  Map73_IRQ_Cnt = 0;
+  IRQ_REQ;
+  Map73_IRQ_Enable = 0;
 }
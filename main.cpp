@@ -9,6 +9,7 @@
 #include "hardware/timer.h"
 #include "hardware/clocks.h"
 #include "hardware/vreg.h"
+#include "hardware/watchdog.h"
 #include <hardware/sync.h>
 #include <pico/multicore.h>
 #include <hardware/flash.h>
@@ -24,6 +25,7 @@
 #include <InfoNES.h>
 #include <InfoNES_System.h>
 #include <InfoNES_pAPU.h>
+#include <K6502.h>
 
 #include <dvi/dvi.h>
 #include <tusb.h>
@@ -37,8 +39,8 @@ const uint LED_PIN = PICO_DEFAULT_LED_PIN;
 #define DVICONFIG dviConfig_AdafruitMetroRP2350 // dviConfig_PimoroniDemoDVSock
 #endif
 
-uint8_t framebuffer1[320 * 240];
-uint8_t framebuffer2[320 * 240];
+alignas(4) uint8_t framebuffer1[320 * 240];
+alignas(4) uint8_t framebuffer2[320 * 240];
 uint8_t *framebufferCore0 = framebuffer1;
 
 // Shared state
@@ -54,6 +56,11 @@ namespace
 {
     constexpr uint32_t CPUFreqKHz = 252000; // 324000; // 252000;
 
+#ifdef K6502_TRACE
+    // No frame for this long resets the chip, the trace is dumped at start up
+    constexpr uint32_t TRACE_WATCHDOG_MS = 3000;
+#endif
+
     constexpr dvi::Config dviConfig_PicoDVI = {
         .pinTMDS = {10, 12, 14},
         .pinClock = 8,
@@ -253,6 +260,8 @@ void InfoNES_PadState(DWORD *pdwPad1, DWORD *pdwPad2, DWORD *pdwSystem)
             }
             if (pushed & START)
             {
+                // The last instructions of a game that hung
+                K6502_TraceDump();
                 saveNVRAM();
                 reset = true;
             }
@@ -390,10 +399,67 @@ void __not_in_flash_func(InfoNES_SoundOutput)(int samples, BYTE *wave1, BYTE *wa
     }
 }
 
-extern WORD PC;
+// Report the interpreter and the speed of the emulated CPU every 600 emulated frames ( and the frame skip and the caches ),
+// checked on the drawn frames
+void reportCpuSpeed()
+{
+    static DWORD lastFrames;
+    if (EmulatedFrames - lastFrames < 600)
+    {
+        return;
+    }
+    lastFrames = EmulatedFrames;
+    if (CpuMicrosPerFrame)
+    {
+        printf("CPU (%s): %.2f emulated MHz, %lu us/frame\n", K6502_CoreName(),
+               (double)CpuClocksPerFrame / CpuMicrosPerFrame, (unsigned long)CpuMicrosPerFrame);
+    }
+#if INFONES_AUTO_FRAMESKIP
+    printf("Frame skip: %d, %lu us/frame, %lu missed deadlines\n", FrameSkip,
+           (unsigned long)FrameMicros, (unsigned long)FrameDeadlineMisses);
+#endif
+#if INFONES_DRAW8 && INFONES_BG_CACHE
+    const DWORD tiles = BgCacheHitsPerFrame + BgCacheMissesPerFrame;
+    printf("BG cache: %lu bytes, %.1f%% hits, %lu tiles rendered, %lu lines bypassed\n",
+           (unsigned long)BgCacheBytes, tiles ? BgCacheHitsPerFrame * 100.0 / tiles : 0.0,
+           (unsigned long)BgCacheMissesPerFrame, (unsigned long)BgCacheBypassesPerFrame);
+#endif
+#if INFONES_CHR_CACHE
+    const DWORD banks = ChrCacheHitsPerFrame + ChrCacheMissesPerFrame;
+    printf("CHR cache: %lu bytes, %.1f%% hits, %lu banks decoded\n",
+           (unsigned long)ChrCacheBytes, banks ? ChrCacheHitsPerFrame * 100.0 / banks : 0.0,
+           (unsigned long)ChrCacheMissesPerFrame);
+#endif
+}
+
+// Dump the execution profile when 'p' comes in over UART ( 'r' clears it ),
+// and the trace of the last instructions on 't'
+void pollDebugRequest()
+{
+#if defined(K6502_PROFILE) || defined(K6502_TRACE)
+    switch (getchar_timeout_us(0))
+    {
+    case 'p':
+        K6502_ProfileDump();
+        break;
+    case 'r':
+        K6502_ProfileReset();
+        printf("K6502 profile cleared\n");
+        break;
+    case 't':
+        K6502_TraceDump();
+        break;
+    }
+#endif
+}
 
 void InfoNES_LoadFrame()
 {
+    reportCpuSpeed();
+    pollDebugRequest();
+#ifdef K6502_TRACE
+    watchdog_update();
+#endif
 
     gpio_put(LED_PIN, hw_divider_s32_quotient_inlined(dvi_->getFrameCounter(), 60) & 1);
 
@@ -470,14 +536,21 @@ void __not_in_flash_func(drawWorkMeter)(int line)
     // //    util::WorkMeterEnum(160, clocksPerLine * 2, drawWorkMeterUnit);
 }
 
+#if !INFONES_DRAW8
+// 16-bit colours of the line, only the palette indices in the framebuffer are shown
 WORD lineBuffer[320];
+#endif
 void __not_in_flash_func(InfoNES_PreDrawLine)(int line)
 {
     // util::WorkMeterMark(0xaaaa);
     // auto b = dvi_->getLineBuffer();
     // util::WorkMeterMark(0x5555);
     uint8_t *tmpWorkline = &framebufferCore0[line * 320];
+#if INFONES_DRAW8
+    InfoNES_SetLineBuffer(nullptr, tmpWorkline + 32, 320);
+#else
     InfoNES_SetLineBuffer(lineBuffer + 32, tmpWorkline + 32, 320);
+#endif
     //    (*b)[319] = line + dvi_->getFrameCounter();
 
     // currentLineBuffer_ = b;
@@ -497,6 +570,9 @@ void __not_in_flash_func(InfoNES_PostDrawLine)(int line)
 
 bool loadAndReset()
 {
+    // The profile of the former game ( K6502_Reset() clears it )
+    K6502_ProfileDump();
+
     auto rom = romSelector_.getCurrentROM();
     if (!rom)
     {
@@ -594,20 +670,27 @@ void __not_in_flash_func(coreFB_main)()
                 }
                 mutex_exit(&framebuffer_mutex);
             }
+#if INFONES_DEFERRED_RENDER
+            // Scanlines that core0 queued for the framebuffer it draws
+            InfoNES_DeferredRender();
+#endif
             if (may_render)
             {
                 // printf("Core 1: Rendering frame %s %d\n", current_framebuffer == framebuffer1 ? "framebuffer1" : "framebuffer2", frame++);
                 for (int line = 4; line < 240 - 4; ++line)
                 {
+#if INFONES_DEFERRED_RENDER
+                    // Between the lines of the frame shown, core0 is not kept waiting for a frame
+                    InfoNES_DeferredRender();
+#endif
                     uint8_t *current_line = &framebufferCore1[line * 320];
                     for (int kol = 0; kol < 320; kol += 4)
                     {
-                        // buffer[kol] = NesPalette[current_line[kol]];
-                        // NesPalette[current_framebuffer[line * 320 + kol] & 0x3F];
-                        buffer[kol] = NesPalette[current_line[kol]];
-                        buffer[kol + 1] = NesPalette[current_line[kol + 1]];
-                        buffer[kol + 2] = NesPalette[current_line[kol + 2]];
-                        buffer[kol + 3] = NesPalette[current_line[kol + 3]];
+                        // The index has PAL8_BG_CLEAR on the backdrop ( INFONES_DRAW8 )
+                        buffer[kol] = NesPalette[current_line[kol] & 0x3f];
+                        buffer[kol + 1] = NesPalette[current_line[kol + 1] & 0x3f];
+                        buffer[kol + 2] = NesPalette[current_line[kol + 2] & 0x3f];
+                        buffer[kol + 3] = NesPalette[current_line[kol + 3] & 0x3f];
                     }
                     if (scaleMode8_7_)
                     {
@@ -729,9 +812,24 @@ int main()
     mutex_init(&framebuffer_mutex);
 
     multicore_launch_core1(coreFB_main);
+#if INFONES_DEFERRED_RENDER
+    // Scanlines are rendered by coreFB_main()
+    DeferredRenderEnable = 1;
+#endif
 
     memset(framebuffer1, 0x3f, sizeof(framebuffer1));
     memset(framebuffer2, 0x3f, sizeof(framebuffer2));
+
+#ifdef K6502_TRACE
+    // The trace of a game that stopped drawing frames is left in RAM over the reset
+    if (watchdog_caused_reboot())
+    {
+        printf("Watchdog reset, the last instructions:\n");
+        K6502_TraceDump();
+    }
+    watchdog_enable(TRACE_WATCHDOG_MS, true);
+#endif
+
     InfoNES_Main();
 
     return 0;